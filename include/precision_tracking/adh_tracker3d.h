@@ -33,13 +33,18 @@ public:
   virtual ~ADHTracker3d();
 
   // Estimate the posterior distribution over alignments sampled from the
-  // proposed range in xRange, yRange, zRange.
+  // proposed range in xRange, yRange, zRange.  The xy ranges are given in
+  // a lattice frame which is rotated by lattice_heading (radians) about
+  // the z-axis; set lattice_heading to 0 for an axis-aligned search.
+  // The current points are aligned to prev_points, which are set in the
+  // alignment evaluator before the search.
 	void track(
       const double initial_xy_sampling_resolution,
       const double initial_z_sampling_resolution,
       const std::pair <double, double>& xRange,
 	    const std::pair <double, double>& yRange,
 	    const std::pair <double, double>& zRange,
+      const double lattice_heading,
       const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& current_points,
       const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& prev_points,
       const Eigen::Vector3f& current_points_centroid,
@@ -50,6 +55,51 @@ public:
       ScoredTransforms<ScoredTransformXYZ>* scored_transforms) const;
 
 private:
+  // The precision tracker sets the previous points in the evaluator once
+  // per frame, and shares them between its searches.
+  friend class PrecisionTracker;
+
+  // Same as above, but aligns the current points to the previous points
+  // which are already set in the alignment evaluator (see
+  // AlignmentEvaluator::setPrevPoints); exits with an error if they have
+  // not been set.  The caller is responsible for setting the points of the
+  // current object, not those of an earlier one.
+  void trackPrevPointsSet(
+      const double initial_xy_sampling_resolution,
+      const double initial_z_sampling_resolution,
+      const std::pair <double, double>& xRange,
+      const std::pair <double, double>& yRange,
+      const std::pair <double, double>& zRange,
+      const double lattice_heading,
+      const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& current_points,
+      const Eigen::Vector3f& current_points_centroid,
+      const MotionModel& motion_model,
+      const double xy_sensor_resolution,
+      const double z_sensor_resolution,
+      boost::shared_ptr<AlignmentEvaluator> alignment_evaluator,
+      ScoredTransforms<ScoredTransformXYZ>* scored_transforms) const;
+
+  // Same as trackPrevPointsSet, but compiled for the given type of
+  // evaluator, so that no virtual calls are made while scoring the
+  // transforms.  trackPrevPointsSet looks up the type of the evaluator once
+  // and then calls this function.  Instantiated for each of the evaluators
+  // in adh_tracker3d.cpp.
+  template <class Evaluator>
+  void track(
+      const double initial_xy_sampling_resolution,
+      const double initial_z_sampling_resolution,
+      const std::pair <double, double>& xRange,
+      const std::pair <double, double>& yRange,
+      const std::pair <double, double>& zRange,
+      const double lattice_heading,
+      const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& current_points,
+      const Eigen::Vector3f& current_points_centroid,
+      const MotionModel& motion_model,
+      const double xy_sensor_resolution,
+      const double z_sensor_resolution,
+      Evaluator* alignment_evaluator,
+      ScoredTransforms<ScoredTransformXYZ>* scored_transforms) const;
+
   const Params *params_;
 
   // Compute the joint probability of each cell and the region, given
@@ -63,6 +113,7 @@ private:
       const double new_xy_resolution, const double new_z_resolution,
       const double old_xy_sampling_resolution,
       const double old_z_sampling_resolution,
+      const double lattice_cos, const double lattice_sin,
       ScoredTransforms<ScoredTransformXYZ>* scored_transforms,
       std::vector<XYZTransform>* new_xyz_transforms,
       double* total_recomputing_prob) const;
@@ -74,6 +125,7 @@ private:
       const std::pair <double, double>& xRange,
       const std::pair <double, double>& yRange,
       const std::pair <double, double>& zRange_orig,
+      const double lattice_cos, const double lattice_sin,
       std::vector<XYZTransform>* transforms) const;
 };
 
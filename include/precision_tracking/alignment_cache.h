@@ -0,0 +1,79 @@
+/*
+ * alignment_cache.h
+ *
+ * On-disk cache of the alignments computed without a motion prior for
+ * pairs of frames (see Tracker::alignWithoutPrior).  These alignments only
+ * depend on the points and on the measurement parameters, so they can be
+ * reused across runs which only change the motion model parameters (e.g.
+ * kPropagationVarianceXY or useMean) when tuning the tracker.
+ *
+ */
+
+#ifndef __PRECISION_TRACKING__ALIGNMENT_CACHE_H
+#define __PRECISION_TRACKING__ALIGNMENT_CACHE_H
+
+#include <string>
+
+#include <boost/cstdint.hpp>
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+#include <precision_tracking/scored_transform.h>
+#include <precision_tracking/params.h>
+
+namespace precision_tracking {
+
+// Bump this whenever a change to the tracker changes the alignments, to
+// invalidate existing caches.
+const int ALIGNMENT_CACHE_VERSION = 4;
+
+class AlignmentCache {
+public:
+  // The cache files are stored in cache_dir, which must already exist.
+  AlignmentCache(const std::string& cache_dir, const Params *params);
+
+  // Load the alignment of the current points to the previous points.
+  // Returns false if the alignment is not in the cache.
+  bool load(
+      const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& previous_points,
+      const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& current_points,
+      const double sensor_horizontal_resolution,
+      const double sensor_vertical_resolution,
+      ScoredTransforms<ScoredTransformXYZ>* scored_transforms) const;
+
+  // Save the alignment of the current points to the previous points.
+  // Safe to call concurrently from several threads or processes.
+  bool save(
+      const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& previous_points,
+      const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& current_points,
+      const double sensor_horizontal_resolution,
+      const double sensor_vertical_resolution,
+      const ScoredTransforms<ScoredTransformXYZ>& scored_transforms) const;
+
+private:
+  std::string getFilename(
+      const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& previous_points,
+      const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& current_points,
+      const double sensor_horizontal_resolution,
+      const double sensor_vertical_resolution) const;
+
+  std::string cache_dir_;
+
+  // Hash of the parameters which affect the alignments.
+  boost::uint64_t params_hash_;
+};
+
+// Hash of all of the parameters which affect the alignments computed
+// without a motion prior, i.e. all parameters except for the motion model
+// and tracker sections.  New measurement parameters must be added here.
+boost::uint64_t hashMeasurementParams(const Params& params);
+
+// Hash of all of the parameters, e.g. to check that a saved tracker state
+// is restored with the same params (see Tracker::loadState).  New motion
+// model and tracker parameters must be added here.
+boost::uint64_t hashParams(const Params& params);
+
+} // namespace precision_tracking
+
+#endif // __PRECISION_TRACKING__ALIGNMENT_CACHE_H
@@ -12,6 +12,9 @@
 #ifndef __PRECISION_TRACKING__ALIGNMENT_EVALUATOR_H
 #define __PRECISION_TRACKING__ALIGNMENT_EVALUATOR_H
 
+#include <algorithm>
+#include <vector>
+
 #include <pcl/point_types.h>
 #include <pcl/point_cloud.h>
 
@@ -30,6 +33,11 @@ public:
   virtual void setPrevPoints(
       const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr prev_points);
 
+  // The points set by setPrevPoints, or NULL if they have not been set.
+  const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& getPrevPoints() const {
+    return prev_points_;
+  }
+
   // Compute the probability of each of the transforms being the
   // correct alignment of the current points to the previous points.
   virtual void score3DTransforms(
@@ -43,6 +51,32 @@ public:
       const MotionModel& motion_model,
       ScoredTransforms<ScoredTransformXYZ>* scored_transforms);
 
+  // Same as score3DTransforms.  Evaluators derived from
+  // AlignmentEvaluatorImpl hide this with a version that does not make a
+  // virtual call per transform, so templates over the evaluator type (such
+  // as ADHTracker3d::track) should call this function.
+  void scoreXYZTransforms(
+      const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& current_points,
+      const Eigen::Vector3f& current_points_centroid,
+      const double xy_sampling_resolution,
+      const double z_sampling_resolution,
+      const double sensor_horizontal_resolution,
+      const double sensor_vertical_resolution,
+      const std::vector<XYZTransform>& transforms,
+      const MotionModel& motion_model,
+      ScoredTransforms<ScoredTransformXYZ>* scored_transforms) {
+    score3DTransforms(current_points, current_points_centroid,
+                      xy_sampling_resolution, z_sampling_resolution,
+                      sensor_horizontal_resolution,
+                      sensor_vertical_resolution, transforms, motion_model,
+                      scored_transforms);
+  }
+
+  // Total number of (point, transform) pairs scored so far, for
+  // measuring the cost per scored point.
+  size_t getNumScoredPoints() const { return num_scored_points_; }
+  void resetNumScoredPoints() { num_scored_points_ = 0; }
+
 protected:
   virtual void init(const double xy_sampling_resolution,
             const double z_sampling_resolution,
@@ -85,8 +119,168 @@ protected:
   // How much to discount the measurement model, based on dependencies
   // between points.
   double measurement_discount_factor_;
+
+  size_t num_scored_points_;
+};
+
+// Number of transforms which are scored together by
+// AlignmentEvaluatorImpl::getLogProbabilities.
+const size_t kTransformBlockSize = 8;
+
+// Base class for evaluators which scores the transforms using
+// Derived::init and Derived::getLogProbability directly, so that they can be
+// inlined into the loop over the transforms (static polymorphism).  Derived
+// must declare AlignmentEvaluatorImpl<Derived> as a friend, and must define
+// getLogProbability, getLogProbabilities or both, since by default each one
+// calls the other.  The virtual API of AlignmentEvaluator is kept as a
+// wrapper around these functions.
+template <class Derived>
+class AlignmentEvaluatorImpl : public AlignmentEvaluator
+{
+public:
+  explicit AlignmentEvaluatorImpl(const Params *params)
+    : AlignmentEvaluator(params) {}
+
+  virtual void score3DTransforms(
+      const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& current_points,
+      const Eigen::Vector3f& current_points_centroid,
+      const double xy_sampling_resolution,
+      const double z_sampling_resolution,
+      const double sensor_horizontal_resolution,
+      const double sensor_vertical_resolution,
+      const std::vector<XYZTransform>& transforms,
+      const MotionModel& motion_model,
+      ScoredTransforms<ScoredTransformXYZ>* scored_transforms) {
+    scoreXYZTransforms(current_points, current_points_centroid,
+                       xy_sampling_resolution, z_sampling_resolution,
+                       sensor_horizontal_resolution,
+                       sensor_vertical_resolution, transforms, motion_model,
+                       scored_transforms);
+  }
+
+  void scoreXYZTransforms(
+      const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& current_points,
+      const Eigen::Vector3f& current_points_centroid,
+      const double xy_sampling_resolution,
+      const double z_sampling_resolution,
+      const double sensor_horizontal_resolution,
+      const double sensor_vertical_resolution,
+      const std::vector<XYZTransform>& transforms,
+      const MotionModel& motion_model,
+      ScoredTransforms<ScoredTransformXYZ>* scored_transforms);
+
+protected:
+  // Get the probability of the translation (x, y, z) applied to the
+  // current points.  By default this scores a block containing only this
+  // transform with Derived::getLogProbabilities.
+  virtual double getLogProbability(
+      const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& current_points,
+      const Eigen::Vector3f& current_points_centroid,
+      const MotionModel& motion_model,
+      const double delta_x, const double delta_y, const double delta_z);
+
+  // Get the probability of each of the num_transforms (at most
+  // kTransformBlockSize) transforms.  By default this calls
+  // Derived::getLogProbability for each transform; evaluators can hide this
+  // with a version that scores all of the transforms in a single pass over
+  // the points.
+  void getLogProbabilities(
+      const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& current_points,
+      const Eigen::Vector3f& current_points_centroid,
+      const MotionModel& motion_model,
+      const XYZTransform* transforms, const size_t num_transforms,
+      double* log_probs);
 };
 
+template <class Derived>
+double AlignmentEvaluatorImpl<Derived>::getLogProbability(
+    const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& current_points,
+    const Eigen::Vector3f& current_points_centroid,
+    const MotionModel& motion_model,
+    const double delta_x, const double delta_y, const double delta_z)
+{
+  const XYZTransform transform(delta_x, delta_y, delta_z, 0);
+  double log_prob;
+
+  // Qualify the call so that it is not dispatched virtually.
+  static_cast<Derived*>(this)->Derived::getLogProbabilities(
+        current_points, current_points_centroid, motion_model, &transform, 1,
+        &log_prob);
+
+  return log_prob;
+}
+
+template <class Derived>
+void AlignmentEvaluatorImpl<Derived>::getLogProbabilities(
+    const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& current_points,
+    const Eigen::Vector3f& current_points_centroid,
+    const MotionModel& motion_model,
+    const XYZTransform* transforms, const size_t num_transforms,
+    double* log_probs)
+{
+  Derived* evaluator = static_cast<Derived*>(this);
+  for (size_t i = 0; i < num_transforms; ++i) {
+    // Qualify the call so that it is not dispatched virtually.
+    log_probs[i] = evaluator->Derived::getLogProbability(
+          current_points, current_points_centroid, motion_model,
+          transforms[i].x, transforms[i].y, transforms[i].z);
+  }
+}
+
+template <class Derived>
+void AlignmentEvaluatorImpl<Derived>::scoreXYZTransforms(
+    const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& current_points,
+    const Eigen::Vector3f& current_points_centroid,
+    const double xy_sampling_resolution,
+    const double z_sampling_resolution,
+    const double sensor_horizontal_resolution,
+    const double sensor_vertical_resolution,
+    const std::vector<XYZTransform>& transforms,
+    const MotionModel& motion_model,
+    ScoredTransforms<ScoredTransformXYZ>* scored_transforms)
+{
+  Derived* evaluator = static_cast<Derived*>(this);
+
+  // Initialize variables for tracking grid.
+  const size_t num_current_points = current_points->size();
+  evaluator->Derived::init(xy_sampling_resolution, z_sampling_resolution,
+                           sensor_horizontal_resolution,
+                           sensor_vertical_resolution, num_current_points);
+
+  const size_t num_transforms = transforms.size();
+  num_scored_points_ += num_transforms * num_current_points;
+
+  // Compute scores for all of the transforms.
+  scored_transforms->clear();
+  scored_transforms->resize(num_transforms);
+
+  // Score the transforms in blocks, so that evaluators can score all of the
+  // transforms in a block in a single pass over the points.  Consecutive
+  // transforms are neighbors in the sampling lattice, so they mostly look
+  // up nearby values.
+  double log_probs[kTransformBlockSize];
+  for (size_t start = 0; start < num_transforms;
+       start += kTransformBlockSize) {
+    const size_t num_block_transforms =
+        std::min(kTransformBlockSize, num_transforms - start);
+
+    // Qualify the call so that it is not dispatched virtually.
+    evaluator->Derived::getLogProbabilities(
+          current_points, current_points_centroid, motion_model,
+          &transforms[start], num_block_transforms, log_probs);
+
+    for (size_t i = 0; i < num_block_transforms; ++i) {
+      const XYZTransform& transform = transforms[start + i];
+
+      // Save the complete transform with its log probability.
+      const ScoredTransformXYZ scored_transform(
+            transform.x, transform.y, transform.z, log_probs[i],
+            transform.volume);
+      scored_transforms->set(scored_transform, start + i);
+    }
+  }
+}
+
 } // namespace precision_tracking
 
 #endif // __PRECISION_TRACKING__ALIGNMENT_EVALUATOR_H
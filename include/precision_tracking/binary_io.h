@@ -0,0 +1,33 @@
+/*
+ * binary_io.h
+ *
+ * Helpers for the compact binary serialization of the tracker state (see
+ * Tracker::saveState).  Values are written with their in-memory
+ * representation, so the state can only be restored on a machine with the
+ * same architecture.
+ *
+ */
+
+#ifndef __PRECISION_TRACKING__BINARY_IO_H
+#define __PRECISION_TRACKING__BINARY_IO_H
+
+#include <iostream>
+
+namespace precision_tracking {
+
+// Write a value, which must be a plain type or a fixed-size Eigen matrix.
+template <class T>
+void writeBinary(const T& value, std::ostream& out) {
+  out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+// Read a value written by writeBinary.  Returns false if the stream ended.
+template <class T>
+bool readBinary(std::istream& in, T* value) {
+  in.read(reinterpret_cast<char*>(value), sizeof(T));
+  return in.good();
+}
+
+} // namespace precision_tracking
+
+#endif // __PRECISION_TRACKING__BINARY_IO_H
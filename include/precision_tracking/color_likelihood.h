@@ -0,0 +1,154 @@
+/*
+ * color_likelihood.h
+ *
+ * The color term of the likelihood field model, shared by the
+ * LF_RGBD_6D_Evaluator and the LF_RGBD_2D_Evaluator.  The probability of
+ * matching a point to its nearest neighbor is the spatial match probability
+ * times a Laplacian of the distance between their colors (in the color
+ * space given by params.kColorSpace), plus a smoothing term.  The Laplacians
+ * and the match probabilities are tabulated for every color distance.
+ *
+ */
+
+#ifndef __PRECISION_TRACKING__COLOR_LIKELIHOOD_H
+#define __PRECISION_TRACKING__COLOR_LIKELIHOOD_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include <pcl/point_types.h>
+
+#include <precision_tracking/params.h>
+
+namespace precision_tracking {
+
+// The number of possible values of a color channel.
+const int kNumColors = 256;
+
+// Get the colors of a point in the color space given by params.kColorSpace.
+template <int ColorSpace>
+inline int getFirstColor(const pcl::PointXYZRGB& pt) {
+  if (ColorSpace == 0) {
+    // Blue.
+    return pt.b;
+  } else {
+    // Mean of RGB.
+    return (pt.r + pt.g + pt.b) / 3;
+  }
+}
+
+template <int ColorSpace>
+inline int getSecondColor(const pcl::PointXYZRGB& pt) {
+  if (ColorSpace == 0) {
+    // Green.
+    return pt.g;
+  } else {
+    // The mean of RGB only has one color.
+    return 0;
+  }
+}
+
+// Call selector->select<UseColor, TwoColors, ColorSpace>() for the color
+// model given by the params, so that the evaluators can choose kernels
+// which are specialized on the color model at compile time.
+template <class Selector>
+void selectColorModel(const Params& params, const bool use_color,
+                      Selector* selector);
+
+class ColorLikelihood {
+public:
+  // smoothing_factor is the smoothing factor of the measurement model
+  // without color.
+  ColorLikelihood(const Params *params, const double smoothing_factor);
+
+  // Recompute the color match probabilities for the sampling resolution of
+  // the transforms - when we are sampling sparsely, we do not expect the
+  // colors to align well.
+  void init(const double xy_sampling_resolution,
+            const double z_sampling_resolution);
+
+  // Compute the probability of matching a point to a neighbor with the
+  // given color distances, given the probability of the spatial match.
+  template <bool TwoColors>
+  double computeColorProb(const int color_distance1,
+                          const int color_distance2,
+                          const double point_match_prob_spatial_i) const;
+
+  // The probability of a point which does not match any neighbor.
+  double getSmoothingFactor() const { return color_smoothing_factor_; }
+
+private:
+  const Params *params_;
+
+  // Color parameters.
+  double color_exp_factor1_;
+  double color_exp_factor2_;
+  double prob_color_match_;
+
+  // The color Laplacians exp(color_distance * color_exp_factor) for each
+  // color distance from 0 to 255.
+  std::vector<double> color_exps1_;
+  std::vector<double> color_exps2_;
+
+  // The probability of the color match for each distance of the first color
+  // (including prob_color_match_), which is recomputed in init.
+  std::vector<double> color_match_probs1_;
+
+  // For two colors, the probability of matching if the colors do not match.
+  double color_mismatch_prob_;
+
+  // The smoothing factor when using color.
+  double color_smoothing_factor_;
+};
+
+template <class Selector>
+void selectColorModel(const Params& params, const bool use_color,
+                      Selector* selector)
+{
+  if (!use_color) {
+    selector->template select<false, false, 0>();
+  } else if (params.kColorSpace == 0 && params.kTwoColors) {
+    selector->template select<true, true, 0>();
+  } else if (params.kColorSpace == 0) {
+    selector->template select<true, false, 0>();
+  } else if (params.kColorSpace == 1 && params.kTwoColors) {
+    selector->template select<true, true, 1>();
+  } else if (params.kColorSpace == 1) {
+    selector->template select<true, false, 1>();
+  } else {
+    printf("Unknown color space: %d\n", params.kColorSpace);
+    exit(1);
+  }
+}
+
+template <bool TwoColors>
+inline double ColorLikelihood::computeColorProb(
+    const int color_distance1, const int color_distance2,
+    const double point_match_prob_spatial_i) const
+{
+  // Because we are using color, we have to modify the smoothing factor.
+  const double smoothing_factor =
+      color_smoothing_factor_ * (1 - point_match_prob_spatial_i);
+
+  // Compute the probability of the match, using the spatial and color
+  // distance, looking up the color terms in the tables computed in init.
+  double point_match_prob;
+  if (TwoColors) {
+    point_match_prob =
+        point_match_prob_spatial_i *
+        (color_mismatch_prob_ +
+         color_match_probs1_[color_distance1] *
+           -0.5 * color_exp_factor2_ * color_exps2_[color_distance2]);
+  } else {
+    point_match_prob =
+        point_match_prob_spatial_i * color_match_probs1_[color_distance1];
+  }
+  const double point_prob = point_match_prob + smoothing_factor;
+
+  return point_prob;
+}
+
+} // namespace precision_tracking
+
+#endif // __PRECISION_TRACKING__COLOR_LIKELIHOOD_H
@@ -18,11 +18,14 @@
 
 #include <vector>
 
+#include <boost/cstdint.hpp>
+
 #include <pcl/point_types.h>
 #include <pcl/point_cloud.h>
 
 #include <precision_tracking/scored_transform.h>
 #include <precision_tracking/alignment_evaluator.h>
+#include <precision_tracking/spillover_cache.h>
 
 
 struct ScoredTransform;
@@ -31,24 +34,28 @@ class MotionModel;
 
 namespace precision_tracking {
 
-class DensityGrid2dEvaluator : public AlignmentEvaluator {
+class DensityGrid2dEvaluator : public AlignmentEvaluatorImpl<DensityGrid2dEvaluator> {
 public:
   DensityGrid2dEvaluator(const Params *params);
   virtual ~DensityGrid2dEvaluator();
 
 private:
+  friend class AlignmentEvaluatorImpl<DensityGrid2dEvaluator>;
+
   void init(const double xy_sampling_resolution,
             const double z_sampling_resolution,
             const double sensor_horizontal_resolution,
             const double sensor_vertical_resolution,
             const size_t num_current_points);
 
-  // Get the probability of this transform.
-  double getLogProbability(
+  // Get the probability of each of the transforms, in a single pass over
+  // the current points.
+  void getLogProbabilities(
       const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& current_points,
       const Eigen::Vector3f& current_points_centroid,
       const MotionModel& motion_model,
-      const double delta_x, const double delta_y, const double delta_z);
+      const XYZTransform* transforms, const size_t num_transforms,
+      double* log_probs);
 
   void computeDensityGridParameters(
       const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& prev_points,
@@ -56,12 +63,39 @@ private:
       const double xy_sensor_resolution);
 
   // Pre-cache probability values in a density grid for fast lookups.
+  // Cell is double for density_grid_ or int16 for fixed_point_grid_.
+  template <class Cell>
   void computeDensityGrid(
-      const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& prev_points);
+      const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& prev_points,
+      std::vector<std::vector<Cell> >* grid);
+
+  // Set the used part of the grid to the default value.
+  template <class Cell>
+  void resetGrid(const Cell default_val,
+                 std::vector<std::vector<Cell> >* grid) const;
+
+  // For each of the transforms, given by the offset to apply to each
+  // point in grid cells, sum the log densities of the shifted points,
+  // accumulating in Sum.
+  template <class Cell, class Sum>
+  void sumLogDensities(
+      const pcl::PointCloud<pcl::PointXYZRGB>& current_points,
+      const std::vector<std::vector<Cell>  >& grid,
+      const double* x_offsets, const double* y_offsets,
+      const size_t num_transforms,
+      double* total_log_densities) const;
 
   // A grid used to pre-cache probability values for fast lookups.
   std::vector<std::vector<double> > density_grid_;
 
+  // Whether to use fixed_point_grid_ instead of density_grid_.
+  bool use_fixed_point_;
+
+  // The same grid with the log densities multiplied by fixed_point_scale_
+  // and rounded, if params.useFixedPointGrid is set.
+  std::vector<std::vector<boost::int16_t> > fixed_point_grid_;
+  double fixed_point_scale_;
+
   // The size of the resulting grid.
   int xSize_;
   int ySize_;
@@ -78,6 +112,9 @@ private:
   // so we only need to compute the probability at a limited number
   // of grid cells for each point.
   int num_spillover_steps_xy_;
+
+  // The spillover kernel, if it is not taken from the SpilloverCache.
+  SpilloverKernel spillover_kernel_;
 };
 
 } // namespace precision_tracking
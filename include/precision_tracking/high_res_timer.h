@@ -3,7 +3,9 @@
  *
  *      Author: Alex Teichman
  *
- * A class for measuring how long some piece of code takes to run.
+ * A class for measuring how long some piece of code takes to run, and a
+ * class for counting hardware events (cycles, cache misses, etc.) while it
+ * runs.
  *
  */
 
@@ -64,6 +66,67 @@ public:
   ~ScopedTimer();
 };
 
+//! Counts hardware events with the Linux perf_event_open interface, to tell
+//! whether some piece of code is compute-bound or memory-bound.  Like
+//! HighResTimer, the counts are accumulated over each start / stop.
+//! The counters only count events of the thread that constructed this
+//! object, so use one PerfCounters per thread and add them together.
+//! If the counters are not available (e.g. if perf_event_paranoid does not
+//! allow it, or in a virtual machine without a PMU, or on other operating
+//! systems), isAvailable() returns false and all counts are 0.
+class PerfCounters {
+public:
+  enum Event {
+    kCycles,
+    kInstructions,
+    kLLCMisses,
+    kBranchMisses,
+    kNumEvents
+  };
+
+  std::string description_;
+
+  PerfCounters(const std::string& description = "PerfCounters");
+  ~PerfCounters();
+  void start();
+  void stop();
+  void reset();
+  //! Add the counts of another PerfCounters, e.g. from another thread.
+  void add(const PerfCounters& other);
+  //! Whether any of the events / the given event could be counted.
+  bool isAvailable() const;
+  bool isAvailable(const Event event) const;
+  double getCount(const Event event) const;
+  //! Instructions per cycle.
+  double getIPC() const;
+
+  //! If num_items > 0, also reports the misses per item.
+  std::string report(const double num_items = 0,
+                     const std::string& item_name = "item") const;
+  void print(const double num_items = 0,
+             const std::string& item_name = "item") const {
+    std::string report_string = report(num_items, item_name);
+    printf("[COUNTERS] %s\n", report_string.c_str());
+  }
+
+  static const char* getEventName(const Event event);
+
+private:
+  // Non-copyable, since we own the file descriptors.
+  PerfCounters(const PerfCounters&);
+  PerfCounters& operator=(const PerfCounters&);
+
+  // Read the current value of the given event, scaled up to compensate
+  // for the time that the counter was not running when the kernel has to
+  // multiplex the counters.
+  double read(const Event event) const;
+
+  int fds_[kNumEvents];
+  bool available_[kNumEvents];
+  double start_[kNumEvents];
+  double totals_[kNumEvents];
+};
+
 } // namespace precision_tracking
 
 #endif // __PRECISION_TRACKING__HIGH_RES_TIMER_H
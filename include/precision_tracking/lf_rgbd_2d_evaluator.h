@@ -0,0 +1,143 @@
+/*
+ * lf_rgbd_2d_evaluator.h
+ *
+ * Using the likelihood field model from
+ * Probabilistic Robotics, Thrun, et al, 2005.
+ * to evaluate the probability of a given set of translations, with the
+ * previous points projected onto the xy-plane.
+ *
+ * The previous points are binned into a 2D grid, keeping the centroid, the
+ * height range and the mean color of the points in each cell.  A distance
+ * transform of the grid gives the nearest occupied cell to every cell, so
+ * the nearest neighbor of each current point is found with a single lookup
+ * rather than a 3D nearest neighbor search.  The heights are only compared
+ * when searching over vertical translations.  This makes tracking with color
+ * much faster than the LF_RGBD_6D_Evaluator, for trackers which only
+ * estimate the horizontal motion (params.use3D = false, params.maxZ = 0).
+ *
+ */
+
+#ifndef __PRECISION_TRACKING__LF_RGBD_2D_EVALUATOR_H_
+#define __PRECISION_TRACKING__LF_RGBD_2D_EVALUATOR_H_
+
+#include <vector>
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+#include <precision_tracking/motion_model.h>
+#include <precision_tracking/scored_transform.h>
+#include <precision_tracking/alignment_evaluator.h>
+#include <precision_tracking/color_likelihood.h>
+
+namespace precision_tracking {
+
+class LF_RGBD_2D_Evaluator : public AlignmentEvaluatorImpl<LF_RGBD_2D_Evaluator> {
+public:
+  explicit LF_RGBD_2D_Evaluator(const Params *params);
+  virtual ~LF_RGBD_2D_Evaluator();
+
+private:
+  friend class AlignmentEvaluatorImpl<LF_RGBD_2D_Evaluator>;
+
+  // The previous points which fall into one cell of the grid.
+  struct ProjectedCell {
+    // The centroid of the points in the xy-plane.
+    float x;
+    float y;
+
+    // The range of heights of the points.
+    float min_z;
+    float max_z;
+
+    // The mean colors of the points, in the color space given by
+    // params.kColorSpace.
+    unsigned char color1;
+    unsigned char color2;
+  };
+
+  void init(const double xy_sampling_resolution,
+            const double z_sampling_resolution,
+            const double sensor_horizontal_resolution,
+            const double sensor_vertical_resolution,
+            const size_t num_current_points);
+
+  // Get the probability of each of the transforms, in a single pass over
+  // the current points.
+  void getLogProbabilities(
+      const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& current_points,
+      const Eigen::Vector3f& current_points_centroid,
+      const MotionModel& motion_model,
+      const XYZTransform* transforms, const size_t num_transforms,
+      double* log_probs);
+
+  // Bin the previous points into projected_cells_.
+  template <int ColorSpace>
+  void computeProjectedCells();
+
+  // Find the nearest occupied cell to each cell of the grid.
+  void computeDistanceTransform();
+
+  // Choose the kernel below for the current color model.
+  void selectKernels();
+
+  // Sets sum_log_probs_ for the color model (see selectColorModel).
+  struct KernelSelector;
+
+  // For each of the translations, sum the log probabilities of the
+  // translated points.  The kernel is specialized at compile time on
+  // whether we use color, whether we use two colors, and on the color space
+  // (params.kColorSpace).
+  template <bool UseColor, bool TwoColors, int ColorSpace>
+  void sumLogProbs(
+      const pcl::PointCloud<pcl::PointXYZRGB>& current_points,
+      const XYZTransform* translations, const size_t num_translations,
+      double* log_measurement_probs) const;
+
+  // The occupied cells of the grid.
+  std::vector<ProjectedCell> projected_cells_;
+
+  // For each cell of the grid, the index in projected_cells_ of the nearest
+  // occupied cell.  Cell (i, j) is stored at i * ySize_ + j.
+  std::vector<int> nearest_cells_;
+
+  // For each cell of the grid, the index in projected_cells_ of the cell,
+  // or -1 if it is empty.
+  std::vector<int> cell_indices_;
+
+  // Buffers for the distance transform.
+  std::vector<int> column_sq_dists_;
+  std::vector<int> column_nearest_;
+  std::vector<int> envelope_cells_;
+  std::vector<double> envelope_starts_;
+
+  // The size of the grid.
+  int xSize_;
+  int ySize_;
+
+  // The step size of the grid.
+  double xy_grid_step_;
+
+  // The factor for the squared vertical distance of a point from the range
+  // of heights of its nearest cell (see init).
+  double height_exp_factor_;
+
+  // The minimum point of the previous points.
+  pcl::PointXYZRGB min_pt_;
+
+  // Whether to use color in the measurement model.
+  bool use_color_;
+
+  // The color term of the measurement model.
+  ColorLikelihood color_likelihood_;
+
+  // The kernel selected by selectKernels.
+  void (LF_RGBD_2D_Evaluator::*sum_log_probs_)(
+      const pcl::PointCloud<pcl::PointXYZRGB>& current_points,
+      const XYZTransform* translations, const size_t num_translations,
+      double* log_measurement_probs) const;
+};
+
+} // namespace precision_tracking
+
+#endif /* __PRECISION_TRACKING__LF_RGBD_2D_EVALUATOR_H_ */
@@ -18,13 +18,20 @@
 #ifndef __PRECISION_TRACKING__LF_RGBD_6D_EVALUATOR_H_
 #define __PRECISION_TRACKING__LF_RGBD_6D_EVALUATOR_H_
 
+#include <utility>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+
 #include <pcl/point_types.h>
 #include <pcl/point_cloud.h>
 #include <pcl/kdtree/kdtree_flann.h>
 
 #include <precision_tracking/motion_model.h>
 #include <precision_tracking/scored_transform.h>
+#include <precision_tracking/spatial_hash.h>
 #include <precision_tracking/alignment_evaluator.h>
+#include <precision_tracking/color_likelihood.h>
 
 namespace precision_tracking {
 
@@ -53,7 +60,7 @@ public:
   double volume;
 };
 
-class LF_RGBD_6D_Evaluator : public AlignmentEvaluator {
+class LF_RGBD_6D_Evaluator : public AlignmentEvaluatorImpl<LF_RGBD_6D_Evaluator> {
 public:
   explicit LF_RGBD_6D_Evaluator (const Params *params);
   virtual ~LF_RGBD_6D_Evaluator();
@@ -76,6 +83,8 @@ public:
       ScoredTransforms<ScoredTransform6D>* scored_transforms);
 
 private:
+  friend class AlignmentEvaluatorImpl<LF_RGBD_6D_Evaluator>;
+
   double getLogProbability(
       const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& current_points,
       const Eigen::Vector3f& current_points_centroid,
@@ -95,16 +104,67 @@ private:
       const double pitch,
       const double yaw);
 
+  // Rotate the current points about their centroid.  Returns
+  // current_points if there is no rotation, and otherwise rotated_points_.
+  const pcl::PointCloud<pcl::PointXYZRGB>& rotatePoints(
+      const pcl::PointCloud<pcl::PointXYZRGB>& current_points,
+      const Eigen::Vector3f& current_points_centroid,
+      const double roll, const double pitch, const double yaw);
+
+  // Get the probability of each of the translations (at most
+  // kTransformBlockSize) without a rotation.
+  void getLogProbabilities(
+      const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& current_points,
+      const Eigen::Vector3f& current_points_centroid,
+      const MotionModel& motion_model,
+      const XYZTransform* transforms, const size_t num_transforms,
+      double* log_probs);
+
+  // Get the likelihood field score of the rotated points after applying
+  // each of the translations (at most kTransformBlockSize).
+  void getTranslatedLogProbabilities(
+      const pcl::PointCloud<pcl::PointXYZRGB>& rotated_points,
+      const MotionModel& motion_model,
+      const XYZTransform* translations, const size_t num_translations,
+      double* log_probs);
+
+  // Sort the points by their Morton code into point_order_, which sets the
+  // order in which sumLogProbs visits them.
+  void computeSpatialOrder(
+      const pcl::PointCloud<pcl::PointXYZRGB>& points);
+
   void init(const double xy_sampling_resolution,
             const double z_sampling_resolution,
             const double sensor_horizontal_resolution,
             const double sensor_vertical_resolution,
             const size_t num_current_points);
 
+  // Choose the kernels below for the current nearest neighbor search and
+  // color model.
+  void selectKernels();
+
+  // Sets sum_log_probs_ and point_log_prob_ for the color model (see
+  // selectColorModel).
+  template <bool UseSpatialHash>
+  struct KernelSelector;
+
+  // The kernels are specialized at compile time on whether we find the
+  // nearest neighbors with the spatial hash or the search tree, whether we
+  // use color, whether we use two colors, and on the color space
+  // (params.kColorSpace).
+  template <bool UseSpatialHash, bool UseColor, bool TwoColors, int ColorSpace>
+  void sumLogProbs(
+      const pcl::PointCloud<pcl::PointXYZRGB>& rotated_points,
+      const Eigen::Vector3f* translations, const size_t num_translations,
+      double* log_measurement_probs);
+
+  template <bool UseSpatialHash, bool UseColor, bool TwoColors, int ColorSpace>
   double get_log_prob(const pcl::PointXYZRGB& current_pt);
 
-  double computeColorProb(const pcl::PointXYZRGB& prev_pt,
-      const pcl::PointXYZRGB& pt, const double point_match_prob_spatial_i) const;
+  // Convert the colors of the previous points into prev_colors1_ and
+  // prev_colors2_.
+  template <int ColorSpace>
+  void convertPrevColors();
 
   void makeEigenRotation(
       const double roll, const double pitch, const double yaw,
@@ -122,17 +182,53 @@ private:
   // The number of nearest neighbors to find.
   const int max_nn_;
 
+  // The current points after the most recent rotation.
+  pcl::PointCloud<pcl::PointXYZRGB> rotated_points_;
+
+  // The order in which to visit the points, and the Morton codes used to
+  // compute it.
+  std::vector<size_t> point_order_;
+  std::vector<std::pair<boost::uint32_t, size_t> > spatial_codes_;
+
+  // The points for which point_order_ was computed, or NULL if it is out of
+  // date.
+  const pcl::PointCloud<pcl::PointXYZRGB>* ordered_points_;
+
+  // The log probability of each point for each translation in a block.
+  std::vector<double> point_log_probs_;
+
   // Vector to store the result of the nearest neighbor search.
   std::vector<int> nn_indices_;
   std::vector<float> nn_sq_dists_;
 
+  // Whether to find the nearest neighbors with spatial_hash_ instead of
+  // searchTree_.
+  bool use_spatial_hash_;
+
+  // Bounded-radius nearest neighbor search of the previous points.
+  SpatialHash spatial_hash_;
+
+  // Whether the previous points changed since spatial_hash_ was built.
+  bool spatial_hash_stale_;
+
   // Whether to use color in the measurement model.
   bool use_color_;
 
-  // Color parameters.
-  double color_exp_factor1_;
-  double color_exp_factor2_;
-  double prob_color_match_;
+  // The color term of the measurement model.
+  ColorLikelihood color_likelihood_;
+
+  // The colors of the previous points, in the color space given by
+  // params.kColorSpace.
+  std::vector<unsigned char> prev_colors1_;
+  std::vector<unsigned char> prev_colors2_;
+
+  // The kernels selected by selectKernels for the current frame.
+  void (LF_RGBD_6D_Evaluator::*sum_log_probs_)(
+      const pcl::PointCloud<pcl::PointXYZRGB>& rotated_points,
+      const Eigen::Vector3f* translations, const size_t num_translations,
+      double* log_measurement_probs);
+  double (LF_RGBD_6D_Evaluator::*point_log_prob_)(
+      const pcl::PointXYZRGB& current_pt);
 };
 
 } // namespace precision_tracking
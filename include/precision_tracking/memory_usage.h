@@ -0,0 +1,28 @@
+/*
+ * memory_usage.h
+ *
+ * Functions for measuring the memory used by this process, e.g. to compare
+ * the memory used by the different versions of the tracker.
+ *
+ */
+
+#ifndef __PRECISION_TRACKING__MEMORY_USAGE_H
+#define __PRECISION_TRACKING__MEMORY_USAGE_H
+
+#include <cstddef>
+
+namespace precision_tracking {
+
+// Get the resident set size of this process and its peak since the process
+// started or since the last call to resetPeakResidentSetSize, in bytes.
+// Returns false if these are not available (only Linux is supported).
+bool getResidentSetSize(size_t* rss, size_t* peak_rss);
+
+// Reset the peak resident set size to the current resident set size, so
+// that we can measure the peak memory used by some piece of code.
+// Returns false if this is not supported (requires Linux 4.0 or later).
+bool resetPeakResidentSetSize();
+
+} // namespace precision_tracking
+
+#endif // __PRECISION_TRACKING__MEMORY_USAGE_H
@@ -12,6 +12,7 @@
 #ifndef __PRECISION_TRACKING__MOTION_MODEL_H_
 #define __PRECISION_TRACKING__MOTION_MODEL_H_
 
+#include <iostream>
 #include <vector>
 
 #include <Eigen/Eigen>
@@ -78,6 +79,15 @@ public:
 
   void setFlip(const bool flip) { if (flip) { flip_ = -1; } else { flip_ = 1; } }
 
+  // Write the estimated motion in binary (see Tracker::saveState).  The
+  // propagation uncertainty is not written, since it only depends on the
+  // params.
+  void serialize(std::ostream& out) const;
+
+  // Read the motion written by serialize.  Returns false if the stream
+  // ended, in which case the motion model is unchanged.
+  bool deserialize(std::istream& in);
+
 private:
   Eigen::Vector3d computeMeanVelocity(
       const ScoredTransforms<ScoredTransformXYZ>& transforms,
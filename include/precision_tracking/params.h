@@ -100,6 +100,23 @@ struct Params
   int kMaxZSize;
   /// @}
 
+  /// Whether to store the log densities of the density grid as 16-bit
+  /// fixed-point integers and sum them as 32-bit integers, rather than as
+  /// doubles.  This uses a quarter of the memory for the grid and speeds up
+  /// the lookups, and changes the log density of each point by at most
+  /// about 1e-5 (see fixed_point.h for the exact bound).
+  bool useFixedPointGrid;
+
+  /// If positive, the spillover kernels of the density grids are shared by
+  /// all of the evaluators in a process-wide cache (see spillover_cache.h),
+  /// with the Gaussian exponent factors quantized to this many bins per
+  /// unit of log(-factor) (a relative step of 0.1% for 1000), so that
+  /// frames at slightly different distances share a kernel.  This saves an
+  /// exp and a log per kernel entry each time a grid is built, but changes
+  /// the scores slightly.  By default (0), each evaluator computes its
+  /// kernel from the exact factors.
+  double kSpilloverFactorBinsPerLog;
+
   /// @}
 
 
@@ -119,6 +136,17 @@ struct Params
   /// For a reasonable speedup, set to 2.
   double kSearchTreeEpsilon;
 
+  /// Whether to find the nearest neighbors with a spatial hash grid instead
+  /// of a KD-tree.  The spatial hash only finds neighbors within
+  /// kSpatialHashRadius standard deviations of the measurement model;
+  /// points without such a neighbor are given the smoothing probability.
+  bool useSpatialHash;
+
+  /// The radius for the spatial hash nearest neighbor search, in standard
+  /// deviations of the measurement model.  Beyond 3 standard deviations,
+  /// the spatial match probability is less than 0.011.
+  double kSpatialHashRadius;
+
   /// Whether to use two colors in our measurement model.
   bool kTwoColors;
 
@@ -173,11 +201,25 @@ struct Params
   /// very slow!
   bool useColor;
 
+  /// When using color without use3D, whether to project the previous points
+  /// onto the xy-plane and find the nearest neighbors with a 2D distance
+  /// transform (LF_RGBD_2D_Evaluator), instead of 3D nearest neighbor
+  /// searches.  This makes tracking with color much faster, but only the
+  /// height range of the previous points in each grid cell is kept.
+  bool useProjectedColorField;
+
   // Whether to track the full 3D point cloud or a 2D projection.  Tracking with
   // the full 3D point cloud is more accurate but uses much more memory,
   // due to our caching scheme.
   bool use3D;
 
+  /// Whether to score the alignments with a range image of the previous
+  /// points (RangeImageEvaluator), instead of with a density grid.  This
+  /// uses memory in proportion to the angular size of the object, so much
+  /// less than the 3D density grid, but it keeps only the nearest range in
+  /// each pixel, so it can be slightly less accurate.  Not used with color.
+  bool useRangeImage;
+
   /// We downsample the current frame of the tracked object to have this many
   /// points.
   int kCurrFrameDownsample;
@@ -199,6 +241,48 @@ struct Params
   /// Do not sample in the z-direction - assume minimal vertical motion.
   double kInitialZSamplingResolution;
 
+  /// How to orient the xy search window.
+  /// 0: Axis-aligned square window based on the bounding box diagonal,
+  /// 1: Aligned with the principal axes of the tracked points,
+  /// 2: Aligned with the velocity of the motion model (falls back to the
+  ///    principal axes if the motion model is not valid or the object
+  ///    is moving slower than kMinOrientationSpeed).
+  int kSearchWindowOrientation;
+
+  /// @{ For an oriented search window, the extent of the window along and
+  /// across the heading, as a multiple of half of the object size in that
+  /// direction.
+  double kAlongTrackSearchFactor;
+  double kCrossTrackSearchFactor;
+  /// @}
+
+  /// Minimum speed (m/s) of the motion model for its velocity to be used
+  /// to orient the search window.
+  double kMinOrientationSpeed;
+
+  /// Whether to first try a small local search around the zero transform
+  /// for objects that appear to be static, falling back to the full search
+  /// if the object turns out to be moving.
+  bool useStaticFastPath;
+
+  /// Maximum centroid shift and predicted displacement of the motion model
+  /// (in meters) for an object to be considered static.
+  double kStaticMaxDisplacement;
+
+  /// Maximum standard deviation (in meters) of the displacement predicted
+  /// by the motion model for an object to be considered static.
+  double kStaticMaxMotionStd;
+
+  /// The zero transform must score at least as well as the transforms
+  /// offset by this amount (in meters) along x and y.
+  double kStaticProbeOffset;
+
+  /// Half-width (in meters) of the local search window for static objects.
+  double kStaticSearchRadius;
+
+  /// Initial xy sampling resolution of the local search for static objects.
+  double kStaticXYSamplingResolution;
+
   /// @}
 
 
@@ -229,12 +313,16 @@ struct Params
     kMaxXSize = 1000; // At a resolution of 3.7 cm, a 10 m wide object will take 270 cells
     kMaxYSize = 1000;
     kMaxZSize = 250;  // At a resolution of 3.7 cm, a 5 m tall object will take 135 cells.
+    useFixedPointGrid = false;
+    kSpilloverFactorBinsPerLog = 0;
 
     // down sampler section
     kUseCeil = true;
 
     // lg rgbd 6d evaluator section
     kSearchTreeEpsilon = 2;
+    useSpatialHash = false;
+    kSpatialHashRadius = 3;
     kTwoColors = false;
     kValueSigma1 = 13.9;
     kValueSigma2 = 15.2;
@@ -251,7 +339,9 @@ struct Params
 
     // Precision tracker section
     useColor = false;
+    useProjectedColorField = false;
     use3D = false;
+    useRangeImage = false;
     kCurrFrameDownsample = 150;
     kPrevFrameDownsample = 2000;
     stochastic_downsample = false;
@@ -259,6 +349,16 @@ struct Params
                 // in urban settings, the vertical motion is small).
     kInitialXYSamplingResolution = 1;
     kInitialZSamplingResolution = 0;
+    kSearchWindowOrientation = 0;
+    kAlongTrackSearchFactor = 1;
+    kCrossTrackSearchFactor = 1;
+    kMinOrientationSpeed = 1;
+    useStaticFastPath = false;
+    kStaticMaxDisplacement = 0.1;
+    kStaticMaxMotionStd = 0.15;
+    kStaticProbeOffset = 0.15;
+    kStaticSearchRadius = 0.3;
+    kStaticXYSamplingResolution = 0.15;
   }
 };
 
@@ -36,13 +36,44 @@ public:
       const MotionModel& motion_model,
       ScoredTransforms<ScoredTransformXYZ>* scored_transforms);
 
+  // Total number of (point, transform) pairs scored so far.
+  size_t getNumScoredPoints() const {
+    return alignment_evaluator_->getNumScoredPoints();
+  }
+
 private:  
+  // Estimate the search range for alignment, around the displacement of
+  // the centroid given by centroid_diff.  The xy ranges are returned
+  // in a lattice frame rotated by lattice_heading about the z-axis.
   void estimateRange(
       const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& current_points,
       const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& prev_points,
+      const Eigen::Matrix4f& centroid_diff,
+      const MotionModel& motion_model,
       std::pair <double, double>* xRange,
       std::pair <double, double>* yRange,
-      std::pair <double, double>* zRange) const;
+      std::pair <double, double>* zRange,
+      double* lattice_heading) const;
+
+  // If the object appears to be static, align the points using a small
+  // local search around the zero transform.  Returns false if the object
+  // does not appear to be static or if the local search finds that the
+  // object has moved, in which case the full search should be used.
+  // The down-sampled previous points must already be set in the alignment
+  // evaluator.
+  bool trackStatic(
+      const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& down_sampled_current,
+      const Eigen::Vector3f& current_points_centroid,
+      const Eigen::Matrix4f& centroid_diff,
+      const double sensor_horizontal_res,
+      const double sensor_vertical_res,
+      const MotionModel& motion_model,
+      ScoredTransforms<ScoredTransformXYZ>* scored_transforms);
+
+  // Estimate the heading (radians) with which to align the search window.
+  double estimateHeading(
+      const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& prev_points,
+      const MotionModel& motion_model) const;
 
   Eigen::Matrix4f estimateAlignmentCentroidDiff(
       const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& curr_points,
@@ -0,0 +1,134 @@
+/*
+ * range_image_evaluator.h
+ *
+ * Compute the probability of a given set of alignments with a range image
+ * of the previous points, as seen from the sensor (which is at the origin
+ * of the points).  The image covers a small patch around the object: it is
+ * a pinhole projection onto the plane facing the sensor along the direction
+ * of the centroid of the previous points, with pixels at the angular
+ * resolution of the sensor.  Each pixel stores a single range, that of the
+ * nearest previous point which projects into it.
+ *
+ * Each current point is scored by projecting it into the image (a single
+ * pixel lookup per point and transform) and comparing its range to the
+ * range of the pixel, with the horizontal variance of the same measurement
+ * model as the density grids.  Empty pixels next to a pixel with a range
+ * take the nearest range of their 8 neighbors, to fill the holes between
+ * the previous points.  A current point which falls into a pixel that is
+ * still empty, or outside of the patch, does not match any previous point
+ * and gets the probability of the smoothing factor, like a point in an
+ * empty cell of the density grids.
+ *
+ * Since only the nearest range is kept, surfaces behind it (e.g. a side of
+ * the object seen at a grazing angle, at the coarse levels of the ADH
+ * search) are lost, so this can be slightly less accurate than the 3D
+ * density grid.  The memory used is proportional to the angular size of
+ * the object rather than to its volume, so it is much less than for the 3D
+ * density grid.  Like the density grids, this evaluator only handles
+ * translations and does not make use of color.
+ *
+ */
+
+#ifndef __PRECISION_TRACKING__RANGE_IMAGE_EVALUATOR_H_
+#define __PRECISION_TRACKING__RANGE_IMAGE_EVALUATOR_H_
+
+#include <vector>
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+#include <precision_tracking/scored_transform.h>
+#include <precision_tracking/alignment_evaluator.h>
+
+namespace precision_tracking {
+
+class RangeImageEvaluator : public AlignmentEvaluatorImpl<RangeImageEvaluator> {
+public:
+  explicit RangeImageEvaluator(const Params *params);
+  virtual ~RangeImageEvaluator();
+
+  void setPrevPoints(
+      const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr prev_points);
+
+private:
+  friend class AlignmentEvaluatorImpl<RangeImageEvaluator>;
+
+  void init(const double xy_sampling_resolution,
+            const double z_sampling_resolution,
+            const double sensor_horizontal_resolution,
+            const double sensor_vertical_resolution,
+            const size_t num_current_points);
+
+  // Get the probability of each of the transforms, in a single pass over
+  // the current points.
+  void getLogProbabilities(
+      const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& current_points,
+      const Eigen::Vector3f& current_points_centroid,
+      const MotionModel& motion_model,
+      const XYZTransform* transforms, const size_t num_transforms,
+      double* log_probs);
+
+  // Project the previous points into the pixels of the patch, keeping the
+  // nearest range in each pixel, and fill the holes.
+  void computeRangeImage();
+
+  // Tabulate the log probability of the range residuals for the current
+  // measurement model.
+  void computeResidualLogProbs();
+
+  // Get the log probability of a point with the given range which projects
+  // to the image coordinates (u, v).
+  double getPointLogProbability(const double u, const double v,
+                                const double range) const;
+
+  // Direction from the sensor to the centroid of the previous points, which
+  // is the optical axis of the image.  A point (x, y, z) has the depth
+  // x * center_cos_ + y * center_sin_ along this axis, and the lateral
+  // offset -x * center_sin_ + y * center_cos_.  Its image coordinates are
+  // u = lateral / depth and v = z / depth.
+  double center_cos_;
+  double center_sin_;
+
+  // The depth of the centroid of the previous points.
+  double center_distance_;
+
+  // The image coordinates and range of each previous point which is in
+  // front of the sensor.
+  std::vector<double> prev_us_;
+  std::vector<double> prev_vs_;
+  std::vector<float> prev_ranges_;
+
+  // The range of each pixel, or kEmptyPixel if no previous point projects
+  // into it or its neighbors.  Pixel (i, j), at horizontal index i and
+  // vertical index j, is pixel_ranges_[i * num_vs_ + j].
+  std::vector<float> pixel_ranges_;
+
+  // Buffer for the nearest range of each pixel, before filling the holes.
+  std::vector<float> nearest_ranges_;
+
+  // The size of the patch, in pixels.
+  int num_us_;
+  int num_vs_;
+
+  // The size of each pixel in image coordinates (i.e. in radians, near the
+  // center of the patch), and its inverse.
+  double u_step_;
+  double v_step_;
+  double inv_u_step_;
+  double inv_v_step_;
+
+  // The minimum image coordinates of the patch.
+  double min_u_;
+  double min_v_;
+
+  // residual_log_probs_[k] is the log probability of a range residual of
+  // k / residual_scale_ meters.  Larger residuals have the log probability
+  // of the smoothing factor, no_match_log_prob_.
+  std::vector<double> residual_log_probs_;
+  double residual_scale_;
+  double no_match_log_prob_;
+};
+
+} // namespace precision_tracking
+
+#endif /* __PRECISION_TRACKING__RANGE_IMAGE_EVALUATOR_H_ */
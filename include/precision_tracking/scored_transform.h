@@ -37,6 +37,13 @@ public:
      z(z),
      volume(volume)
   {  }
+
+  XYZTransform()
+    :x(0),
+     y(0),
+     z(0),
+     volume(0)
+  {  }
 };
 
 // Base class for a scored transform, which stores the unnormalized log
@@ -0,0 +1,82 @@
+/*
+ * spatial_hash.h
+ *
+ * Bounded-radius nearest neighbor search using a hash grid.  The points are
+ * binned into cubic cells with the same size as the search radius, so the
+ * nearest neighbor within the radius is found by checking the 27 cells
+ * around the query point, in O(1) expected time.  Unlike a KD-tree, points
+ * farther than the radius are never returned.
+ *
+ */
+
+#ifndef __PRECISION_TRACKING__SPATIAL_HASH_H
+#define __PRECISION_TRACKING__SPATIAL_HASH_H
+
+#include <vector>
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+namespace precision_tracking {
+
+class SpatialHash {
+public:
+  SpatialHash();
+  virtual ~SpatialHash();
+
+  // Index the points for searches within the given radius.
+  void setInputCloud(
+      const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& points,
+      const double radius);
+
+  // Find the nearest point to the query point within the radius.  Returns
+  // false if there is no point within the radius; otherwise sets the index
+  // of the nearest point and its squared distance to the query point.  Of
+  // several points at the same distance, the one with the lowest index is
+  // returned, so the result does not depend on the order of the buckets.
+  // Consecutive queries in the same cell reuse the buckets found for the
+  // previous query, so queries should be made in spatial order.
+  bool nearestWithinRadius(const pcl::PointXYZRGB& query, int* index,
+                           float* sq_dist);
+
+  double getRadius() const { return radius_; }
+
+private:
+  // A point stored in the order of the buckets, for locality.
+  struct Entry {
+    float x;
+    float y;
+    float z;
+    int index;
+  };
+
+  int getCell(const float value) const;
+
+  size_t getBucket(const int x_cell, const int y_cell, const int z_cell) const;
+
+  // The search radius, which is also the size of each cell.
+  double radius_;
+  double inv_cell_size_;
+  float sq_radius_;
+
+  // The number of buckets is a power of 2, so we can use a mask.
+  size_t bucket_mask_;
+
+  // The cell of the previous query, and the distinct buckets of the 27
+  // cells around it.
+  int query_x_cell_;
+  int query_y_cell_;
+  int query_z_cell_;
+  bool has_query_cell_;
+  size_t num_query_buckets_;
+  size_t query_buckets_[27];
+
+  // The entries of bucket i are entries_[bucket_starts_[i]] to
+  // entries_[bucket_starts_[i + 1] - 1].
+  std::vector<size_t> bucket_starts_;
+  std::vector<Entry> entries_;
+};
+
+} // namespace precision_tracking
+
+#endif // __PRECISION_TRACKING__SPATIAL_HASH_H
@@ -0,0 +1,133 @@
+/*
+ * spillover_cache.h
+ *
+ * Process-wide cache of the spillover kernels used to build the density
+ * grids (see DensityGrid2dEvaluator and DensityGrid3dEvaluator).  A kernel
+ * holds the log density that a point spills into each grid cell within a
+ * given number of cells of the point.  It only depends on the number of
+ * spillover steps, on the Gaussian exponent factors in units of grid cells
+ * and on the smoothing factor.
+ *
+ * The exponent factors depend on the sensor resolution, i.e. on the
+ * distance to the object, so they almost never repeat exactly.  The cache
+ * is therefore only used if Params::kSpilloverFactorBinsPerLog is positive:
+ * the exponent factors are then quantized to that many bins per unit of
+ * log(-factor), so that nearby values share a kernel, and each kernel is
+ * computed from its quantized factors, so the kernels do not depend on the
+ * order in which they were requested.  Otherwise, each kernel is computed
+ * from the exact factors into a buffer of the evaluator.
+ *
+ * Lookups do not take a lock: the kernels are never modified or removed
+ * once they are added, and each bucket of the cache is a linked list whose
+ * head is published with an atomic store.  Adding a kernel takes a mutex.
+ *
+ */
+
+#ifndef __PRECISION_TRACKING__SPILLOVER_CACHE_H
+#define __PRECISION_TRACKING__SPILLOVER_CACHE_H
+
+#include <vector>
+
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace precision_tracking {
+
+struct SpilloverKernel {
+  // The number of grid cells to spill over in each direction.
+  int num_steps_xy;
+  int num_steps_z;
+
+  // The log density spilled to a cell which is i, j and k cells away from
+  // the point in x, y and z is at index (i * (num_steps_xy + 1) + j) *
+  // (num_steps_z + 1) + k, as a double and in fixed point (see
+  // fixed_point.h).
+  std::vector<double> log_densities;
+  std::vector<boost::int16_t> fixed_point_log_densities;
+
+  // Get the log densities of the kernel, where Cell is double or int16.
+  template <class Cell>
+  const Cell* getCells() const;
+};
+
+class SpilloverCache {
+public:
+  // The cache shared by all of the evaluators.
+  static SpilloverCache& getInstance();
+
+  // Get the kernel for the given number of spillover steps and exponent
+  // factors (such that the density at x grid steps is exp(x^2 * factor)).
+  // For a 2D grid, num_steps_z should be 0 (z_exp_factor is then ignored).
+  // The exponent factors are quantized to factor_bins_per_log bins per unit
+  // of log(-factor).  If factor_bins_per_log is 0, or if the cache is full,
+  // the kernel is computed (from the exact factors if factor_bins_per_log
+  // is 0) in local_kernel instead.  Safe to call concurrently from several
+  // threads.
+  const SpilloverKernel& getKernel(
+      const int num_steps_xy, const int num_steps_z,
+      const double xy_exp_factor, const double z_exp_factor,
+      const double smoothing_factor, const double factor_bins_per_log,
+      SpilloverKernel* local_kernel);
+
+  // The number of kernels in the cache.
+  size_t size() const { return num_entries_.load(boost::memory_order_relaxed); }
+
+private:
+  SpilloverCache();
+  ~SpilloverCache();
+
+  // The quantized parameters of a kernel.
+  struct Key {
+    int num_steps_xy;
+    int num_steps_z;
+    int xy_factor_bin;
+    int z_factor_bin;
+    double smoothing_factor;
+    double factor_bins_per_log;
+
+    bool operator==(const Key& other) const;
+  };
+
+  struct Entry {
+    Key key;
+    SpilloverKernel kernel;
+    const Entry* next;
+  };
+
+  static Key getKey(const int num_steps_xy, const int num_steps_z,
+                    const double xy_exp_factor, const double z_exp_factor,
+                    const double smoothing_factor,
+                    const double factor_bins_per_log);
+
+  static size_t getBucket(const Key& key);
+
+  // Find the kernel in the given bucket, or return NULL.
+  static const SpilloverKernel* find(const Entry* head, const Key& key);
+
+  // Compute the kernel for the given parameters.
+  static void computeKernel(const int num_steps_xy, const int num_steps_z,
+                            const double xy_exp_factor,
+                            const double z_exp_factor,
+                            const double smoothing_factor,
+                            SpilloverKernel* kernel);
+
+  // Compute the kernel for the quantized parameters.
+  static void computeKernel(const Key& key, SpilloverKernel* kernel);
+
+  // The number of buckets and the maximum number of kernels.
+  static const size_t kNumBuckets = 256;
+  static const size_t kMaxEntries = 4096;
+
+  // The head of the list of entries in each bucket.
+  boost::atomic<const Entry*> bucket_heads_[kNumBuckets];
+
+  boost::atomic<size_t> num_entries_;
+
+  // Held while adding a kernel.
+  boost::mutex insert_mutex_;
+};
+
+} // namespace precision_tracking
+
+#endif // __PRECISION_TRACKING__SPILLOVER_CACHE_H
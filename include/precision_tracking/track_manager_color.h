@@ -48,16 +48,26 @@ const int FRAME_SERIALIZATION_VERSION = 0;
     //! Returns false if there were no points.
     bool operator!=(const Frame& fr);
     bool operator==(const Frame& fr);
-    Eigen::Vector3f getCentroid();
-    Eigen::MatrixXf getBoundingBox();
-    double getDistance();
+
+    //! The metadata below is computed when the frame is created or
+    //! deserialized, so the accessors are safe to call from several threads.
+    //! Call computeMetadata() after modifying cloud_.
+    void computeMetadata();
+    const Eigen::Vector3f& getCentroid() const { return centroid_; }
+    //! getBoundingBox().col(0) are the small x and y coords; .col(1) are the
+    //! large.
+    const Eigen::Matrix2f& getBoundingBox() const { return bounding_box_; }
+    //! Distance from the sensor to the centroid.
+    double getDistance() const { return distance_; }
+    size_t getNumPoints() const { return num_points_; }
+
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 
   private:
-    //! For caching of getCentroid() call.
-    boost::shared_ptr<Eigen::Vector3f> centroid_;
-    //! For caching of getBoundingBox() call.
-    //! bounding_box_.col(0) are the small x and y coords; .col(1) are the large.
-    boost::shared_ptr<Eigen::MatrixXf> bounding_box_;
+    Eigen::Matrix2f bounding_box_;
+    Eigen::Vector3f centroid_;
+    double distance_;
+    size_t num_points_;
   };
  
   class Track {
@@ -81,7 +91,7 @@ const int FRAME_SERIALIZATION_VERSION = 0;
     void serialize(std::ostream& out) const;
     bool deserialize(std::istream& istrm);
     double getMeanNumPoints() const;
-    double getMeanDistance();
+    double getMeanDistance() const;
   };
 
   class TrackManagerColor {
@@ -99,6 +109,11 @@ const int FRAME_SERIALIZATION_VERSION = 0;
     void serialize(std::ostream& out);
     bool deserialize(std::istream& istrm);
     bool deserialize(std::istream& istrm, const int tracknum);
+    //! Only deserialize the tracks [begin, end), using an index of the
+    //! offsets of each track in the stream (see indexTracks).
+    bool deserialize(std::istream& istrm,
+                     const std::vector<std::streamoff>& track_offsets,
+                     const size_t begin, const size_t end);
     //! Put the tracks in descending order of track length.
     void sortTracks();
     //! Sort based on some other criteria.  Descending.
@@ -115,6 +130,24 @@ const int FRAME_SERIALIZATION_VERSION = 0;
   };
 
   bool checkLine(std::istream& istrm, const std::string& expected_input);
+  //! Finds the offset of each track in a serialized TrackManagerColor
+  //! without deserializing the point clouds.
+  bool indexTracks(std::istream& istrm,
+                   std::vector<std::streamoff>* track_offsets);
+  //! Describes the current version of a file by its size and modification
+  //! time, so that an index of an older version of the file is not used.
+  bool getFileStamp(const std::string& filename, std::string* stamp);
+  //! Save / load a track index computed by indexTracks, for the version of
+  //! the tm file given by getFileStamp.  loadTrackIndex fails if the index
+  //! was saved for another version of the tm file.
+  bool saveTrackIndex(const std::string& filename,
+                      const std::string& tm_file_stamp,
+                      const std::vector<std::streamoff>& track_offsets);
+  bool loadTrackIndex(const std::string& filename,
+                      const std::string& tm_file_stamp,
+                      std::vector<std::streamoff>* track_offsets);
+  //! Skip over a serialized frame without deserializing its point cloud.
+  bool skipFrame(std::istream& istrm);
   bool readCloud(std::istream& s, pcl::PCLPointCloud2 &cloud);
   void deserializePointCloud(std::istream& istrm,
       pcl::PointCloud<pcl::PointXYZRGB>& point_cloud);
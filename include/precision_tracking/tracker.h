@@ -12,6 +12,8 @@
 #ifndef __PRECISION_TRACKING__TRACKER_H_
 #define __PRECISION_TRACKING__TRACKER_H_
 
+#include <iostream>
+
 #include <pcl/point_types.h>
 #include <pcl/point_cloud.h>
 
@@ -47,6 +49,29 @@ public:
       Eigen::Vector3f* estimated_velocity,
       double* alignment_probability);
 
+  // Offline processing: align the current points to the previous points
+  // without using the motion model.  The alignments of the consecutive
+  // frames of a track are independent of each other, so they can be
+  // computed in parallel (with one Tracker per thread) and then fused in
+  // order using addAlignment.
+  void alignWithoutPrior(
+      const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& previous_points,
+      const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& current_points,
+      const double sensor_horizontal_resolution,
+      const double sensor_vertical_resolution,
+      ScoredTransforms<ScoredTransformXYZ>* scored_transforms);
+
+  // Offline processing: combines the alignment computed by alignWithoutPrior
+  // for the previous and the current points with the motion model, and
+  // estimates the velocity of the object.  Call this function each time the
+  // object is observed, in order.  The alignment is ignored for the first
+  // observation of the object.
+  void addAlignment(
+      const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& current_points,
+      const double current_timestamp,
+      const ScoredTransforms<ScoredTransformXYZ>& scored_transforms,
+      Eigen::Vector3f* estimated_velocity);
+
   const Eigen::Matrix3d get_covariance_velocity() const {
     return motion_model_->get_covariance_velocity();
   }
@@ -67,7 +92,29 @@ public:
     precision_tracker_ = precision_tracker;
   }
 
+  // Save the state of the tracker (the motion model, the previous points and
+  // their timestamp) in a compact binary format, so that another tracker,
+  // e.g. in a standby process, can continue tracking the object with a warm
+  // motion model.  The precision tracker has no state between frames, so it
+  // is not saved.
+  void saveState(std::ostream& out) const;
+
+  // Restore the state written by saveState.  The tracker must use the same
+  // params as the tracker which saved the state (a hash of the params is
+  // saved with the state).  Returns false if the state is invalid or was
+  // saved with different params, in which case the tracker is unchanged.
+  bool loadState(std::istream& in);
+
 private:
+  // Update the motion model with the scored transforms and estimate the
+  // velocity of the object.
+  void estimateVelocity(
+      const ScoredTransforms<ScoredTransformXYZ>& scored_transforms,
+      const bool flip,
+      const double timestamp_diff,
+      Eigen::Vector3f* estimated_velocity,
+      double* alignment_probability);
+
   const Params *params_;
   pcl::PointCloud<pcl::PointXYZRGB>::Ptr previousModel_;
   double prev_timestamp_;
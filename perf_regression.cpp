@@ -0,0 +1,720 @@
+/*
+ * perf_regression.cpp
+ *
+ * Checks for performance regressions in the tracker.  Runs microbenchmarks
+ * of the main kernels and an end-to-end tracking workload on synthetic data,
+ * repeats each benchmark several times, and compares the median runtimes to
+ * a stored baseline.  Returns a non-zero exit code if any benchmark has
+ * become significantly slower.
+ *
+ */
+
+#include <string>
+#include <cstdio>
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
+
+#include <boost/make_shared.hpp>
+
+#include <pcl/common/centroid.h>
+
+#include <precision_tracking/density_grid_2d_evaluator.h>
+#include <precision_tracking/density_grid_3d_evaluator.h>
+#include <precision_tracking/down_sampler.h>
+#include <precision_tracking/high_res_timer.h>
+#include <precision_tracking/lf_rgbd_2d_evaluator.h>
+#include <precision_tracking/lf_rgbd_6d_evaluator.h>
+#include <precision_tracking/precision_tracker.h>
+#include <precision_tracking/range_image_evaluator.h>
+#include <precision_tracking/sensor_specs.h>
+#include <precision_tracking/tracker.h>
+
+using std::string;
+
+namespace {
+
+// Version of the baseline file format.
+const int kBaselineVersion = 1;
+
+// Number of times to run each benchmark, after one warm-up run.  With 10
+// runs or fewer, the confidence interval of the median spans all of the
+// runtimes (see getConfidenceRanks).
+const int kDefaultRepetitions = 15;
+
+// A benchmark has regressed if its median runtime is more than this
+// fraction slower than the baseline, and the confidence intervals of the
+// current and the baseline runtimes do not overlap.
+const double kDefaultTolerance = 0.1;
+
+// Name of the benchmark used to correct for the speed of the machine.
+const char* kCalibrationName = "calibration";
+
+// Deterministic random number generator, so that the synthetic data is the
+// same on every platform.
+class Random {
+public:
+  explicit Random(const unsigned int seed) : state_(seed) {}
+
+  // Returns a random number between 0 and 1.
+  double uniform() {
+    state_ = state_ * 1664525u + 1013904223u;
+    return (state_ >> 8) / static_cast<double>(1 << 24);
+  }
+
+private:
+  unsigned int state_;
+};
+
+// Make a synthetic point cloud of the sides of a car-sized box centered at
+// (x, y) and rotated by heading about the z-axis.
+pcl::PointCloud<pcl::PointXYZRGB>::Ptr makeBoxCloud(
+    const int num_points, const double x, const double y,
+    const double heading, Random* random) {
+  const double length = 4.0;
+  const double width = 1.8;
+  const double height = 1.5;
+
+  pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud(
+        new pcl::PointCloud<pcl::PointXYZRGB>);
+  for (int i = 0; i < num_points; ++i) {
+    double u;
+    double v;
+    if (i % 3 == 0) {
+      // Front or back of the box.
+      u = random->uniform() < 0.5 ? length / 2 : -length / 2;
+      v = (random->uniform() - 0.5) * width;
+    } else {
+      // Left or right side of the box.
+      u = (random->uniform() - 0.5) * length;
+      v = random->uniform() < 0.5 ? width / 2 : -width / 2;
+    }
+    const double w = random->uniform() * height;
+
+    pcl::PointXYZRGB point;
+    point.x = x + u * cos(heading) - v * sin(heading) +
+        0.01 * random->uniform();
+    point.y = y + u * sin(heading) + v * cos(heading) +
+        0.01 * random->uniform();
+    point.z = w;
+    point.r = 100 + static_cast<int>(u * 20);
+    point.g = 50 + static_cast<int>(w * 50);
+    point.b = 128;
+    cloud->push_back(point);
+  }
+  return cloud;
+}
+
+// A synthetic object observed by the sensor at 10 Hz.
+struct SyntheticTrack {
+  std::vector<pcl::PointCloud<pcl::PointXYZRGB>::Ptr> clouds;
+  std::vector<double> timestamps;
+};
+
+// Data shared by all of the benchmarks.
+struct Workload {
+  precision_tracking::Params params;
+  precision_tracking::Params params_3d;
+  precision_tracking::Params params_color;
+  precision_tracking::Params params_fixed_point;
+  precision_tracking::Params params_spatial_hash;
+  precision_tracking::Params params_color_2d;
+  precision_tracking::Params params_range_image;
+
+  // A dense cloud, for the downsampling benchmark.
+  pcl::PointCloud<pcl::PointXYZRGB>::Ptr dense_points;
+
+  // A pair of frames of a moving object, for the alignment benchmarks.
+  pcl::PointCloud<pcl::PointXYZRGB>::Ptr prev_points;
+  pcl::PointCloud<pcl::PointXYZRGB>::Ptr current_points;
+  pcl::PointCloud<pcl::PointXYZRGB>::Ptr down_sampled_prev;
+  pcl::PointCloud<pcl::PointXYZRGB>::Ptr down_sampled_current;
+  Eigen::Vector3f current_centroid;
+  double sensor_horizontal_resolution;
+  double sensor_vertical_resolution;
+
+  // Candidate transforms to score.
+  std::vector<precision_tracking::XYZTransform> transforms;
+
+  // The evaluators are created once, since the 3D evaluator allocates a
+  // large grid when it is created.
+  boost::shared_ptr<precision_tracking::MotionModel> motion_model;
+  boost::shared_ptr<precision_tracking::AlignmentEvaluator> grid_2d;
+  boost::shared_ptr<precision_tracking::AlignmentEvaluator> grid_3d;
+  boost::shared_ptr<precision_tracking::AlignmentEvaluator> lf_color;
+  boost::shared_ptr<precision_tracking::AlignmentEvaluator> grid_3d_fixed_point;
+  boost::shared_ptr<precision_tracking::AlignmentEvaluator> lf_spatial_hash;
+  boost::shared_ptr<precision_tracking::AlignmentEvaluator> lf_color_2d;
+  boost::shared_ptr<precision_tracking::AlignmentEvaluator> range_image;
+
+  std::vector<SyntheticTrack> tracks;
+};
+
+void makeWorkload(Workload* workload) {
+  Random random(1);
+
+  workload->params_3d.use3D = true;
+  workload->params_color.useColor = true;
+  workload->params_fixed_point.use3D = true;
+  workload->params_fixed_point.useFixedPointGrid = true;
+  workload->params_spatial_hash.useColor = true;
+  workload->params_spatial_hash.useSpatialHash = true;
+  workload->params_color_2d.useColor = true;
+  workload->params_color_2d.useProjectedColorField = true;
+  workload->params_range_image.useRangeImage = true;
+
+  workload->dense_points = makeBoxCloud(5000, 10, 5, 0.3, &random);
+
+  // The object moves 1 m between frames.
+  workload->prev_points = makeBoxCloud(1500, 10, 5, 0.3, &random);
+  workload->current_points = makeBoxCloud(1500, 10.9, 5.4, 0.3, &random);
+
+  const precision_tracking::Params& params = workload->params;
+  workload->down_sampled_prev.reset(new pcl::PointCloud<pcl::PointXYZRGB>);
+  workload->down_sampled_current.reset(
+        new pcl::PointCloud<pcl::PointXYZRGB>);
+  precision_tracking::DownSampler::downSamplePointsDeterministic(
+        workload->prev_points, params.kPrevFrameDownsample,
+        workload->down_sampled_prev, false);
+  precision_tracking::DownSampler::downSamplePointsDeterministic(
+        workload->current_points, params.kCurrFrameDownsample,
+        workload->down_sampled_current, false);
+
+  Eigen::Vector4f centroid;
+  pcl::compute3DCentroid(*workload->down_sampled_current, centroid);
+  workload->current_centroid = centroid.head<3>();
+  precision_tracking::getSensorResolution(
+        workload->current_centroid, &workload->sensor_horizontal_resolution,
+        &workload->sensor_vertical_resolution);
+
+  // A 21 x 21 grid of translations with a resolution of 0.1 m around the
+  // correct alignment.
+  const double resolution = 0.1;
+  for (int i = -10; i <= 10; ++i) {
+    for (int j = -10; j <= 10; ++j) {
+      workload->transforms.push_back(precision_tracking::XYZTransform(
+          0.9 + i * resolution, 0.4 + j * resolution, 0,
+          pow(resolution, 2)));
+    }
+  }
+
+  workload->motion_model.reset(
+        new precision_tracking::MotionModel(&workload->params));
+  workload->grid_2d.reset(
+        new precision_tracking::DensityGrid2dEvaluator(&workload->params));
+  workload->grid_3d.reset(
+        new precision_tracking::DensityGrid3dEvaluator(&workload->params_3d));
+  workload->lf_color.reset(
+        new precision_tracking::LF_RGBD_6D_Evaluator(&workload->params_color));
+  workload->grid_3d_fixed_point.reset(
+        new precision_tracking::DensityGrid3dEvaluator(
+          &workload->params_fixed_point));
+  workload->lf_spatial_hash.reset(
+        new precision_tracking::LF_RGBD_6D_Evaluator(
+          &workload->params_spatial_hash));
+  workload->lf_color_2d.reset(
+        new precision_tracking::LF_RGBD_2D_Evaluator(
+          &workload->params_color_2d));
+  workload->range_image.reset(
+        new precision_tracking::RangeImageEvaluator(
+          &workload->params_range_image));
+
+  // Objects at different distances and speeds, observed for 10 frames.
+  const int num_tracks = 6;
+  const int num_frames = 10;
+  for (int t = 0; t < num_tracks; ++t) {
+    SyntheticTrack track;
+    const double vx = (t % 3) * 3.0;
+    const double vy = (t % 2) - 0.5;
+    const double heading = atan2(vy, vx);
+    const double x0 = 5 + 4 * t;
+    const double y0 = -3 + t;
+    const int num_points = 2000 / (t + 1);
+    for (int f = 0; f < num_frames; ++f) {
+      const double timestamp = 0.1 * f;
+      track.clouds.push_back(makeBoxCloud(
+          num_points, x0 + vx * timestamp, y0 + vy * timestamp, heading,
+          &random));
+      track.timestamps.push_back(timestamp);
+    }
+    workload->tracks.push_back(track);
+  }
+}
+
+// A fixed amount of arithmetic, to measure the speed of the machine.
+void runCalibration(Workload* ) {
+  volatile double sum = 0;
+  for (int i = 1; i < 2000000; ++i) {
+    sum += sqrt(static_cast<double>(i)) / i;
+  }
+}
+
+void runDownSample(Workload* workload) {
+  const precision_tracking::DownSampler down_sampler(true, &workload->params);
+  for (int i = 0; i < 100; ++i) {
+    pcl::PointCloud<pcl::PointXYZRGB>::Ptr down_sampled_points(
+          new pcl::PointCloud<pcl::PointXYZRGB>);
+    down_sampler.downSamplePoints(workload->dense_points,
+                                  workload->params.kCurrFrameDownsample,
+                                  down_sampled_points);
+  }
+}
+
+// Score the candidate transforms num_iterations times.
+void runEvaluator(Workload* workload,
+                  precision_tracking::AlignmentEvaluator* evaluator,
+                  const double z_sampling_resolution,
+                  const int num_iterations) {
+  precision_tracking::ScoredTransforms<precision_tracking::ScoredTransformXYZ>
+      scored_transforms;
+  for (int i = 0; i < num_iterations; ++i) {
+    evaluator->setPrevPoints(workload->down_sampled_prev);
+    evaluator->score3DTransforms(
+          workload->down_sampled_current, workload->current_centroid, 0.1,
+          z_sampling_resolution, workload->sensor_horizontal_resolution,
+          workload->sensor_vertical_resolution, workload->transforms,
+          *workload->motion_model, &scored_transforms);
+  }
+}
+
+void runDensityGrid2d(Workload* workload) {
+  runEvaluator(workload, workload->grid_2d.get(), 0, 20);
+}
+
+void runDensityGrid3d(Workload* workload) {
+  runEvaluator(workload, workload->grid_3d.get(), 0.1, 20);
+}
+
+void runFixedPointGrid3d(Workload* workload) {
+  runEvaluator(workload, workload->grid_3d_fixed_point.get(), 0.1, 20);
+}
+
+void runColorEvaluator(Workload* workload) {
+  runEvaluator(workload, workload->lf_color.get(), 0.1, 1);
+}
+
+void runSpatialHashEvaluator(Workload* workload) {
+  runEvaluator(workload, workload->lf_spatial_hash.get(), 0.1, 1);
+}
+
+void runColor2dEvaluator(Workload* workload) {
+  runEvaluator(workload, workload->lf_color_2d.get(), 0, 5);
+}
+
+void runRangeImage(Workload* workload) {
+  runEvaluator(workload, workload->range_image.get(), 0, 20);
+}
+
+void runPrecisionTracker(Workload* workload) {
+  precision_tracking::PrecisionTracker precision_tracker(&workload->params);
+  precision_tracking::ScoredTransforms<precision_tracking::ScoredTransformXYZ>
+      scored_transforms;
+  for (int i = 0; i < 5; ++i) {
+    precision_tracker.track(workload->current_points, workload->prev_points,
+                            workload->sensor_horizontal_resolution,
+                            workload->sensor_vertical_resolution,
+                            *workload->motion_model, &scored_transforms);
+  }
+}
+
+// Track all of the synthetic objects.
+void runTracking(Workload* workload, const precision_tracking::Params& params,
+                 const bool use_precision_tracker) {
+  precision_tracking::Tracker tracker(&params);
+  if (use_precision_tracker) {
+    tracker.setPrecisionTracker(
+        boost::make_shared<precision_tracking::PrecisionTracker>(&params));
+  }
+
+  for (size_t i = 0; i < workload->tracks.size(); ++i) {
+    const SyntheticTrack& track = workload->tracks[i];
+    tracker.clear();
+    for (size_t j = 0; j < track.clouds.size(); ++j) {
+      Eigen::Vector4f centroid;
+      pcl::compute3DCentroid(*track.clouds[j], centroid);
+      double sensor_horizontal_resolution;
+      double sensor_vertical_resolution;
+      precision_tracking::getSensorResolution(
+            centroid.head<3>(), &sensor_horizontal_resolution,
+            &sensor_vertical_resolution);
+
+      Eigen::Vector3f estimated_velocity;
+      tracker.addPoints(track.clouds[j], track.timestamps[j],
+                        sensor_horizontal_resolution,
+                        sensor_vertical_resolution, &estimated_velocity);
+    }
+  }
+}
+
+void runTrackingKalman(Workload* workload) {
+  runTracking(workload, workload->params, false);
+}
+
+void runTracking2d(Workload* workload) {
+  runTracking(workload, workload->params, true);
+}
+
+void runTrackingColor(Workload* workload) {
+  runTracking(workload, workload->params_color, true);
+}
+
+typedef void (*BenchmarkFunction)(Workload* workload);
+
+struct Benchmark {
+  const char* name;
+  BenchmarkFunction function;
+};
+
+// All benchmarks, starting with the calibration.
+const Benchmark benchmarks[] = {
+  { kCalibrationName, runCalibration },
+  { "down_sample", runDownSample },
+  { "density_grid_2d", runDensityGrid2d },
+  { "density_grid_3d", runDensityGrid3d },
+  { "fixed_point_grid_3d", runFixedPointGrid3d },
+  { "lf_rgbd_color", runColorEvaluator },
+  { "lf_rgbd_spatial_hash", runSpatialHashEvaluator },
+  { "lf_rgbd_color_2d", runColor2dEvaluator },
+  { "range_image", runRangeImage },
+  { "precision_tracker_2d", runPrecisionTracker },
+  { "tracking_kalman", runTrackingKalman },
+  { "tracking_2d", runTracking2d },
+  { "tracking_color", runTrackingColor },
+};
+const int num_benchmarks = sizeof(benchmarks) / sizeof(benchmarks[0]);
+
+// The median runtime of a benchmark and a 95% confidence interval for it.
+struct BenchmarkStats {
+  string name;
+  double median_ms;
+  double ci_low_ms;
+  double ci_high_ms;
+};
+
+// Get the ranks (starting from 1) of the runtimes which bound a
+// distribution-free 95% confidence interval for the median of n runtimes,
+// using the normal approximation to the binomial distribution.  For small n
+// these are 1 and n, so the interval is just the range of the runtimes.
+void getConfidenceRanks(const int n, int* low_rank, int* high_rank) {
+  const double half_width = 0.98 * sqrt(static_cast<double>(n));
+  *low_rank = std::max(1, static_cast<int>(floor(n / 2.0 - half_width)));
+  *high_rank = std::min(n, static_cast<int>(ceil(n / 2.0 + 1 + half_width)));
+}
+
+// Compute the median and a confidence interval for the median, using the
+// order statistics of the runtimes.
+void computeStats(const string& name, std::vector<double> runtimes,
+                  BenchmarkStats* stats) {
+  std::sort(runtimes.begin(), runtimes.end());
+  const int n = runtimes.size();
+
+  stats->name = name;
+  stats->median_ms = n % 2 == 1 ? runtimes[n / 2] :
+      (runtimes[n / 2 - 1] + runtimes[n / 2]) / 2;
+
+  int low_rank;
+  int high_rank;
+  getConfidenceRanks(n, &low_rank, &high_rank);
+  stats->ci_low_ms = runtimes[low_rank - 1];
+  stats->ci_high_ms = runtimes[high_rank - 1];
+}
+
+// Run the benchmarks repeatedly and compute their statistics.  The
+// benchmarks are run in turn, rather than each one repeatedly, so that
+// slow periods of the machine affect all of them equally.
+void runBenchmarks(const std::vector<Benchmark>& benchmarks,
+                   const int repetitions, Workload* workload,
+                   std::vector<BenchmarkStats>* results) {
+  std::vector<std::vector<double> > runtimes(benchmarks.size());
+  for (int i = 0; i <= repetitions; ++i) {
+    for (size_t k = 0; k < benchmarks.size(); ++k) {
+      // Make the stochastic downsampling repeatable.
+      srand(0);
+
+      // Measure the CPU time, which is less affected by other processes.
+      precision_tracking::HighResTimer hrt(benchmarks[k].name,
+                                           CLOCK_THREAD_CPUTIME_ID);
+      hrt.start();
+      benchmarks[k].function(workload);
+      hrt.stop();
+
+      // The first run is a warm-up run.
+      if (i > 0) {
+        runtimes[k].push_back(hrt.getMilliseconds());
+      }
+    }
+    printf(".");
+    fflush(stdout);
+  }
+  printf("\n");
+
+  results->resize(benchmarks.size());
+  for (size_t k = 0; k < benchmarks.size(); ++k) {
+    computeStats(benchmarks[k].name, runtimes[k], &(*results)[k]);
+  }
+}
+
+bool saveBaseline(const string& filename, const int repetitions,
+                  const std::vector<BenchmarkStats>& results) {
+  FILE* fid = fopen(filename.c_str(), "w");
+  if (fid == NULL) {
+    return false;
+  }
+  fprintf(fid, "{\n");
+  fprintf(fid, "  \"version\": %d,\n", kBaselineVersion);
+  fprintf(fid, "  \"repetitions\": %d,\n", repetitions);
+  fprintf(fid, "  \"benchmarks\": [\n");
+  for (size_t i = 0; i < results.size(); ++i) {
+    const BenchmarkStats& stats = results[i];
+    fprintf(fid, "    {\"name\": \"%s\", \"median_ms\": %.6g, "
+            "\"ci_low_ms\": %.6g, \"ci_high_ms\": %.6g}%s\n",
+            stats.name.c_str(), stats.median_ms, stats.ci_low_ms,
+            stats.ci_high_ms, i + 1 < results.size() ? "," : "");
+  }
+  fprintf(fid, "  ]\n");
+  fprintf(fid, "}\n");
+  return fclose(fid) == 0;
+}
+
+// Load a baseline saved by saveBaseline.  This only parses the format that
+// saveBaseline writes, with one benchmark per line.
+bool loadBaseline(const string& filename,
+                  std::vector<BenchmarkStats>* baseline) {
+  FILE* fid = fopen(filename.c_str(), "r");
+  if (fid == NULL) {
+    return false;
+  }
+
+  int version = -1;
+  char line[512];
+  while (fgets(line, sizeof(line), fid) != NULL) {
+    int value;
+    if (sscanf(line, " \"version\": %d", &value) == 1) {
+      version = value;
+      continue;
+    }
+
+    char name[128];
+    BenchmarkStats stats;
+    if (sscanf(line, " {\"name\": \"%127[^\"]\", \"median_ms\": %lf, "
+               "\"ci_low_ms\": %lf, \"ci_high_ms\": %lf}", name,
+               &stats.median_ms, &stats.ci_low_ms, &stats.ci_high_ms) == 4) {
+      stats.name = name;
+      baseline->push_back(stats);
+    }
+  }
+  fclose(fid);
+
+  if (version != kBaselineVersion) {
+    printf("Expected baseline version %d, got %d\n", kBaselineVersion,
+           version);
+    return false;
+  }
+  return true;
+}
+
+const BenchmarkStats* findStats(const std::vector<BenchmarkStats>& results,
+                                const string& name) {
+  for (size_t i = 0; i < results.size(); ++i) {
+    if (results[i].name == name) {
+      return &results[i];
+    }
+  }
+  return NULL;
+}
+
+// Compare the results to the baseline and print a report.  Returns the
+// number of benchmarks which have regressed, and sets num_new to the number
+// of benchmarks which are not in the baseline.
+int compareToBaseline(const std::vector<BenchmarkStats>& results,
+                      const std::vector<BenchmarkStats>& baseline,
+                      const double tolerance, int* num_new) {
+  // Scale the baseline by the relative speed of this machine.
+  double scale = 1;
+  const BenchmarkStats* calibration = findStats(results, kCalibrationName);
+  const BenchmarkStats* baseline_calibration =
+      findStats(baseline, kCalibrationName);
+  if (calibration && baseline_calibration &&
+      baseline_calibration->median_ms > 0) {
+    scale = calibration->median_ms / baseline_calibration->median_ms;
+  }
+  printf("\nThis machine is %.2lfx as slow as the baseline machine; "
+         "scaling the baseline runtimes accordingly.\n", scale);
+
+  printf("%-22s %12s %12s %8s %23s  %s\n", "benchmark", "baseline ms",
+         "current ms", "change", "95% CI (ms)", "status");
+
+  int num_regressions = 0;
+  *num_new = 0;
+  for (size_t i = 0; i < results.size(); ++i) {
+    const BenchmarkStats& stats = results[i];
+    if (stats.name == kCalibrationName) {
+      continue;
+    }
+
+    const BenchmarkStats* baseline_stats = findStats(baseline, stats.name);
+    if (baseline_stats == NULL) {
+      printf("%-22s %12s %12.3lf %8s [%10.3lf, %10.3lf]  new\n",
+             stats.name.c_str(), "-", stats.median_ms, "-", stats.ci_low_ms,
+             stats.ci_high_ms);
+      (*num_new)++;
+      continue;
+    }
+
+    const double expected_ms = baseline_stats->median_ms * scale;
+    const double change = (stats.median_ms - expected_ms) / expected_ms;
+
+    string status = "ok";
+    if (change > tolerance &&
+        stats.ci_low_ms > baseline_stats->ci_high_ms * scale) {
+      status = "REGRESSION";
+      num_regressions++;
+    } else if (change < -tolerance &&
+               stats.ci_high_ms < baseline_stats->ci_low_ms * scale) {
+      status = "faster";
+    }
+
+    printf("%-22s %12.3lf %12.3lf %+7.1lf%% [%10.3lf, %10.3lf]  %s\n",
+           stats.name.c_str(), expected_ms, stats.median_ms, 100 * change,
+           stats.ci_low_ms, stats.ci_high_ms, status.c_str());
+  }
+
+  for (size_t i = 0; i < baseline.size(); ++i) {
+    if (findStats(results, baseline[i].name) == NULL) {
+      printf("%-22s missing from this run\n", baseline[i].name.c_str());
+    }
+  }
+
+  return num_regressions;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+  string baseline_file;
+  string output_file;
+  bool update = false;
+  bool allow_new = false;
+  int repetitions = kDefaultRepetitions;
+  double tolerance = kDefaultTolerance;
+  string filter;
+
+  for (int i = 1; i < argc; ++i) {
+    const string arg = argv[i];
+    if (arg == "--baseline" && i + 1 < argc) {
+      baseline_file = argv[++i];
+    } else if (arg == "--output" && i + 1 < argc) {
+      output_file = argv[++i];
+    } else if (arg == "--update") {
+      update = true;
+    } else if (arg == "--allow_new") {
+      allow_new = true;
+    } else if (arg == "--repetitions" && i + 1 < argc) {
+      repetitions = std::max(1, atoi(argv[++i]));
+    } else if (arg == "--tolerance" && i + 1 < argc) {
+      tolerance = atof(argv[++i]);
+    } else if (arg == "--filter" && i + 1 < argc) {
+      filter = argv[++i];
+    } else {
+      printf("Usage: %s [options]\n", argv[0]);
+      printf("  --baseline file: compare the runtimes to this baseline\n");
+      printf("  --update: save the runtimes as the new baseline instead\n");
+      printf("  --allow_new: do not fail if some benchmarks are not in the "
+             "baseline\n");
+      printf("  --output file: save the runtimes to this file\n");
+      printf("  --repetitions n: number of runs of each benchmark "
+             "(default %d)\n", kDefaultRepetitions);
+      printf("  --tolerance t: relative slowdown that counts as a "
+             "regression (default %g)\n", kDefaultTolerance);
+      printf("  --filter name: only run benchmarks containing name\n");
+      return (1);
+    }
+  }
+
+  printf("Creating the synthetic workload...\n");
+  Workload workload;
+  makeWorkload(&workload);
+
+  // Always run the calibration, which is needed to compare to the
+  // baseline.
+  std::vector<Benchmark> selected;
+  for (int i = 0; i < num_benchmarks; ++i) {
+    if (filter.empty() || benchmarks[i].name == string(kCalibrationName) ||
+        string(benchmarks[i].name).find(filter) != string::npos) {
+      selected.push_back(benchmarks[i]);
+    }
+  }
+
+  printf("Running each benchmark %d times", repetitions);
+  std::vector<BenchmarkStats> results;
+  runBenchmarks(selected, repetitions, &workload, &results);
+
+  int low_rank;
+  int high_rank;
+  getConfidenceRanks(repetitions, &low_rank, &high_rank);
+  if (low_rank == 1 && high_rank == repetitions) {
+    printf("Warning - with only %d runs, the 95%% confidence intervals are "
+           "the range of the runtimes [min, max]; use more repetitions for "
+           "tighter intervals.\n", repetitions);
+  }
+  for (size_t i = 0; i < results.size(); ++i) {
+    const BenchmarkStats& stats = results[i];
+    printf("%-22s median %10.3lf ms, 95%% CI [%.3lf, %.3lf] ms\n",
+           stats.name.c_str(), stats.median_ms, stats.ci_low_ms,
+           stats.ci_high_ms);
+  }
+
+  if (!output_file.empty() &&
+      !saveBaseline(output_file, repetitions, results)) {
+    printf("Cannot write file: %s\n", output_file.c_str());
+    return (1);
+  }
+
+  if (baseline_file.empty()) {
+    return 0;
+  }
+
+  if (update) {
+    if (!saveBaseline(baseline_file, repetitions, results)) {
+      printf("Cannot write file: %s\n", baseline_file.c_str());
+      return (1);
+    }
+    printf("Saved the baseline to %s\n", baseline_file.c_str());
+    return 0;
+  }
+
+  std::vector<BenchmarkStats> all_baseline;
+  if (!loadBaseline(baseline_file, &all_baseline)) {
+    printf("Cannot load baseline: %s\n", baseline_file.c_str());
+    return (1);
+  }
+
+  // Only compare to the benchmarks that we ran.
+  std::vector<BenchmarkStats> baseline;
+  for (size_t i = 0; i < all_baseline.size(); ++i) {
+    if (filter.empty() || all_baseline[i].name == kCalibrationName ||
+        all_baseline[i].name.find(filter) != string::npos) {
+      baseline.push_back(all_baseline[i]);
+    }
+  }
+
+  int num_new;
+  const int num_regressions = compareToBaseline(results, baseline, tolerance,
+                                                &num_new);
+  if (num_regressions > 0) {
+    printf("\n%d benchmark(s) regressed.\n", num_regressions);
+  }
+  if (num_new > 0) {
+    printf("\n%d benchmark(s) are not in the baseline and were not checked; "
+           "record them with --update%s.\n", num_new,
+           allow_new ? "" : ", or pass --allow_new to skip them");
+  }
+  if (num_regressions > 0 || (num_new > 0 && !allow_new)) {
+    return (1);
+  }
+
+  printf("\nNo performance regressions.\n");
+  return 0;
+}
@@ -11,12 +11,30 @@
 #include <algorithm>
 
 #include <precision_tracking/adh_tracker3d.h>
+#include <precision_tracking/density_grid_2d_evaluator.h>
+#include <precision_tracking/density_grid_3d_evaluator.h>
+#include <precision_tracking/lf_rgbd_2d_evaluator.h>
+#include <precision_tracking/lf_rgbd_6d_evaluator.h>
+#include <precision_tracking/range_image_evaluator.h>
 
 using std::vector;
 using std::max;
 
 namespace precision_tracking {
 
+namespace {
+
+// Tolerance for the rounding error in the size of a range, so that a range
+// which is a whole number of steps includes its upper end.
+const double kRangeEpsilon = 1e-6;
+
+// Number of samples from min to max (inclusive) at the given resolution.
+int getNumLocations(const double min, const double max,
+                    const double resolution) {
+  return static_cast<int>(floor((max - min) / resolution + kRangeEpsilon)) + 1;
+}
+
+}  // namespace
 
 ADHTracker3d::ADHTracker3d(const Params *params)
   : params_(params)
@@ -33,6 +51,7 @@ void ADHTracker3d::track(
     const std::pair <double, double>& xRange,
     const std::pair <double, double>& yRange,
     const std::pair <double, double>& zRange,
+    const double lattice_heading,
     const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& current_points,
     const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& prev_points,
     const Eigen::Vector3f &current_points_centroid,
@@ -42,6 +61,101 @@ void ADHTracker3d::track(
     boost::shared_ptr<AlignmentEvaluator> alignment_evaluator,
     ScoredTransforms<ScoredTransformXYZ>* final_scored_transforms3D) const
 {
+  alignment_evaluator->setPrevPoints(prev_points);
+  trackPrevPointsSet(
+        initial_xy_sampling_resolution, initial_z_sampling_resolution,
+        xRange, yRange, zRange, lattice_heading, current_points,
+        current_points_centroid, motion_model,
+        xy_sensor_resolution, z_sensor_resolution,
+        alignment_evaluator, final_scored_transforms3D);
+}
+
+void ADHTracker3d::trackPrevPointsSet(
+    const double initial_xy_sampling_resolution,
+    const double initial_z_sampling_resolution,
+    const std::pair <double, double>& xRange,
+    const std::pair <double, double>& yRange,
+    const std::pair <double, double>& zRange,
+    const double lattice_heading,
+    const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& current_points,
+    const Eigen::Vector3f &current_points_centroid,
+    const MotionModel& motion_model,
+    const double xy_sensor_resolution,
+    const double z_sensor_resolution,
+    boost::shared_ptr<AlignmentEvaluator> alignment_evaluator,
+    ScoredTransforms<ScoredTransformXYZ>* final_scored_transforms3D) const
+{
+  // Look up the type of the evaluator once, and then run the version of the
+  // tracker which is compiled for that type.
+  AlignmentEvaluator* evaluator = alignment_evaluator.get();
+  if (DensityGrid2dEvaluator* density_grid_2d_evaluator =
+      dynamic_cast<DensityGrid2dEvaluator*>(evaluator)) {
+    track(initial_xy_sampling_resolution, initial_z_sampling_resolution,
+          xRange, yRange, zRange, lattice_heading, current_points,
+          current_points_centroid, motion_model,
+          xy_sensor_resolution, z_sensor_resolution,
+          density_grid_2d_evaluator, final_scored_transforms3D);
+  } else if (DensityGrid3dEvaluator* density_grid_3d_evaluator =
+             dynamic_cast<DensityGrid3dEvaluator*>(evaluator)) {
+    track(initial_xy_sampling_resolution, initial_z_sampling_resolution,
+          xRange, yRange, zRange, lattice_heading, current_points,
+          current_points_centroid, motion_model,
+          xy_sensor_resolution, z_sensor_resolution,
+          density_grid_3d_evaluator, final_scored_transforms3D);
+  } else if (LF_RGBD_6D_Evaluator* lf_evaluator =
+             dynamic_cast<LF_RGBD_6D_Evaluator*>(evaluator)) {
+    track(initial_xy_sampling_resolution, initial_z_sampling_resolution,
+          xRange, yRange, zRange, lattice_heading, current_points,
+          current_points_centroid, motion_model,
+          xy_sensor_resolution, z_sensor_resolution,
+          lf_evaluator, final_scored_transforms3D);
+  } else if (LF_RGBD_2D_Evaluator* lf_2d_evaluator =
+             dynamic_cast<LF_RGBD_2D_Evaluator*>(evaluator)) {
+    track(initial_xy_sampling_resolution, initial_z_sampling_resolution,
+          xRange, yRange, zRange, lattice_heading, current_points,
+          current_points_centroid, motion_model,
+          xy_sensor_resolution, z_sensor_resolution,
+          lf_2d_evaluator, final_scored_transforms3D);
+  } else if (RangeImageEvaluator* range_image_evaluator =
+             dynamic_cast<RangeImageEvaluator*>(evaluator)) {
+    track(initial_xy_sampling_resolution, initial_z_sampling_resolution,
+          xRange, yRange, zRange, lattice_heading, current_points,
+          current_points_centroid, motion_model,
+          xy_sensor_resolution, z_sensor_resolution,
+          range_image_evaluator, final_scored_transforms3D);
+  } else {
+    // Some other evaluator - use the virtual API.
+    track(initial_xy_sampling_resolution, initial_z_sampling_resolution,
+          xRange, yRange, zRange, lattice_heading, current_points,
+          current_points_centroid, motion_model,
+          xy_sensor_resolution, z_sensor_resolution,
+          evaluator, final_scored_transforms3D);
+  }
+}
+
+template <class Evaluator>
+void ADHTracker3d::track(
+    const double initial_xy_sampling_resolution,
+    const double initial_z_sampling_resolution,
+    const std::pair <double, double>& xRange,
+    const std::pair <double, double>& yRange,
+    const std::pair <double, double>& zRange,
+    const double lattice_heading,
+    const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& current_points,
+    const Eigen::Vector3f &current_points_centroid,
+    const MotionModel& motion_model,
+    const double xy_sensor_resolution,
+    const double z_sensor_resolution,
+    Evaluator* alignment_evaluator,
+    ScoredTransforms<ScoredTransformXYZ>* final_scored_transforms3D) const
+{
+  if (!alignment_evaluator->getPrevPoints()) {
+    printf("Error - the previous points must be set in the alignment "
+           "evaluator (with setPrevPoints) before calling "
+           "ADHTracker3d::trackPrevPointsSet\n");
+    exit(1);
+  }
+
   // Compute the minimum sampling resolution based on the sensor
   // resolution - we are limited in accuracy by the sensor resolution,
   // so there is no point in sampling at a much finer scale.
@@ -52,15 +166,16 @@ void ADHTracker3d::track(
   double current_xy_sampling_resolution = initial_xy_sampling_resolution;
   double current_z_sampling_resolution = initial_z_sampling_resolution;
 
+  // Rotation of the sampling lattice relative to the xy axes.
+  const double lattice_cos = cos(lattice_heading);
+  const double lattice_sin = sin(lattice_heading);
+
   // Create initial candidate transforms.
   vector<XYZTransform> candidate_transforms;
   createCandidateXYZTransforms(
         current_xy_sampling_resolution, current_z_sampling_resolution,
-        xRange, yRange, zRange, &candidate_transforms);
-
-  // Initially track at a coarse resolution and get the probability of
-  // various transforms.
-  alignment_evaluator->setPrevPoints(prev_points);
+        xRange, yRange, zRange, lattice_cos, lattice_sin,
+        &candidate_transforms);
 
   // Total probability for the region that we are evaluating.
   double region_prob = 1;
@@ -68,7 +183,7 @@ void ADHTracker3d::track(
   while(candidate_transforms.size() > 0) {
     // Compute the probability of each of the candidate transforms.
     ScoredTransforms<ScoredTransformXYZ> scored_transforms3D;
-    alignment_evaluator->score3DTransforms(
+    alignment_evaluator->scoreXYZTransforms(
           current_points, current_points_centroid,
           current_xy_sampling_resolution, current_z_sampling_resolution,
           xy_sensor_resolution, z_sensor_resolution,
@@ -95,6 +210,7 @@ void ADHTracker3d::track(
     makeNewTransforms3D(
           new_xy_sampling_resolution, new_z_sampling_resolution,
           current_xy_sampling_resolution, current_z_sampling_resolution,
+          lattice_cos, lattice_sin,
           final_scored_transforms3D, &candidate_transforms,
           &region_prob);
 
@@ -103,6 +219,28 @@ void ADHTracker3d::track(
     }
 }
 
+// Explicitly instantiate the tracker for each of the evaluators.
+#define INSTANTIATE_ADH_TRACK(Evaluator) \
+  template void ADHTracker3d::track<Evaluator>( \
+      const double, const double, \
+      const std::pair <double, double>&, \
+      const std::pair <double, double>&, \
+      const std::pair <double, double>&, \
+      const double, \
+      const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr&, \
+      const Eigen::Vector3f&, const MotionModel&, \
+      const double, const double, Evaluator*, \
+      ScoredTransforms<ScoredTransformXYZ>*) const;
+
+INSTANTIATE_ADH_TRACK(AlignmentEvaluator)
+INSTANTIATE_ADH_TRACK(DensityGrid2dEvaluator)
+INSTANTIATE_ADH_TRACK(DensityGrid3dEvaluator)
+INSTANTIATE_ADH_TRACK(LF_RGBD_6D_Evaluator)
+INSTANTIATE_ADH_TRACK(LF_RGBD_2D_Evaluator)
+INSTANTIATE_ADH_TRACK(RangeImageEvaluator)
+
+#undef INSTANTIATE_ADH_TRACK
+
 void ADHTracker3d::recomputeProbs(
     const double prior_region_prob,
     ScoredTransforms<ScoredTransformXYZ>* scored_transforms) const
@@ -129,6 +267,7 @@ void ADHTracker3d::makeNewTransforms3D(
     const double xy_sampling_resolution, const double z_sampling_resolution,
     const double old_xy_sampling_resolution,
     const double old_z_sampling_resolution,
+    const double lattice_cos, const double lattice_sin,
     ScoredTransforms<ScoredTransformXYZ>* scored_transforms,
     std::vector<XYZTransform>* new_xyz_transforms,
     double* total_recomputing_prob) const
@@ -179,17 +318,21 @@ void ADHTracker3d::makeNewTransforms3D(
       // the previously computed probability for this transform.
       to_remove.push_back(i);
 
-      // Get the initial sampling point in this region.
-      const double min_x = old_x - old_xy_sampling_resolution / 2 + xy_sampling_resolution / 2;
-      const double min_y = old_y - old_xy_sampling_resolution / 2 + xy_sampling_resolution / 2;
+      // Get the initial sampling offset in this region, in the lattice frame.
+      const double min_xy_offset =
+          -old_xy_sampling_resolution / 2 + xy_sampling_resolution / 2;
       const double min_z = old_z - old_z_sampling_resolution / 2 + z_sampling_resolution / 2;
 
       // Sample more finely in this region.
       for (int i = 0; i < params_->kReductionFactor; ++i) {
-        const double new_x = min_x + xy_sampling_resolution * i;
+        const double u = min_xy_offset + xy_sampling_resolution * i;
 
         for (int j = 0; j < params_->kReductionFactor; ++j) {
-          const double new_y = min_y + xy_sampling_resolution * j;
+          const double v = min_xy_offset + xy_sampling_resolution * j;
+
+          // Rotate the offset from the lattice frame into the xy frame.
+          const double new_x = old_x + u * lattice_cos - v * lattice_sin;
+          const double new_y = old_y + u * lattice_sin + v * lattice_cos;
 
           if (z_sampling_resolution == 0) {
             const double new_z = old_z;
@@ -222,6 +365,7 @@ void ADHTracker3d::createCandidateXYZTransforms(
     const std::pair <double, double>& xRange,
     const std::pair <double, double>& yRange,
     const std::pair <double, double>& zRange_orig,
+    const double lattice_cos, const double lattice_sin,
     std::vector<XYZTransform>* transforms) const
 {
   if (xy_sampling_resolution == 0) {
@@ -240,8 +384,10 @@ void ADHTracker3d::createCandidateXYZTransforms(
     const double z = zRange_orig.first;
 
     // Compute the number of transforms along each direction.
-    const int num_x_locations = (xRange.second - xRange.first) / xy_sampling_resolution + 1;
-    const int num_y_locations = (yRange.second - yRange.first) / xy_sampling_resolution + 1;
+    const int num_x_locations =
+        getNumLocations(xRange.first, xRange.second, xy_sampling_resolution);
+    const int num_y_locations =
+        getNumLocations(yRange.first, yRange.second, xy_sampling_resolution);
 
     // Reserve space for all of the transforms.
     transforms->reserve(num_x_locations * num_y_locations);
@@ -251,8 +397,16 @@ void ADHTracker3d::createCandidateXYZTransforms(
     const double volume = pow(xy_sampling_resolution, 2);
 
     // Create candidate transforms.  We only sample in the horizontal direction.
-    for (double x = xRange.first; x <= xRange.second; x += xy_sampling_resolution) {
-      for (double y = yRange.first; y <= yRange.second; y += xy_sampling_resolution) {
+    // Index the samples with integers so that rounding errors do not
+    // accumulate across the range.
+    for (int i = 0; i < num_x_locations; ++i) {
+      const double u = xRange.first + i * xy_sampling_resolution;
+      for (int j = 0; j < num_y_locations; ++j) {
+        const double v = yRange.first + j * xy_sampling_resolution;
+        // Rotate from the lattice frame into the xy frame.
+        const double x = u * lattice_cos - v * lattice_sin;
+        const double y = u * lattice_sin + v * lattice_cos;
+
         XYZTransform transform(x, y, z, volume);
         transforms->push_back(transform);
       }
@@ -270,19 +424,31 @@ void ADHTracker3d::createCandidateXYZTransforms(
     }
 
     // Compute the number of transforms along each direction.
-    const int num_x_locations = (xRange.second - xRange.first) / xy_sampling_resolution + 1;
-    const int num_y_locations = (yRange.second - yRange.first) / xy_sampling_resolution + 1;
-    const int num_z_locations = (zRange.second - zRange.first) / z_sampling_resolution + 1;
+    const int num_x_locations =
+        getNumLocations(xRange.first, xRange.second, xy_sampling_resolution);
+    const int num_y_locations =
+        getNumLocations(yRange.first, yRange.second, xy_sampling_resolution);
+    const int num_z_locations =
+        getNumLocations(zRange.first, zRange.second, z_sampling_resolution);
 
     // Reserve space for all of the transforms.
     transforms->reserve(num_x_locations * num_y_locations * num_z_locations);
 
     const double volume = pow(xy_sampling_resolution, 2) * z_sampling_resolution;
 
-    // Create candidate transforms.
-    for (double x = xRange.first; x <= xRange.second; x += xy_sampling_resolution) {
-      for (double y = yRange.first; y <= yRange.second; y += xy_sampling_resolution) {
-        for (double z = zRange.first; z <= zRange.second; z += z_sampling_resolution) {
+    // Create candidate transforms, indexing the samples with integers as
+    // above.
+    for (int i = 0; i < num_x_locations; ++i) {
+      const double u = xRange.first + i * xy_sampling_resolution;
+      for (int j = 0; j < num_y_locations; ++j) {
+        const double v = yRange.first + j * xy_sampling_resolution;
+
+        // Rotate from the lattice frame into the xy frame.
+        const double x = u * lattice_cos - v * lattice_sin;
+        const double y = u * lattice_sin + v * lattice_cos;
+
+        for (int k = 0; k < num_z_locations; ++k) {
+          const double z = zRange.first + k * z_sampling_resolution;
           XYZTransform transform(x, y, z, volume);
           transforms->push_back(transform);
         }
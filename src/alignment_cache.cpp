@@ -0,0 +1,302 @@
+/*
+ * alignment_cache.cpp
+ *
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <iomanip>
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <precision_tracking/alignment_cache.h>
+
+using std::string;
+using std::vector;
+
+namespace precision_tracking {
+
+namespace {
+
+// 64-bit FNV-1a hash.
+const boost::uint64_t kFnvOffsetBasis = 14695981039346656037ULL;
+const boost::uint64_t kFnvPrime = 1099511628211ULL;
+
+void hashBytes(const void* data, const size_t num_bytes, boost::uint64_t* hash)
+{
+  const unsigned char* bytes = static_cast<const unsigned char*>(data);
+  for (size_t i = 0; i < num_bytes; ++i) {
+    *hash ^= bytes[i];
+    *hash *= kFnvPrime;
+  }
+}
+
+template <class T>
+void hashValue(const T& value, boost::uint64_t* hash)
+{
+  hashBytes(&value, sizeof(T), hash);
+}
+
+void hashCloud(const pcl::PointCloud<pcl::PointXYZRGB>& cloud,
+               boost::uint64_t* hash)
+{
+  hashValue(cloud.size(), hash);
+  for (size_t i = 0; i < cloud.size(); ++i) {
+    const pcl::PointXYZRGB& pt = cloud[i];
+    hashValue(pt.x, hash);
+    hashValue(pt.y, hash);
+    hashValue(pt.z, hash);
+    hashValue(pt.rgb, hash);
+  }
+}
+
+const char kCacheHeader[] = "AlignmentCache";
+
+// Hash all sections of the params except for the motion model and tracker
+// sections.
+void hashMeasurementSections(const Params& params, boost::uint64_t* hash)
+{
+  // ADH tracker section.
+  hashValue(params.kMinResFactor, hash);
+  hashValue(params.kDesiredSamplingResolution, hash);
+  hashValue(params.kReductionFactor, hash);
+  hashValue(params.kMaxNumTransforms, hash);
+  hashValue(params.kMinProb, hash);
+
+  // Alignment evaluator section.
+  hashValue(params.kSigmaFactor, hash);
+  hashValue(params.kSigmaGridFactor, hash);
+  hashValue(params.kMinMeasurementVariance, hash);
+  hashValue(params.kSmoothingFactor, hash);
+  hashValue(params.kMeasurementDiscountFactor, hash);
+  hashValue(params.kMaxDiscountPoints, hash);
+
+  // Density grid evaluator section.
+  hashValue(params.kSpilloverRadius, hash);
+  hashValue(params.kMaxXSize, hash);
+  hashValue(params.kMaxYSize, hash);
+  hashValue(params.kMaxZSize, hash);
+  hashValue(params.useFixedPointGrid, hash);
+  hashValue(params.kSpilloverFactorBinsPerLog, hash);
+
+  // Down sampler section.
+  hashValue(params.kUseCeil, hash);
+
+  // LF RGBD 6D evaluator section.
+  hashValue(params.kSearchTreeEpsilon, hash);
+  hashValue(params.useSpatialHash, hash);
+  hashValue(params.kSpatialHashRadius, hash);
+  hashValue(params.kTwoColors, hash);
+  hashValue(params.kValueSigma1, hash);
+  hashValue(params.kValueSigma2, hash);
+  hashValue(params.kProbColorMatch, hash);
+  hashValue(params.kColorThreshFactor, hash);
+  hashValue(params.kColorSpace, hash);
+
+  // Precision tracker section.
+  hashValue(params.useColor, hash);
+  hashValue(params.useProjectedColorField, hash);
+  hashValue(params.use3D, hash);
+  hashValue(params.useRangeImage, hash);
+  hashValue(params.kCurrFrameDownsample, hash);
+  hashValue(params.kPrevFrameDownsample, hash);
+  hashValue(params.stochastic_downsample, hash);
+  hashValue(params.maxZ, hash);
+  hashValue(params.kInitialXYSamplingResolution, hash);
+  hashValue(params.kInitialZSamplingResolution, hash);
+  hashValue(params.kSearchWindowOrientation, hash);
+  hashValue(params.kAlongTrackSearchFactor, hash);
+  hashValue(params.kCrossTrackSearchFactor, hash);
+  hashValue(params.kMinOrientationSpeed, hash);
+  hashValue(params.useStaticFastPath, hash);
+  hashValue(params.kStaticMaxDisplacement, hash);
+  hashValue(params.kStaticMaxMotionStd, hash);
+  hashValue(params.kStaticProbeOffset, hash);
+  hashValue(params.kStaticSearchRadius, hash);
+  hashValue(params.kStaticXYSamplingResolution, hash);
+}
+
+} // namespace
+
+boost::uint64_t hashMeasurementParams(const Params& params)
+{
+  boost::uint64_t hash = kFnvOffsetBasis;
+  hashValue(ALIGNMENT_CACHE_VERSION, &hash);
+  hashMeasurementSections(params, &hash);
+  return hash;
+}
+
+boost::uint64_t hashParams(const Params& params)
+{
+  boost::uint64_t hash = kFnvOffsetBasis;
+
+  // Tracker section.
+  hashValue(params.useMean, &hash);
+
+  // Motion model section.
+  hashValue(params.kPropagationVarianceXY, &hash);
+  hashValue(params.kPropagationVarianceZ, &hash);
+  hashValue(params.kCentroidMeasurementNoise, &hash);
+  hashValue(params.kCentroidInitVelocityVariance, &hash);
+  hashValue(params.kMotionMinProb, &hash);
+
+  hashMeasurementSections(params, &hash);
+  return hash;
+}
+
+AlignmentCache::AlignmentCache(const std::string& cache_dir,
+                               const Params *params)
+  : cache_dir_(cache_dir),
+    params_hash_(hashMeasurementParams(*params))
+{
+}
+
+string AlignmentCache::getFilename(
+    const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& previous_points,
+    const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& current_points,
+    const double sensor_horizontal_resolution,
+    const double sensor_vertical_resolution) const
+{
+  boost::uint64_t hash = params_hash_;
+  hashCloud(*previous_points, &hash);
+  hashCloud(*current_points, &hash);
+  hashValue(sensor_horizontal_resolution, &hash);
+  hashValue(sensor_vertical_resolution, &hash);
+
+  std::ostringstream filename_stream;
+  filename_stream << cache_dir_ << "/" << std::hex << std::setw(16)
+                  << std::setfill('0') << hash << ".alignment";
+  return filename_stream.str();
+}
+
+bool AlignmentCache::load(
+    const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& previous_points,
+    const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& current_points,
+    const double sensor_horizontal_resolution,
+    const double sensor_vertical_resolution,
+    ScoredTransforms<ScoredTransformXYZ>* scored_transforms) const
+{
+  const string filename = getFilename(
+        previous_points, current_points,
+        sensor_horizontal_resolution, sensor_vertical_resolution);
+
+  FILE* fid = fopen(filename.c_str(), "rb");
+  if (fid == NULL) {
+    return false;
+  }
+
+  char header[sizeof(kCacheHeader)];
+  boost::uint64_t num_transforms = 0;
+  bool success =
+      fread(header, sizeof(header), 1, fid) == 1 &&
+      memcmp(header, kCacheHeader, sizeof(header)) == 0 &&
+      fread(&num_transforms, sizeof(num_transforms), 1, fid) == 1;
+
+  // Each transform is stored as x, y, z, log probability, volume.  Check
+  // num_transforms against the rest of the file before allocating the
+  // values, in case the file is corrupt.
+  const size_t transform_size = 5 * sizeof(double);
+  if (success) {
+    const long data_start = ftell(fid);
+    success = data_start >= 0 && fseek(fid, 0, SEEK_END) == 0;
+    const long data_end = success ? ftell(fid) : -1;
+    success = success && data_end >= data_start &&
+        fseek(fid, data_start, SEEK_SET) == 0;
+    if (success) {
+      const size_t data_size = static_cast<size_t>(data_end - data_start);
+      success = data_size % transform_size == 0 &&
+          num_transforms == data_size / transform_size;
+    }
+  }
+  if (!success) {
+    fclose(fid);
+    printf("Error - corrupt alignment cache file: %s\n", filename.c_str());
+    return false;
+  }
+
+  vector<double> values(5 * num_transforms);
+  success = (num_transforms == 0 ||
+      fread(&values[0], sizeof(double), values.size(), fid) == values.size());
+  fclose(fid);
+
+  if (!success) {
+    printf("Error - corrupt alignment cache file: %s\n", filename.c_str());
+    return false;
+  }
+
+  scored_transforms->clear();
+  scored_transforms->reserve(num_transforms);
+  for (size_t i = 0; i < num_transforms; ++i) {
+    const double* v = &values[5 * i];
+    scored_transforms->addScoredTransform(
+          ScoredTransformXYZ(v[0], v[1], v[2], v[3], v[4]));
+  }
+
+  return true;
+}
+
+bool AlignmentCache::save(
+    const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& previous_points,
+    const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& current_points,
+    const double sensor_horizontal_resolution,
+    const double sensor_vertical_resolution,
+    const ScoredTransforms<ScoredTransformXYZ>& scored_transforms) const
+{
+  const string filename = getFilename(
+        previous_points, current_points,
+        sensor_horizontal_resolution, sensor_vertical_resolution);
+
+  const vector<ScoredTransformXYZ>& transforms =
+      scored_transforms.getScoredTransforms();
+  const boost::uint64_t num_transforms = transforms.size();
+
+  vector<double> values;
+  values.reserve(5 * num_transforms);
+  for (size_t i = 0; i < num_transforms; ++i) {
+    const ScoredTransformXYZ& transform = transforms[i];
+    values.push_back(transform.getX());
+    values.push_back(transform.getY());
+    values.push_back(transform.getZ());
+    values.push_back(transform.getUnnormalizedLogProb());
+    values.push_back(transform.getVolume());
+  }
+
+  // Write to a temporary file and then rename it, so that readers never
+  // see a partially written file.
+  string temp_filename = filename + ".XXXXXX";
+  vector<char> temp_filename_buffer(temp_filename.begin(), temp_filename.end());
+  temp_filename_buffer.push_back('\0');
+  const int fd = mkstemp(&temp_filename_buffer[0]);
+  if (fd == -1) {
+    printf("Error - cannot create alignment cache file: %s\n",
+           filename.c_str());
+    return false;
+  }
+  temp_filename = &temp_filename_buffer[0];
+
+  FILE* fid = fdopen(fd, "wb");
+  bool success =
+      fid != NULL &&
+      fwrite(kCacheHeader, sizeof(kCacheHeader), 1, fid) == 1 &&
+      fwrite(&num_transforms, sizeof(num_transforms), 1, fid) == 1 &&
+      (values.empty() ||
+       fwrite(&values[0], sizeof(double), values.size(), fid) == values.size());
+  if (fid != NULL) {
+    success = (fclose(fid) == 0) && success;
+  } else {
+    close(fd);
+  }
+
+  success = success && rename(temp_filename.c_str(), filename.c_str()) == 0;
+  if (!success) {
+    printf("Error - cannot write alignment cache file: %s\n",
+           filename.c_str());
+    unlink(temp_filename.c_str());
+  }
+
+  return success;
+}
+
+} // namespace precision_tracking
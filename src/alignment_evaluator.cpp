@@ -14,6 +14,7 @@ namespace precision_tracking {
 AlignmentEvaluator::AlignmentEvaluator(const Params *params)
   : params_(params)
   , smoothing_factor_(params_->kSmoothingFactor)
+  , num_scored_points_(0)
 {
 }
 
@@ -92,6 +93,7 @@ void AlignmentEvaluator::score3DTransforms(
        num_current_points);
 
   const size_t num_transforms = transforms.size();
+  num_scored_points_ += num_transforms * num_current_points;
 
   // Compute scores for all of the transforms using the density grid.
   scored_transforms->clear();
@@ -0,0 +1,72 @@
+/*
+ * color_likelihood.cpp
+ *
+ */
+
+#include <cmath>
+
+#include <precision_tracking/color_likelihood.h>
+
+
+namespace precision_tracking {
+
+ColorLikelihood::ColorLikelihood(const Params *params,
+                                 const double smoothing_factor)
+  : params_(params),
+    color_exp_factor1_(-1.0 / params_->kValueSigma1),
+    color_exp_factor2_(-1.0 / params_->kValueSigma2),
+    prob_color_match_(0),
+    color_exps1_(kNumColors),
+    color_exps2_(kNumColors),
+    color_match_probs1_(kNumColors),
+    color_mismatch_prob_(0)
+{
+  // Tabulate the color Laplacians for every color distance.
+  for (int i = 0; i < kNumColors; ++i) {
+    const double color_distance = i;
+    color_exps1_[i] = exp(color_distance * color_exp_factor1_);
+    color_exps2_[i] = exp(color_distance * color_exp_factor2_);
+  }
+
+  // Because we are using color, we have to modify the smoothing factor.
+  const double factor1 = smoothing_factor / (smoothing_factor + 1);
+  if (!params_->kTwoColors) {
+    color_smoothing_factor_ = factor1 / 255;
+  } else {
+    color_smoothing_factor_ = factor1 / pow(255, 2);
+  }
+}
+
+void ColorLikelihood::init(const double xy_sampling_resolution,
+                           const double z_sampling_resolution)
+{
+  // Compute the total particle sampling resolution
+  const double sampling_resolution = sqrt(pow(xy_sampling_resolution, 2) +
+                                          pow(z_sampling_resolution, 2));
+
+  // Set the probability of seeing a color match, which is based on the
+  // particle sampling resolution - when we are sampling sparsely, we do not
+  // expect the colors to align well.
+  if (params_->kColorThreshFactor == 0) {
+    prob_color_match_ = params_->kProbColorMatch;
+  } else {
+    prob_color_match_ = params_->kProbColorMatch * exp(-pow(sampling_resolution, 2) /
+        (2 * pow(params_->kColorThreshFactor, 2)));
+  }
+
+  // Tabulate the color match probability for every color distance, for the
+  // current prob_color_match_.
+  for (int i = 0; i < kNumColors; ++i) {
+    if (params_->kTwoColors) {
+      color_match_probs1_[i] =
+          prob_color_match_ * (-0.5 * color_exp_factor1_ * color_exps1_[i]);
+    } else {
+      color_match_probs1_[i] =
+          (1-prob_color_match_) * 1.0 / 255 +
+          prob_color_match_ * -1 * color_exp_factor1_ * color_exps1_[i];
+    }
+  }
+  color_mismatch_prob_ = (1-prob_color_match_) * 1.0 / pow(255, 2);
+}
+
+} // namespace precision_tracking
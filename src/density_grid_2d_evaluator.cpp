@@ -13,6 +13,7 @@
 #include <pcl/common/common.h>
 
 #include <precision_tracking/density_grid_2d_evaluator.h>
+#include <precision_tracking/fixed_point.h>
 
 
 namespace precision_tracking {
@@ -28,12 +29,20 @@ using std::min;
 
 // Initialize the density grid to all have log(kSmoothingFactor), so we do
 // not give a probability of 0 to any location.
+// Only the grid which we use (doubles or fixed point) is allocated.
 DensityGrid2dEvaluator::DensityGrid2dEvaluator(const Params *params)
-  : AlignmentEvaluator(params)
-  , density_grid_(params_->kMaxXSize, vector<double>(
-                    params_->kMaxYSize, log(smoothing_factor_)))
+  : AlignmentEvaluatorImpl<DensityGrid2dEvaluator>(params)
+  , use_fixed_point_(params_->useFixedPointGrid)
+  , fixed_point_scale_(getFixedPointScale(smoothing_factor_))
 {
-
+  if (use_fixed_point_) {
+    fixed_point_grid_.assign(params_->kMaxXSize, vector<boost::int16_t>(
+        params_->kMaxYSize, toFixedPoint(log(smoothing_factor_),
+                                         fixed_point_scale_)));
+  } else {
+    density_grid_.assign(params_->kMaxXSize, vector<double>(
+        params_->kMaxYSize, log(smoothing_factor_)));
+  }
 }
 
 DensityGrid2dEvaluator::~DensityGrid2dEvaluator()
@@ -54,7 +63,11 @@ void DensityGrid2dEvaluator::init(const double xy_sampling_resolution,
   computeDensityGridParameters(
         prev_points_, xy_sampling_resolution, sensor_horizontal_resolution);
 
-  computeDensityGrid(prev_points_);
+  if (use_fixed_point_) {
+    computeDensityGrid(prev_points_, &fixed_point_grid_);
+  } else {
+    computeDensityGrid(prev_points_, &density_grid_);
+  }
 }
 
 void DensityGrid2dEvaluator::computeDensityGridParameters(
@@ -91,10 +104,11 @@ void DensityGrid2dEvaluator::computeDensityGridParameters(
 
   // Reset the density grid to the default value.
   const double default_val = log(smoothing_factor_);
-  for (int i = 0; i < xSize_; ++i) {
-    std::fill(
-        density_grid_[i].begin(),
-        density_grid_[i].begin() + ySize_, default_val);
+  if (use_fixed_point_) {
+    resetGrid(toFixedPoint(default_val, fixed_point_scale_),
+              &fixed_point_grid_);
+  } else {
+    resetGrid(default_val, &density_grid_);
   }
 
   // In our discrete grid, we want to compute the Gaussian for a certian
@@ -103,8 +117,19 @@ void DensityGrid2dEvaluator::computeDensityGridParameters(
       ceil(params_->kSpilloverRadius * sigma_xy_ / xy_grid_step_ - 1);
 }
 
+template <class Cell>
+void DensityGrid2dEvaluator::resetGrid(
+    const Cell default_val, vector<vector<Cell> >* grid) const
+{
+  for (int i = 0; i < xSize_; ++i) {
+    std::fill((*grid)[i].begin(), (*grid)[i].begin() + ySize_, default_val);
+  }
+}
+
+template <class Cell>
 void DensityGrid2dEvaluator::computeDensityGrid(
-    const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& points)
+    const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& points,
+    vector<vector<Cell> >* grid)
 {
   // Apply this offset when converting from the point location to the index.
   const double x_offset = -min_pt_.x / xy_grid_step_;
@@ -117,22 +142,15 @@ void DensityGrid2dEvaluator::computeDensityGrid(
       -1.0 * pow(xy_grid_step_, 2) / (2 * pow(sigma_xy_, 2));
 
   // For any given point, the density falls off as a Gaussian to
-  // neighboring regions.
-  // Pre-compute the density spillover for different cell distances.
-  vector<vector<double> > spillovers(
-        num_spillover_steps_xy_ + 1, vector<double>(
-          num_spillover_steps_xy_ + 1));
-  for (int i = 0; i <= num_spillover_steps_xy_; ++i) {
-    const int i_dist_sq = pow(i, 2);
-
-    for (int j = 0; j <= num_spillover_steps_xy_; ++j) {
-      const int j_dist_sq = pow(j, 2);
-      const double log_xy_density = (i_dist_sq + j_dist_sq) * xy_exp_factor;
-
-      spillovers[i][j] = log(
-            exp(log_xy_density) + smoothing_factor_);
-    }
-  }
+  // neighboring regions.  The density spillover for different cell
+  // distances can be shared with the other evaluators (see
+  // Params::kSpilloverFactorBinsPerLog).
+  const SpilloverKernel& spillover_kernel =
+      SpilloverCache::getInstance().getKernel(
+        num_spillover_steps_xy_, 0, xy_exp_factor, 0, smoothing_factor_,
+        params_->kSpilloverFactorBinsPerLog, &spillover_kernel_);
+  const Cell* spillovers = spillover_kernel.getCells<Cell>();
+  const int x_stride = num_spillover_steps_xy_ + 1;
 
   // Build the density grid
   size_t num_points = points->size();
@@ -172,64 +190,122 @@ void DensityGrid2dEvaluator::computeDensityGrid(
       for (int y_spill = min_y_index; y_spill <= max_y_index; ++y_spill) {
         const int y_diff = abs(y_index - y_spill);
 
-        const double spillover0 = spillovers[x_diff][y_diff];
+        // Rounding to fixed point preserves the order of the values, so
+        // taking the max of the rounded values gives the same grid as
+        // rounding the max.
+        const Cell spillover0 = spillovers[x_diff * x_stride + y_diff];
 
-        density_grid_[x_spill][y_spill] =
-            max(density_grid_[x_spill][y_spill], spillover0);
+        (*grid)[x_spill][y_spill] =
+            max((*grid)[x_spill][y_spill], spillover0);
       }
     }
   }
 }
 
-double DensityGrid2dEvaluator::getLogProbability(
+void DensityGrid2dEvaluator::getLogProbabilities(
     const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& current_points,
     const Eigen::Vector3f& ,
     const MotionModel& motion_model,
-    const double delta_x, const double delta_y, const double delta_z)
+    const XYZTransform* transforms, const size_t num_transforms,
+    double* log_probs)
 {
-  // Amount of total log probability density for the given alignment.
-  double total_log_density = 0;
+  // Offset to apply to each point to get the new position, for each
+  // transform.
+  double x_offsets[kTransformBlockSize];
+  double y_offsets[kTransformBlockSize];
+  for (size_t i = 0; i < num_transforms; ++i) {
+    x_offsets[i] = (transforms[i].x - min_pt_.x) / xy_grid_step_;
+    y_offsets[i] = (transforms[i].y - min_pt_.y) / xy_grid_step_;
+  }
 
-  // Offset to apply to each point to get the new position.
-  const double x_offset = (delta_x - min_pt_.x) / xy_grid_step_;
-  const double y_offset = (delta_y - min_pt_.y) / xy_grid_step_;
+  // Amount of total log probability density for each of the alignments.
+  double total_log_densities[kTransformBlockSize];
+  if (use_fixed_point_) {
+    sumLogDensities<boost::int16_t, boost::int32_t>(
+          *current_points, fixed_point_grid_, x_offsets, y_offsets,
+          num_transforms, total_log_densities);
 
-  // Iterate over every point and look up its log probability density
-  // in the density grid.
-	const size_t num_points = current_points->size();
-  for (size_t i = 0; i < num_points; ++i) {
-    // Extract the point so we can compute its probability.
-  	const pcl::PointXYZRGB& pt = (*current_points)[i];
-
-    // We shift each point based on the proposed alignment, to try to
-    // align the current points with the previous points.  We then
-    // divide by the grid step to find the appropriate cell in the density
-    // grid.
-    const int x_index_shifted =
-        min(max(0, static_cast<int>(round(pt.x / xy_grid_step_ + x_offset))),
-            xSize_ - 1);
-    const int y_index_shifted =
-        min(max(0, static_cast<int>(round(pt.y / xy_grid_step_ + y_offset))),
-            ySize_ - 1);
-
-    // Look up the log density of this grid cell and add to the total density.
-    total_log_density +=
-        density_grid_[x_index_shifted][y_index_shifted];
+    // Convert the fixed point sums back to log densities.
+    for (size_t i = 0; i < num_transforms; ++i) {
+      total_log_densities[i] /= fixed_point_scale_;
+    }
+  } else {
+    sumLogDensities<double, double>(
+          *current_points, density_grid_, x_offsets, y_offsets,
+          num_transforms, total_log_densities);
   }
 
-  // Compute the motion model probability.
-  const double motion_model_prob = motion_model.computeScore(
-              delta_x, delta_y, delta_z);
+  for (size_t i = 0; i < num_transforms; ++i) {
+    // Compute the motion model probability.
+    const double motion_model_prob = motion_model.computeScore(
+                transforms[i].x, transforms[i].y, transforms[i].z);
 
-  // Compute the log measurement probability.
-  const double log_measurement_prob = total_log_density;
+    // Compute the log measurement probability.
+    const double log_measurement_prob = total_log_densities[i];
 
-  // Combine the motion model score with the (discounted) measurement score to
-  // get the final log probability.
-  const double log_prob = log(motion_model_prob) +
-      measurement_discount_factor_ * log_measurement_prob;
+    // Combine the motion model score with the (discounted) measurement score
+    // to get the final log probability.
+    log_probs[i] = log(motion_model_prob) +
+        measurement_discount_factor_ * log_measurement_prob;
+  }
+}
 
-  return log_prob;
+template <class Cell, class Sum>
+void DensityGrid2dEvaluator::sumLogDensities(
+    const pcl::PointCloud<pcl::PointXYZRGB>& current_points,
+    const vector<vector<Cell> >& grid,
+    const double* x_offsets, const double* y_offsets,
+    const size_t num_transforms,
+    double* total_log_densities) const
+{
+  for (size_t j = 0; j < num_transforms; ++j) {
+    total_log_densities[j] = 0;
+  }
+
+  // Sum the points in blocks, so that the sum of each block fits in Sum.
+  const size_t num_points = current_points.size();
+  for (size_t start = 0; start < num_points;
+       start += kMaxFixedPointSumTerms) {
+    const size_t end = min(num_points, start + kMaxFixedPointSumTerms);
+
+    Sum block_log_densities[kTransformBlockSize];
+    for (size_t j = 0; j < num_transforms; ++j) {
+      block_log_densities[j] = 0;
+    }
+
+    // Iterate over every point once, and look up its log probability density
+    // in the density grid for each of the transforms.  Neighboring
+    // transforms mostly look up nearby grid cells, which are then still
+    // in the cache.
+    for (size_t i = start; i < end; ++i) {
+      // Extract the point so we can compute its probability.
+      const pcl::PointXYZRGB& pt = current_points[i];
+
+      // Divide by the grid step to find the location in the density grid.
+      const double x_scaled = pt.x / xy_grid_step_;
+      const double y_scaled = pt.y / xy_grid_step_;
+
+      for (size_t j = 0; j < num_transforms; ++j) {
+        // We shift each point based on the proposed alignment, to try to
+        // align the current points with the previous points, and find the
+        // appropriate cell in the density grid.
+        const int x_index_shifted =
+            min(max(0, static_cast<int>(round(x_scaled + x_offsets[j]))),
+                xSize_ - 1);
+        const int y_index_shifted =
+            min(max(0, static_cast<int>(round(y_scaled + y_offsets[j]))),
+                ySize_ - 1);
+
+        // Look up the log density of this grid cell and add to the total
+        // density.
+        block_log_densities[j] += grid[x_index_shifted][y_index_shifted];
+      }
+    }
+
+    for (size_t j = 0; j < num_transforms; ++j) {
+      total_log_densities[j] += block_log_densities[j];
+    }
+  }
 }
 
 } // namespace precision_tracking
@@ -13,6 +13,7 @@
 #include <pcl/common/common.h>
 
 #include <precision_tracking/density_grid_3d_evaluator.h>
+#include <precision_tracking/fixed_point.h>
 
 
 namespace precision_tracking {
@@ -28,13 +29,23 @@ using std::min;
 
 // Initialize the density grid to all have log(kSmoothingFactor), so we do
 // not give a probability of 0 to any location.
+// Only the grid which we use (doubles or fixed point) is allocated.
 DensityGrid3dEvaluator::DensityGrid3dEvaluator(const Params *params)
-  : AlignmentEvaluator(params)
-  , density_grid_(params_->kMaxXSize, vector<vector<double> >(
-                    params_->kMaxYSize, vector<double>(
-                      params_->kMaxZSize, log(smoothing_factor_))))
+  : AlignmentEvaluatorImpl<DensityGrid3dEvaluator>(params)
+  , use_fixed_point_(params_->useFixedPointGrid)
+  , fixed_point_scale_(getFixedPointScale(smoothing_factor_))
 {
-
+  if (use_fixed_point_) {
+    fixed_point_grid_.assign(
+          params_->kMaxXSize, vector<vector<boost::int16_t> >(
+            params_->kMaxYSize, vector<boost::int16_t>(
+              params_->kMaxZSize, toFixedPoint(log(smoothing_factor_),
+                                               fixed_point_scale_))));
+  } else {
+    density_grid_.assign(params_->kMaxXSize, vector<vector<double> >(
+                           params_->kMaxYSize, vector<double>(
+                             params_->kMaxZSize, log(smoothing_factor_))));
+  }
 }
 
 DensityGrid3dEvaluator::~DensityGrid3dEvaluator()
@@ -56,7 +67,11 @@ void DensityGrid3dEvaluator::init(const double xy_sampling_resolution,
         prev_points_, xy_sampling_resolution, z_sampling_resolution,
         sensor_horizontal_resolution, sensor_vertical_resolution);
 
-  computeDensityGrid(prev_points_);
+  if (use_fixed_point_) {
+    computeDensityGrid(prev_points_, &fixed_point_grid_);
+  } else {
+    computeDensityGrid(prev_points_, &density_grid_);
+  }
 }
 
 void DensityGrid3dEvaluator::computeDensityGridParameters(
@@ -110,12 +125,11 @@ void DensityGrid3dEvaluator::computeDensityGridParameters(
 
   // Reset the density grid to the default value.
   const double default_val = log(smoothing_factor_);
-  for (int i = 0; i < xSize_; ++i) {
-    for (int j = 0; j < ySize_; ++j) {
-      std::fill(
-          density_grid_[i][j].begin(),
-          density_grid_[i][j].begin() + zSize_, default_val);
-    }
+  if (use_fixed_point_) {
+    resetGrid(toFixedPoint(default_val, fixed_point_scale_),
+              &fixed_point_grid_);
+  } else {
+    resetGrid(default_val, &density_grid_);
   }
 
   // In our discrete grid, we want to compute the Gaussian for a certian
@@ -128,14 +142,23 @@ void DensityGrid3dEvaluator::computeDensityGridParameters(
       max(1.0, ceil(params_->kSpilloverRadius * sigma_z_ / z_grid_step_ - 1));
 }
 
-void DensityGrid3dEvaluator::computeDensityGrid(
-    const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& points)
+template <class Cell>
+void DensityGrid3dEvaluator::resetGrid(
+    const Cell default_val, vector<vector<vector<Cell> > >* grid) const
 {
-  // Apply this offset when converting from the point location to the index.
-  const double x_offset = -min_pt_.x / xy_grid_step_;
-  const double y_offset = -min_pt_.y / xy_grid_step_;
-  const double z_offset = -min_pt_.z / z_grid_step_;
+  for (int i = 0; i < xSize_; ++i) {
+    for (int j = 0; j < ySize_; ++j) {
+      std::fill((*grid)[i][j].begin(), (*grid)[i][j].begin() + zSize_,
+                default_val);
+    }
+  }
+}
 
+template <class Cell>
+void DensityGrid3dEvaluator::computeDensityGrid(
+    const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& points,
+    vector<vector<vector<Cell> > >* grid)
+{
   // Convert sigma to a factor such that
   // exp(-x^2 * grid_size^2 / 2 sigma^2) = exp(x^2 * factor)
   // where x is the number of grid steps.
@@ -145,34 +168,48 @@ void DensityGrid3dEvaluator::computeDensityGrid(
       -1.0 * pow(z_grid_step_, 2) / (2 * pow(sigma_z_, 2));
 
   // For any given point, the density falls off as a Gaussian to
-  // neighboring regions.
-  // Pre-compute the density spillover for different cell distances.
-  vector<vector<vector<double> > > spillovers(
-        num_spillover_steps_xy_ + 1, vector<vector<double> >(
-          num_spillover_steps_xy_ + 1, vector<double>(
-            num_spillover_steps_z_ + 1)));
-  for (int i = 0; i <= num_spillover_steps_xy_; ++i) {
-    const int i_dist_sq = pow(i, 2);
-
-    for (int j = 0; j <= num_spillover_steps_xy_; ++j) {
-      const int j_dist_sq = pow(j, 2);
-      const double log_xy_density = (i_dist_sq + j_dist_sq) * xy_exp_factor;
-
-      for (int k = 0; k <= num_spillover_steps_z_; ++k) {
-        const int k_dist_sq = pow(k, 2);
-        const double log_z_density = k_dist_sq * z_exp_factor;
-
-        spillovers[i][j][k] = log(
-              exp(log_xy_density + log_z_density) + smoothing_factor_);
-      }
-    }
-  }
+  // neighboring regions.  The density spillover for different cell
+  // distances can be shared with the other evaluators (see
+  // Params::kSpilloverFactorBinsPerLog).
+  const SpilloverKernel& spillovers = SpilloverCache::getInstance().getKernel(
+        num_spillover_steps_xy_, num_spillover_steps_z_, xy_exp_factor,
+        z_exp_factor, smoothing_factor_, params_->kSpilloverFactorBinsPerLog,
+        &spillover_kernel_);
 
   if (num_spillover_steps_z_ == 0) {
     printf("Error - we assume that we are spilling at least 1 in the"
            "z-direction\n");
   }
 
+  // Choose the spillover kernel once for the whole grid, rather than once
+  // per point, so that each variant is compiled without the branch.
+  if (num_spillover_steps_z_ > 1) {
+    spillDensity<false>(points, spillovers.getCells<Cell>(), grid);
+  } else {
+    spillDensity<true>(points, spillovers.getCells<Cell>(), grid);
+  }
+}
+
+template <bool SingleZSpill, class Cell>
+void DensityGrid3dEvaluator::spillDensity(
+    const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& points,
+    const Cell* spillovers,
+    vector<vector<vector<Cell> > >* grid)
+{
+  // Rounding to fixed point preserves the order of the values, so taking
+  // the max of the rounded values gives the same grid as rounding the max.
+  vector<vector<vector<Cell> > >& density_grid = *grid;
+
+  // Apply this offset when converting from the point location to the index.
+  const double x_offset = -min_pt_.x / xy_grid_step_;
+  const double y_offset = -min_pt_.y / xy_grid_step_;
+  const double z_offset = -min_pt_.z / z_grid_step_;
+
+  // The strides of the spillover kernel (see SpilloverKernel).
+  const int z_stride = num_spillover_steps_z_ + 1;
+  const int y_stride = z_stride;
+  const int x_stride = (num_spillover_steps_xy_ + 1) * y_stride;
+
   // Build the density grid
   size_t num_points = points->size();
 
@@ -205,7 +242,7 @@ void DensityGrid3dEvaluator::computeDensityGrid(
     const int min_y_index =
         min(ySize_ - 2, max(1, y_index - num_spillover_steps_xy_));
 
-    if (num_spillover_steps_z_ > 1) {
+    if (!SingleZSpill) {
       const int max_z_index =
           max(1, min(zSize_ - 2, z_index + num_spillover_steps_z_));
       const int min_z_index =
@@ -221,10 +258,11 @@ void DensityGrid3dEvaluator::computeDensityGrid(
           for (int z_spill = min_z_index; z_spill <= max_z_index; ++z_spill) {
             const int z_diff = abs(z_index - z_spill);
 
-          const double spillover = spillovers[x_diff][y_diff][z_diff];
+          const Cell spillover =
+              spillovers[x_diff * x_stride + y_diff * y_stride + z_diff];
 
-          density_grid_[x_spill][y_spill][z_spill] =
-              max(density_grid_[x_spill][y_spill][z_spill], spillover);
+          density_grid[x_spill][y_spill][z_spill] =
+              max(density_grid[x_spill][y_spill][z_spill], spillover);
           }
         }
       }
@@ -244,18 +282,21 @@ void DensityGrid3dEvaluator::computeDensityGrid(
         for (int y_spill = min_y_index; y_spill <= max_y_index; ++y_spill) {
           const int y_diff = abs(y_index - y_spill);
 
-          const double spillover0 = spillovers[x_diff][y_diff][0];
+          const Cell* xy_spillovers =
+              &spillovers[x_diff * x_stride + y_diff * y_stride];
+
+          const Cell spillover0 = xy_spillovers[0];
 
-          density_grid_[x_spill][y_spill][z_spill] =
-              max(density_grid_[x_spill][y_spill][z_spill], spillover0);
+          density_grid[x_spill][y_spill][z_spill] =
+              max(density_grid[x_spill][y_spill][z_spill], spillover0);
 
-          const double spillover1 = spillovers[x_diff][y_diff][1];
+          const Cell spillover1 = xy_spillovers[1];
 
-          density_grid_[x_spill][y_spill][z_spill_up] =
-              max(density_grid_[x_spill][y_spill][z_spill_up], spillover1);
+          density_grid[x_spill][y_spill][z_spill_up] =
+              max(density_grid[x_spill][y_spill][z_spill_up], spillover1);
 
-          density_grid_[x_spill][y_spill][z_spill_down] =
-              max(density_grid_[x_spill][y_spill][z_spill_down], spillover1);
+          density_grid[x_spill][y_spill][z_spill_down] =
+              max(density_grid[x_spill][y_spill][z_spill_down], spillover1);
 
         }
       }
@@ -263,59 +304,116 @@ void DensityGrid3dEvaluator::computeDensityGrid(
   }
 }
 
-double DensityGrid3dEvaluator::getLogProbability(
+void DensityGrid3dEvaluator::getLogProbabilities(
     const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& current_points,
     const Eigen::Vector3f& ,
     const MotionModel& motion_model,
-    const double delta_x, const double delta_y, const double delta_z)
+    const XYZTransform* transforms, const size_t num_transforms,
+    double* log_probs)
 {
-  // Amount of total log probability density for the given alignment.
-  double total_log_density = 0;
+  // Offset to apply to each point to get the new position, for each
+  // transform.
+  double x_offsets[kTransformBlockSize];
+  double y_offsets[kTransformBlockSize];
+  double z_offsets[kTransformBlockSize];
+  for (size_t i = 0; i < num_transforms; ++i) {
+    x_offsets[i] = (transforms[i].x - min_pt_.x) / xy_grid_step_;
+    y_offsets[i] = (transforms[i].y - min_pt_.y) / xy_grid_step_;
+    z_offsets[i] = (transforms[i].z - min_pt_.z) / z_grid_step_;
+  }
 
-  // Offset to apply to each point to get the new position.
-  const double x_offset = (delta_x - min_pt_.x) / xy_grid_step_;
-  const double y_offset = (delta_y - min_pt_.y) / xy_grid_step_;
-  const double z_offset = (delta_z - min_pt_.z) / z_grid_step_;
+  // Amount of total log probability density for each of the alignments.
+  double total_log_densities[kTransformBlockSize];
+  if (use_fixed_point_) {
+    sumLogDensities<boost::int16_t, boost::int32_t>(
+          *current_points, fixed_point_grid_, x_offsets, y_offsets, z_offsets,
+          num_transforms, total_log_densities);
 
-  // Iterate over every point and look up its log probability density
-  // in the density grid.
-	const size_t num_points = current_points->size();
-  for (size_t i = 0; i < num_points; ++i) {
-    // Extract the point so we can compute its probability.
-  	const pcl::PointXYZRGB& pt = (*current_points)[i];
-
-    // We shift each point based on the proposed alignment, to try to
-    // align the current points with the previous points.  We then
-    // divide by the grid step to find the appropriate cell in the density
-    // grid.
-    const int x_index_shifted =
-        min(max(0, static_cast<int>(round(pt.x / xy_grid_step_ + x_offset))),
-            xSize_ - 1);
-    const int y_index_shifted =
-        min(max(0, static_cast<int>(round(pt.y / xy_grid_step_ + y_offset))),
-            ySize_ - 1);
-    const int z_index_shifted =
-        min(max(0, static_cast<int>(round(pt.z / z_grid_step_ + z_offset))),
-            zSize_ - 1);
-
-    // Look up the log density of this grid cell and add to the total density.
-    total_log_density +=
-        density_grid_[x_index_shifted][y_index_shifted][z_index_shifted];
+    // Convert the fixed point sums back to log densities.
+    for (size_t i = 0; i < num_transforms; ++i) {
+      total_log_densities[i] /= fixed_point_scale_;
+    }
+  } else {
+    sumLogDensities<double, double>(
+          *current_points, density_grid_, x_offsets, y_offsets, z_offsets,
+          num_transforms, total_log_densities);
+  }
+
+  for (size_t i = 0; i < num_transforms; ++i) {
+    // Compute the motion model probability.
+    const double motion_model_prob = motion_model.computeScore(
+                transforms[i].x, transforms[i].y, transforms[i].z);
+
+    // Compute the log measurement probability.
+    const double log_measurement_prob = total_log_densities[i];
+
+    // Combine the motion model score with the (discounted) measurement score
+    // to get the final log probability.
+    log_probs[i] = log(motion_model_prob) +
+        measurement_discount_factor_ * log_measurement_prob;
+  }
+}
+
+template <class Cell, class Sum>
+void DensityGrid3dEvaluator::sumLogDensities(
+    const pcl::PointCloud<pcl::PointXYZRGB>& current_points,
+    const vector<vector<vector<Cell> > >& grid,
+    const double* x_offsets, const double* y_offsets,
+    const double* z_offsets, const size_t num_transforms,
+    double* total_log_densities) const
+{
+  for (size_t j = 0; j < num_transforms; ++j) {
+    total_log_densities[j] = 0;
   }
 
-  // Compute the motion model probability.
-  const double motion_model_prob = motion_model.computeScore(
-              delta_x, delta_y, delta_z);
+  // Sum the points in blocks, so that the sum of each block fits in Sum.
+  const size_t num_points = current_points.size();
+  for (size_t start = 0; start < num_points;
+       start += kMaxFixedPointSumTerms) {
+    const size_t end = min(num_points, start + kMaxFixedPointSumTerms);
 
-  // Compute the log measurement probability.
-  const double log_measurement_prob = total_log_density;
+    Sum block_log_densities[kTransformBlockSize];
+    for (size_t j = 0; j < num_transforms; ++j) {
+      block_log_densities[j] = 0;
+    }
 
-  // Combine the motion model score with the (discounted) measurement score to
-  // get the final log probability.
-  const double log_prob = log(motion_model_prob) +
-      measurement_discount_factor_ * log_measurement_prob;
+    // Iterate over every point once, and look up its log probability density
+    // in the density grid for each of the transforms.  Neighboring
+    // transforms mostly look up nearby grid cells, which are then still
+    // in the cache.
+    for (size_t i = start; i < end; ++i) {
+      // Extract the point so we can compute its probability.
+      const pcl::PointXYZRGB& pt = current_points[i];
+
+      // Divide by the grid step to find the location in the density grid.
+      const double x_scaled = pt.x / xy_grid_step_;
+      const double y_scaled = pt.y / xy_grid_step_;
+      const double z_scaled = pt.z / z_grid_step_;
+
+      for (size_t j = 0; j < num_transforms; ++j) {
+        // We shift each point based on the proposed alignment, to try to
+        // align the current points with the previous points, and find the
+        // appropriate cell in the density grid.
+        const int x_index_shifted =
+            min(max(0, static_cast<int>(round(x_scaled + x_offsets[j]))),
+                xSize_ - 1);
+        const int y_index_shifted =
+            min(max(0, static_cast<int>(round(y_scaled + y_offsets[j]))),
+                ySize_ - 1);
+        const int z_index_shifted =
+            min(max(0, static_cast<int>(round(z_scaled + z_offsets[j]))),
+                zSize_ - 1);
+
+        // Look up the log density of this grid cell and add to the total
+        // density.
+        block_log_densities[j] += grid[x_index_shifted][y_index_shifted][z_index_shifted];
+      }
+    }
 
-  return log_prob;
+    for (size_t j = 0; j < num_transforms; ++j) {
+      total_log_densities[j] += block_log_densities[j];
+    }
+  }
 }
 
 } // namespace precision_tracking
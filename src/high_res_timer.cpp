@@ -8,6 +8,16 @@
 
 #include <precision_tracking/high_res_timer.h>
 
+#include <cstring>
+#include <stdint.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
 namespace precision_tracking {
 
 HighResTimer::HighResTimer(const std::string& description,
@@ -129,4 +139,178 @@ ScopedTimer::~ScopedTimer()
   std::cout << hrt_.report() << std::endl;
 }
 
+PerfCounters::PerfCounters(const std::string& description)
+  : description_(description)
+{
+  for (int i = 0; i < kNumEvents; ++i) {
+    fds_[i] = -1;
+    available_[i] = false;
+    start_[i] = 0;
+    totals_[i] = 0;
+  }
+
+#ifdef __linux__
+  const __u32 types[kNumEvents] = {
+    PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE,
+    PERF_TYPE_HARDWARE };
+  const __u64 configs[kNumEvents] = {
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES };
+
+  // Open each event separately, so that we can still count the others if
+  // one of them is not supported.
+  for (int i = 0; i < kNumEvents; ++i) {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = types[i];
+    attr.size = sizeof(attr);
+    attr.config = configs[i];
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+                       PERF_FORMAT_TOTAL_TIME_RUNNING;
+    // Only count user space events, which is allowed with the default
+    // perf_event_paranoid setting.
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    // Count events for this thread, on any CPU.
+    fds_[i] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    available_[i] = fds_[i] >= 0;
+  }
+#endif
+}
+
+PerfCounters::~PerfCounters()
+{
+  for (int i = 0; i < kNumEvents; ++i) {
+    if (fds_[i] >= 0) {
+      close(fds_[i]);
+    }
+  }
+}
+
+double PerfCounters::read(const Event event) const
+{
+  if (!available_[event]) {
+    return 0;
+  }
+
+  // The value, the time enabled and the time running.
+  uint64_t values[3];
+  if (::read(fds_[event], values, sizeof(values)) != sizeof(values) ||
+      values[2] == 0) {
+    return 0;
+  }
+  return static_cast<double>(values[0]) * values[1] / values[2];
+}
+
+void PerfCounters::start()
+{
+  for (int i = 0; i < kNumEvents; ++i) {
+    start_[i] = read(static_cast<Event>(i));
+  }
+}
+
+void PerfCounters::stop()
+{
+  for (int i = 0; i < kNumEvents; ++i) {
+    totals_[i] += read(static_cast<Event>(i)) - start_[i];
+  }
+}
+
+void PerfCounters::reset()
+{
+  for (int i = 0; i < kNumEvents; ++i) {
+    totals_[i] = 0;
+  }
+}
+
+void PerfCounters::add(const PerfCounters& other)
+{
+  for (int i = 0; i < kNumEvents; ++i) {
+    totals_[i] += other.totals_[i];
+    available_[i] = available_[i] || other.available_[i];
+  }
+}
+
+bool PerfCounters::isAvailable() const
+{
+  for (int i = 0; i < kNumEvents; ++i) {
+    if (available_[i]) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool PerfCounters::isAvailable(const Event event) const
+{
+  return available_[event];
+}
+
+double PerfCounters::getCount(const Event event) const
+{
+  return totals_[event];
+}
+
+double PerfCounters::getIPC() const
+{
+  if (!available_[kCycles] || !available_[kInstructions] ||
+      totals_[kCycles] == 0) {
+    return 0;
+  }
+  return totals_[kInstructions] / totals_[kCycles];
+}
+
+const char* PerfCounters::getEventName(const Event event)
+{
+  switch (event) {
+  case kCycles:
+    return "cycles";
+  case kInstructions:
+    return "instructions";
+  case kLLCMisses:
+    return "LLC misses";
+  case kBranchMisses:
+    return "branch misses";
+  default:
+    return "unknown";
+  }
+}
+
+std::string PerfCounters::report(const double num_items,
+                                 const std::string& item_name) const
+{
+  std::ostringstream oss;
+  oss << description_ << ":";
+  if (!isAvailable()) {
+    oss << " hardware counters not available.";
+    return oss.str();
+  }
+
+  for (int i = 0; i < kNumEvents; ++i) {
+    const Event event = static_cast<Event>(i);
+    if (available_[event]) {
+      oss << " " << getEventName(event) << " " << totals_[event] << ",";
+    }
+  }
+  if (available_[kCycles] && available_[kInstructions]) {
+    oss << " IPC " << getIPC() << ",";
+  }
+  if (num_items > 0) {
+    if (available_[kLLCMisses]) {
+      oss << " LLC misses per " << item_name << " "
+          << totals_[kLLCMisses] / num_items << ",";
+    }
+    if (available_[kBranchMisses]) {
+      oss << " branch misses per " << item_name << " "
+          << totals_[kBranchMisses] / num_items << ",";
+    }
+  }
+
+  // Replace the last comma.
+  std::string result = oss.str();
+  result[result.size() - 1] = '.';
+  return result;
+}
+
 } // namespace precision_tracking
@@ -0,0 +1,371 @@
+/*
+ * lf_rgbd_2d_evaluator.cpp
+ *
+ */
+
+
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#include <pcl/common/common.h>
+
+#include <precision_tracking/lf_rgbd_2d_evaluator.h>
+
+
+using std::max;
+using std::min;
+using std::vector;
+
+namespace precision_tracking {
+
+namespace {
+
+// The squared distance (in cells) of a cell from an empty column.
+const int kInfiniteSqDist = std::numeric_limits<int>::max();
+
+// The sums of the previous points in a cell, for computing their means.
+struct CellSums {
+  double x;
+  double y;
+  int color1;
+  int color2;
+  int count;
+};
+
+} // namespace
+
+
+LF_RGBD_2D_Evaluator::LF_RGBD_2D_Evaluator(const Params *params)
+  : AlignmentEvaluatorImpl<LF_RGBD_2D_Evaluator>(params),
+    xSize_(0),
+    ySize_(0),
+    xy_grid_step_(0),
+    height_exp_factor_(0),
+    use_color_(params->useColor),
+    color_likelihood_(params, smoothing_factor_)
+{
+  selectKernels();
+}
+
+LF_RGBD_2D_Evaluator::~LF_RGBD_2D_Evaluator()
+{
+}
+
+void LF_RGBD_2D_Evaluator::init(const double xy_sampling_resolution,
+          const double z_sampling_resolution,
+          const double sensor_horizontal_resolution,
+          const double sensor_vertical_resolution,
+          const size_t num_current_points)
+{
+  AlignmentEvaluator::init(xy_sampling_resolution, z_sampling_resolution,
+                           sensor_horizontal_resolution,
+                           sensor_vertical_resolution,
+                           num_current_points);
+
+  if (use_color_) {
+    color_likelihood_.init(xy_sampling_resolution_, z_sampling_resolution_);
+  }
+
+  // The previous points are sparse, so the heights of the points in a cell
+  // do not cover the heights at which the current points will hit the
+  // object, and comparing them only makes the alignment worse.  We only use
+  // the heights if we are searching over vertical translations; otherwise,
+  // as for the 2D density grid, we ignore them.
+  height_exp_factor_ = z_sampling_resolution > 0 ? z_exp_factor_ : 0;
+
+  // The grid has the same resolution as the particle sampling, as for the
+  // density grid, but the distance to each cell is measured from the
+  // centroid of its points rather than rounded to the grid.
+  xy_grid_step_ = xy_sampling_resolution > 0 ? xy_sampling_resolution :
+                                               sigma_xy_;
+
+  // Find the min and max of the previous points.
+  pcl::PointXYZRGB max_pt;
+  pcl::getMinMax3D(*prev_points_, min_pt_, max_pt);
+
+  // Use a coarser grid if the previous points do not fit in the maximum
+  // grid size.
+  const double x_extent = max_pt.x - min_pt_.x;
+  const double y_extent = max_pt.y - min_pt_.y;
+  xy_grid_step_ = max(xy_grid_step_, max(
+      x_extent / (params_->kMaxXSize - 1),
+      y_extent / (params_->kMaxYSize - 1)));
+
+  // Find the appropriate size for the grid.
+  xSize_ = min(params_->kMaxXSize,
+               static_cast<int>(floor(x_extent / xy_grid_step_)) + 1);
+  ySize_ = min(params_->kMaxYSize,
+               static_cast<int>(floor(y_extent / xy_grid_step_)) + 1);
+
+  if (params_->kColorSpace == 0) {
+    computeProjectedCells<0>();
+  } else {
+    computeProjectedCells<1>();
+  }
+
+  computeDistanceTransform();
+
+  selectKernels();
+}
+
+template <int ColorSpace>
+void LF_RGBD_2D_Evaluator::computeProjectedCells()
+{
+  cell_indices_.assign(xSize_ * ySize_, -1);
+  projected_cells_.clear();
+
+  vector<CellSums> cell_sums;
+
+  const size_t num_points = prev_points_->size();
+  for (size_t i = 0; i < num_points; ++i) {
+    const pcl::PointXYZRGB& pt = (*prev_points_)[i];
+
+    // Find the cell for this point.
+    const int x_index = min(xSize_ - 1, max(0, static_cast<int>(
+        floor((pt.x - min_pt_.x) / xy_grid_step_))));
+    const int y_index = min(ySize_ - 1, max(0, static_cast<int>(
+        floor((pt.y - min_pt_.y) / xy_grid_step_))));
+
+    int& cell_index = cell_indices_[x_index * ySize_ + y_index];
+    if (cell_index < 0) {
+      cell_index = projected_cells_.size();
+
+      ProjectedCell cell;
+      cell.min_z = pt.z;
+      cell.max_z = pt.z;
+      projected_cells_.push_back(cell);
+
+      const CellSums sums = { 0, 0, 0, 0, 0 };
+      cell_sums.push_back(sums);
+    }
+
+    ProjectedCell& cell = projected_cells_[cell_index];
+    cell.min_z = min(cell.min_z, pt.z);
+    cell.max_z = max(cell.max_z, pt.z);
+
+    CellSums& sums = cell_sums[cell_index];
+    sums.x += pt.x;
+    sums.y += pt.y;
+    sums.color1 += getFirstColor<ColorSpace>(pt);
+    sums.color2 += getSecondColor<ColorSpace>(pt);
+    sums.count++;
+  }
+
+  // Convert the sums to means.
+  const size_t num_cells = projected_cells_.size();
+  for (size_t i = 0; i < num_cells; ++i) {
+    ProjectedCell& cell = projected_cells_[i];
+    const CellSums& sums = cell_sums[i];
+    cell.x = sums.x / sums.count;
+    cell.y = sums.y / sums.count;
+    cell.color1 = (sums.color1 + sums.count / 2) / sums.count;
+    cell.color2 = (sums.color2 + sums.count / 2) / sums.count;
+  }
+}
+
+void LF_RGBD_2D_Evaluator::computeDistanceTransform()
+{
+  // Compute the Euclidean distance transform of the occupied cells,
+  // keeping track of the nearest cell, using the algorithm from
+  // Felzenszwalb and Huttenlocher, "Distance Transforms of Sampled
+  // Functions", 2012.
+  const int num_grid_cells = xSize_ * ySize_;
+  column_sq_dists_.resize(num_grid_cells);
+  column_nearest_.resize(num_grid_cells);
+  nearest_cells_.assign(num_grid_cells, -1);
+
+  // First find the nearest occupied cell in the same column, by sweeping
+  // each column in both directions.
+  for (int i = 0; i < xSize_; ++i) {
+    const int column = i * ySize_;
+
+    int last_occupied = -1;
+    for (int j = 0; j < ySize_; ++j) {
+      if (cell_indices_[column + j] >= 0) {
+        last_occupied = j;
+      }
+      column_nearest_[column + j] = last_occupied;
+    }
+
+    last_occupied = -1;
+    for (int j = ySize_ - 1; j >= 0; --j) {
+      if (cell_indices_[column + j] >= 0) {
+        last_occupied = j;
+      }
+      const int below = column_nearest_[column + j];
+      if (last_occupied >= 0 &&
+          (below < 0 || last_occupied - j < j - below)) {
+        column_nearest_[column + j] = last_occupied;
+      }
+
+      const int nearest = column_nearest_[column + j];
+      column_sq_dists_[column + j] =
+          nearest < 0 ? kInfiniteSqDist : (nearest - j) * (nearest - j);
+    }
+  }
+
+  // Then, for each row, find the column whose nearest cell is the closest,
+  // using the lower envelope of the parabolas (i - k)^2 + column_sq_dist(k).
+  envelope_cells_.resize(xSize_);
+  envelope_starts_.resize(xSize_);
+  for (int j = 0; j < ySize_; ++j) {
+    int num_envelope = 0;
+    for (int k = 0; k < xSize_; ++k) {
+      const int sq_dist = column_sq_dists_[k * ySize_ + j];
+      if (sq_dist == kInfiniteSqDist) {
+        continue;
+      }
+
+      // Remove the parabolas which are now hidden by parabola k.
+      double start = -std::numeric_limits<double>::infinity();
+      while (num_envelope > 0) {
+        const int prev_k = envelope_cells_[num_envelope - 1];
+        const int prev_sq_dist = column_sq_dists_[prev_k * ySize_ + j];
+        start = (static_cast<double>(sq_dist + k * k) -
+                 (prev_sq_dist + prev_k * prev_k)) / (2 * (k - prev_k));
+        if (start <= envelope_starts_[num_envelope - 1]) {
+          --num_envelope;
+          start = -std::numeric_limits<double>::infinity();
+        } else {
+          break;
+        }
+      }
+      envelope_cells_[num_envelope] = k;
+      envelope_starts_[num_envelope] = start;
+      ++num_envelope;
+    }
+
+    // If there are no occupied cells, leave the nearest cells unset.
+    if (num_envelope == 0) {
+      continue;
+    }
+
+    int envelope_index = 0;
+    for (int i = 0; i < xSize_; ++i) {
+      while (envelope_index + 1 < num_envelope &&
+             envelope_starts_[envelope_index + 1] < i) {
+        ++envelope_index;
+      }
+      const int k = envelope_cells_[envelope_index];
+      const int nearest_j = column_nearest_[k * ySize_ + j];
+      nearest_cells_[i * ySize_ + j] = cell_indices_[k * ySize_ + nearest_j];
+    }
+  }
+}
+
+struct LF_RGBD_2D_Evaluator::KernelSelector {
+  LF_RGBD_2D_Evaluator* evaluator;
+
+  template <bool UseColor, bool TwoColors, int ColorSpace>
+  void select() {
+    evaluator->sum_log_probs_ =
+        &LF_RGBD_2D_Evaluator::sumLogProbs<UseColor, TwoColors, ColorSpace>;
+  }
+};
+
+void LF_RGBD_2D_Evaluator::selectKernels()
+{
+  // Choose the kernel once per frame so that the color model is fixed at
+  // compile time inside of the per-point loop.
+  KernelSelector selector = { this };
+  selectColorModel(*params_, use_color_, &selector);
+}
+
+void LF_RGBD_2D_Evaluator::getLogProbabilities(
+    const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& current_points,
+    const Eigen::Vector3f& ,
+    const MotionModel& motion_model,
+    const XYZTransform* transforms, const size_t num_transforms,
+    double* log_probs)
+{
+  // Total log measurement probability for each transform.
+  double log_measurement_probs[kTransformBlockSize];
+  (this->*sum_log_probs_)(*current_points, transforms, num_transforms,
+                          log_measurement_probs);
+
+  for (size_t i = 0; i < num_transforms; ++i) {
+    // Compute the motion model probability.
+    const double motion_model_prob = motion_model.computeScore(
+          transforms[i].x, transforms[i].y, transforms[i].z);
+
+    // Combine the motion model score with the (discounted) measurement score
+    // to get the final log probability.
+    log_probs[i] = log(motion_model_prob) +
+        measurement_discount_factor_ * log_measurement_probs[i];
+  }
+}
+
+template <bool UseColor, bool TwoColors, int ColorSpace>
+void LF_RGBD_2D_Evaluator::sumLogProbs(
+    const pcl::PointCloud<pcl::PointXYZRGB>& current_points,
+    const XYZTransform* translations, const size_t num_translations,
+    double* log_measurement_probs) const
+{
+  for (size_t j = 0; j < num_translations; ++j) {
+    log_measurement_probs[j] = 0;
+  }
+
+  // Iterate over every point once, and look up the nearest occupied cell
+  // for each of the translations.
+  const size_t num_points = current_points.size();
+  for (size_t i = 0; i < num_points; ++i) {
+    const pcl::PointXYZRGB& pt = current_points[i];
+
+    const int color1 = UseColor ? getFirstColor<ColorSpace>(pt) : 0;
+    const int color2 = UseColor ? getSecondColor<ColorSpace>(pt) : 0;
+
+    for (size_t j = 0; j < num_translations; ++j) {
+      // Translate the point so we can compute its score.
+      const double x = pt.x + translations[j].x;
+      const double y = pt.y + translations[j].y;
+      const double z = pt.z + translations[j].z;
+
+      // Points outside of the grid use the nearest cell on the border of
+      // the grid; the distance below is still measured from the point.
+      const int x_index = min(xSize_ - 1, max(0, static_cast<int>(
+          floor((x - min_pt_.x) / xy_grid_step_))));
+      const int y_index = min(ySize_ - 1, max(0, static_cast<int>(
+          floor((y - min_pt_.y) / xy_grid_step_))));
+
+      const int nearest = nearest_cells_[x_index * ySize_ + y_index];
+      if (nearest < 0) {
+        // There are no previous points.
+        log_measurement_probs[j] += log(UseColor ?
+            color_likelihood_.getSmoothingFactor() : smoothing_factor_);
+        continue;
+      }
+      const ProjectedCell& cell = projected_cells_[nearest];
+
+      // Compute the distance to the centroid of the cell in the xy-plane,
+      // and vertically to the range of heights in the cell.
+      const double dx = x - cell.x;
+      const double dy = y - cell.y;
+      const double dz =
+          z < cell.min_z ? cell.min_z - z :
+          z > cell.max_z ? z - cell.max_z : 0;
+
+      // Unlike the 3D nearest neighbor search, we can weight the horizontal
+      // and vertical distances separately.
+      const double point_match_prob_spatial_i = exp(
+            (dx * dx + dy * dy) * xy_exp_factor_ + dz * dz * height_exp_factor_);
+
+      // Compute the point match probability, incorporating color if
+      // necessary.
+      double point_prob;
+      if (UseColor) {
+        point_prob = color_likelihood_.computeColorProb<TwoColors>(
+              abs(color1 - cell.color1), abs(color2 - cell.color2),
+              point_match_prob_spatial_i);
+      } else {
+        point_prob = point_match_prob_spatial_i + smoothing_factor_;
+      }
+
+      log_measurement_probs[j] += log(point_prob);
+    }
+  }
+}
+
+} // namespace precision_tracking
@@ -14,6 +14,7 @@
 #include <pcl/common/common.h>
 #include <pcl/common/transforms.h>
 
+#include <boost/cstdint.hpp>
 #include <boost/math/constants/constants.hpp>
 
 #include <precision_tracking/lf_rgbd_6d_evaluator.h>
@@ -32,20 +33,64 @@ namespace {
 
 const double pi = boost::math::constants::pi<double>();
 
+// Orders the indices of transforms by their rotation, so that transforms
+// with the same rotation are adjacent.
+class CompareRotations {
+public:
+  explicit CompareRotations(const vector<Transform6D>& transforms)
+    : transforms_(transforms) {}
+
+  bool operator()(const size_t i, const size_t j) const {
+    const Transform6D& transform_i = transforms_[i];
+    const Transform6D& transform_j = transforms_[j];
+    if (transform_i.roll != transform_j.roll) {
+      return transform_i.roll < transform_j.roll;
+    }
+    if (transform_i.pitch != transform_j.pitch) {
+      return transform_i.pitch < transform_j.pitch;
+    }
+    return transform_i.yaw < transform_j.yaw;
+  }
+
+private:
+  const vector<Transform6D>& transforms_;
+};
+
+// Spread the lower 10 bits of value so that there are 2 zero bits between
+// each of them, for interleaving 3 coordinates into a Morton code.
+boost::uint32_t spreadBits(boost::uint32_t value) {
+  value &= 0x3ff;
+  value = (value | (value << 16)) & 0x030000ff;
+  value = (value | (value << 8)) & 0x0300f00f;
+  value = (value | (value << 4)) & 0x030c30c3;
+  value = (value | (value << 2)) & 0x09249249;
+  return value;
+}
+
+bool hasSameRotation(const Transform6D& transform_i,
+                     const Transform6D& transform_j) {
+  return transform_i.roll == transform_j.roll &&
+      transform_i.pitch == transform_j.pitch &&
+      transform_i.yaw == transform_j.yaw;
+}
+
 } // namespace
 
 
 LF_RGBD_6D_Evaluator::LF_RGBD_6D_Evaluator(const Params *params)
-    : AlignmentEvaluator(params),
+    : AlignmentEvaluatorImpl<LF_RGBD_6D_Evaluator>(params),
       searchTree_(false),  //  //By setting sorted to false,
                                 // the radiusSearch operations will be faster.
       max_nn_(1),
+      ordered_points_(NULL),
       nn_indices_(max_nn_),
       nn_sq_dists_(max_nn_),
+      use_spatial_hash_(params->useSpatialHash),
+      spatial_hash_stale_(true),
       use_color_(params->useColor),
-      color_exp_factor1_(-1.0 / params_->kValueSigma1),
-      color_exp_factor2_(-1.0 / params_->kValueSigma2)
+      color_likelihood_(params, smoothing_factor_)
 {
+  selectKernels();
 }
 
 LF_RGBD_6D_Evaluator::~LF_RGBD_6D_Evaluator()
@@ -64,6 +109,32 @@ void LF_RGBD_6D_Evaluator::setPrevPoints(
 
   // Set search tree epsilon for a speedup.
   searchTree_.setEpsilon(params_->kSearchTreeEpsilon);
+
+  // The spatial hash depends on the measurement model, so it is built in
+  // init.
+  spatial_hash_stale_ = true;
+  // Convert the colors of the previous points into the color space once,
+  // rather than for every transform.
+  if (use_color_) {
+    if (params_->kColorSpace == 0) {
+      convertPrevColors<0>();
+    } else {
+      convertPrevColors<1>();
+    }
+  }
+}
+
+template <int ColorSpace>
+void LF_RGBD_6D_Evaluator::convertPrevColors()
+{
+  const size_t num_points = prev_points_->size();
+  prev_colors1_.resize(num_points);
+  prev_colors2_.resize(num_points);
+  for (size_t i = 0; i < num_points; ++i) {
+    const pcl::PointXYZRGB& prev_pt = (*prev_points_)[i];
+    prev_colors1_[i] = getFirstColor<ColorSpace>(prev_pt);
+    prev_colors2_[i] = getSecondColor<ColorSpace>(prev_pt);
+  }
 }
 
 void LF_RGBD_6D_Evaluator::init(const double xy_sampling_resolution,
@@ -77,18 +148,53 @@ void LF_RGBD_6D_Evaluator::init(const double xy_sampling_resolution,
                            sensor_vertical_resolution,
                            num_current_points);
 
-  // Compute the total particle sampling resolution
-  const double sampling_resolution = sqrt(pow(xy_sampling_resolution_, 2) +
-                                          pow(z_sampling_resolution_, 2));
+  // The current points may have changed.
+  ordered_points_ = NULL;
+
+  if (use_color_) {
+    color_likelihood_.init(xy_sampling_resolution_, z_sampling_resolution_);
+  }
 
-  // Set the probability of seeing a color match, which is based on the
-  // particle sampling resolution - when we are sampling sparsely, we do not
-  // expect the colors to align well.
-  if (params_->kColorThreshFactor == 0) {
-    prob_color_match_ = params_->kProbColorMatch;
+  if (use_spatial_hash_) {
+    // Tie the radius of the spatial hash to the standard deviation of the
+    // measurement model, such that exp(-sigma^2 / 2 sigma^2) =
+    // exp(sigma^2 * xyz_exp_factor_).  The measurement model is annealed as
+    // we sample more finely, so the spatial hash is rebuilt when it changes.
+    const double sigma = sqrt(-0.5 / xyz_exp_factor_);
+    const double radius = params_->kSpatialHashRadius * sigma;
+    if (spatial_hash_stale_ || radius != spatial_hash_.getRadius()) {
+      spatial_hash_.setInputCloud(prev_points_, radius);
+      spatial_hash_stale_ = false;
+    }
+  }
+
+  selectKernels();
+}
+
+template <bool UseSpatialHash>
+struct LF_RGBD_6D_Evaluator::KernelSelector {
+  LF_RGBD_6D_Evaluator* evaluator;
+
+  template <bool UseColor, bool TwoColors, int ColorSpace>
+  void select() {
+    evaluator->sum_log_probs_ = &LF_RGBD_6D_Evaluator::sumLogProbs<
+        UseSpatialHash, UseColor, TwoColors, ColorSpace>;
+    evaluator->point_log_prob_ = &LF_RGBD_6D_Evaluator::get_log_prob<
+        UseSpatialHash, UseColor, TwoColors, ColorSpace>;
+  }
+};
+
+void LF_RGBD_6D_Evaluator::selectKernels()
+{
+  // Choose the kernels once per frame so that the nearest neighbor search
+  // and the color model are fixed at compile time inside of the per-point
+  // loop.
+  if (use_spatial_hash_) {
+    KernelSelector<true> selector = { this };
+    selectColorModel(*params_, use_color_, &selector);
   } else {
-    prob_color_match_ = params_->kProbColorMatch * exp(-pow(sampling_resolution, 2) /
-        (2 * pow(params_->kColorThreshFactor, 2)));
+    KernelSelector<false> selector = { this };
+    selectColorModel(*params_, use_color_, &selector);
   }
 }
 
@@ -110,29 +216,69 @@ void LF_RGBD_6D_Evaluator::score6DTransforms(
        num_current_points);
 
   const size_t num_transforms = transforms.size();
+  num_scored_points_ += num_transforms * num_current_points;
 
-  // Compute scores for all of the transforms using the density grid.
+  // Compute scores for all of the transforms.
   scored_transforms->clear();
   scored_transforms->resize(num_transforms);
 
-  for(size_t i = 0; i < num_transforms; ++i){
-    const Transform6D& transform = transforms[i];
-    const double delta_x = transform.x;
-    const double delta_y = transform.y;
-    const double delta_z = transform.z;
-    const double roll = transform.roll;
-    const double pitch = transform.pitch;
-    const double yaw = transform.yaw;
-    const double volume = transform.volume;
-
-    const double log_prob = getLogProbability(
-          current_points, current_points_centroid, motion_model,
-          delta_x, delta_y, delta_z, roll, pitch, yaw);
-
-    // Save the complete transform with its log probability.
-    const ScoredTransform6D scored_transform(
-                delta_x, delta_y, delta_z, roll, pitch, yaw, log_prob, volume);
-    scored_transforms->set(scored_transform, i);
+  // Group the transforms by rotation.  Transforms with the same rotation
+  // differ only by their translation, so we rotate the current points once
+  // per group and then apply each translation while scoring the points.
+  vector<size_t> order(num_transforms);
+  for (size_t i = 0; i < num_transforms; ++i) {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(), CompareRotations(transforms));
+
+  size_t group_start = 0;
+  while (group_start < num_transforms) {
+    const Transform6D& group_transform = transforms[order[group_start]];
+
+    // Rotate the current points about their centroid.
+    const pcl::PointCloud<pcl::PointXYZRGB>& rotated_points = rotatePoints(
+          *current_points, current_points_centroid, group_transform.roll,
+          group_transform.pitch, group_transform.yaw);
+    computeSpatialOrder(rotated_points);
+
+    // Find the transforms with this rotation.
+    size_t group_end = group_start;
+    while (group_end < num_transforms &&
+           hasSameRotation(transforms[order[group_end]], group_transform)) {
+      ++group_end;
+    }
+
+    // Score the translations in blocks.
+    for (size_t block_start = group_start; block_start < group_end;
+         block_start += kTransformBlockSize) {
+      const size_t num_block_transforms =
+          min(kTransformBlockSize, group_end - block_start);
+
+      XYZTransform translations[kTransformBlockSize];
+      for (size_t i = 0; i < num_block_transforms; ++i) {
+        const Transform6D& transform = transforms[order[block_start + i]];
+        translations[i] = XYZTransform(transform.x, transform.y, transform.z,
+                                       transform.volume);
+      }
+
+      double log_probs[kTransformBlockSize];
+      getTranslatedLogProbabilities(rotated_points, motion_model,
+                                    translations, num_block_transforms,
+                                    log_probs);
+
+      for (size_t i = 0; i < num_block_transforms; ++i) {
+        const size_t index = order[block_start + i];
+        const Transform6D& transform = transforms[index];
+
+        // Save the complete transform with its log probability.
+        const ScoredTransform6D scored_transform(
+              transform.x, transform.y, transform.z, transform.roll,
+              transform.pitch, transform.yaw, log_probs[i], transform.volume);
+        scored_transforms->set(scored_transform, index);
+      }
+    }
+
+    group_start = group_end;
   }
 }
 
@@ -202,42 +348,125 @@ double LF_RGBD_6D_Evaluator::getLogProbability(
     const double pitch,
     const double yaw)
 {
-  // Make a new cloud to store the transformed cloud for the current points.
-  pcl::PointCloud<pcl::PointXYZRGB>::Ptr transformed_current_points(
-      new pcl::PointCloud<pcl::PointXYZRGB>);
+  // Rotate the current points, then score them with the translation.
+  const pcl::PointCloud<pcl::PointXYZRGB>& rotated_points = rotatePoints(
+        *current_points, current_points_centroid, roll, pitch, yaw);
+  computeSpatialOrder(rotated_points);
+
+  const XYZTransform translation(delta_x, delta_y, delta_z, 0);
+  double log_prob;
+  getTranslatedLogProbabilities(rotated_points, motion_model, &translation, 1,
+                                &log_prob);
+
+  return log_prob;
+}
+
+void LF_RGBD_6D_Evaluator::getLogProbabilities(
+    const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& current_points,
+    const Eigen::Vector3f& ,
+    const MotionModel& motion_model,
+    const XYZTransform* transforms, const size_t num_transforms,
+    double* log_probs)
+{
+  // These transforms have no rotation, so we can score the current points
+  // directly.  They are scored in several blocks, so only sort them once.
+  if (ordered_points_ != current_points.get()) {
+    computeSpatialOrder(*current_points);
+  }
+  getTranslatedLogProbabilities(*current_points, motion_model, transforms,
+                                num_transforms, log_probs);
+}
+
+const pcl::PointCloud<pcl::PointXYZRGB>& LF_RGBD_6D_Evaluator::rotatePoints(
+    const pcl::PointCloud<pcl::PointXYZRGB>& current_points,
+    const Eigen::Vector3f& current_points_centroid,
+    const double roll, const double pitch, const double yaw)
+{
+  // Without a rotation, we do not need to copy the points.
+  if (roll == 0 && pitch == 0 && yaw == 0) {
+    return current_points;
+  }
 
-  // Make the desired transform.
+  // Make the rotation about the centroid, without a translation.
   Eigen::Affine3f transform;
-  makeEigenTransform(current_points_centroid, delta_x, delta_y, delta_z, roll,
-                     pitch, yaw, &transform);
+  makeEigenTransform(current_points_centroid, 0, 0, 0, roll, pitch, yaw,
+                     &transform);
 
-  // Transform the cloud.
-  pcl::transformPointCloud(*current_points, *transformed_current_points,
-                           transform);
+  // Transform the cloud, reusing the memory from the previous rotation.
+  pcl::transformPointCloud(current_points, rotated_points_, transform);
 
-  // Total log measurement probability.
-  double log_measurement_prob = 0;
+  return rotated_points_;
+}
 
-  // Iterate over every point, and look up its score in the density grid.
-  const size_t num_points = current_points->size();
-  for (size_t i = 0; i < num_points; ++i) {
-    // Extract the point so we can compute its score.
-    const pcl::PointXYZRGB& current_pt = (*transformed_current_points)[i];
+void LF_RGBD_6D_Evaluator::getTranslatedLogProbabilities(
+    const pcl::PointCloud<pcl::PointXYZRGB>& rotated_points,
+    const MotionModel& motion_model,
+    const XYZTransform* translations, const size_t num_translations,
+    double* log_probs)
+{
+  // Only the first num_translations entries are used, but initialize all of
+  // them so that the kernels never read an uninitialized vector.
+  Eigen::Vector3f translation_vectors[kTransformBlockSize];
+  for (size_t i = 0; i < kTransformBlockSize; ++i) {
+    translation_vectors[i].setZero();
+  }
+  for (size_t i = 0; i < num_translations; ++i) {
+    translation_vectors[i] = Eigen::Vector3f(
+          translations[i].x, translations[i].y, translations[i].z);
+  }
+
+  // Total log measurement probability for each translation.
+  double log_measurement_probs[kTransformBlockSize];
+  (this->*sum_log_probs_)(rotated_points, translation_vectors,
+                          num_translations, log_measurement_probs);
+
+  for (size_t i = 0; i < num_translations; ++i) {
+    // Compute the motion model probability.
+    const double motion_model_prob = motion_model.computeScore(
+          translations[i].x, translations[i].y, translations[i].z);
+
+    // Combine the motion model score with the (discounted) measurement score
+    // to get the final log probability.
+    log_probs[i] = log(motion_model_prob) +
+        measurement_discount_factor_ * log_measurement_probs[i];
+  }
+}
 
-    // Compute the probability.
-    log_measurement_prob += get_log_prob(current_pt);
+void LF_RGBD_6D_Evaluator::computeSpatialOrder(
+    const pcl::PointCloud<pcl::PointXYZRGB>& points)
+{
+  ordered_points_ = &points;
+
+  const size_t num_points = points.size();
+  point_order_.resize(num_points);
+  if (num_points == 0) {
+    return;
   }
 
-  // Compute the motion model probability.
-  const double motion_model_prob = motion_model.computeScore(delta_x, delta_y,
-                                                             delta_z);
+  // Quantize the points to 10 bits per axis within their bounding box.
+  pcl::PointXYZRGB min_pt, max_pt;
+  pcl::getMinMax3D(points, min_pt, max_pt);
+  const float max_extent = std::max(max_pt.x - min_pt.x, std::max(
+      max_pt.y - min_pt.y, max_pt.z - min_pt.z));
+  const float scale = max_extent > 0 ? 1023 / max_extent : 0;
 
-  // Combine the motion model score with the (discounted) measurement score to
-  // get the final log probability.
-  const double log_prob = log(motion_model_prob) +
-      measurement_discount_factor_ * log_measurement_prob;
+  // Sort the points by their Morton code.
+  spatial_codes_.resize(num_points);
+  for (size_t i = 0; i < num_points; ++i) {
+    const pcl::PointXYZRGB& pt = points[i];
+    const boost::uint32_t code =
+        spreadBits(static_cast<boost::uint32_t>((pt.x - min_pt.x) * scale)) |
+        (spreadBits(static_cast<boost::uint32_t>((pt.y - min_pt.y) * scale))
+         << 1) |
+        (spreadBits(static_cast<boost::uint32_t>((pt.z - min_pt.z) * scale))
+         << 2);
+    spatial_codes_[i] = std::make_pair(code, i);
+  }
+  std::sort(spatial_codes_.begin(), spatial_codes_.end());
 
-  return log_prob;
+  for (size_t i = 0; i < num_points; ++i) {
+    point_order_[i] = spatial_codes_[i].second;
+  }
 }
 
 double LF_RGBD_6D_Evaluator::getPointProbability(
@@ -270,29 +499,94 @@ double LF_RGBD_6D_Evaluator::getPointProbability(
        sensor_horizontal_resolution, sensor_vertical_resolution,
        num_current_points);
 
-  get_log_prob(point);
+  return (this->*point_log_prob_)(point);
 }
 
+template <bool UseSpatialHash, bool UseColor, bool TwoColors, int ColorSpace>
+void LF_RGBD_6D_Evaluator::sumLogProbs(
+    const pcl::PointCloud<pcl::PointXYZRGB>& rotated_points,
+    const Eigen::Vector3f* translations, const size_t num_translations,
+    double* log_measurement_probs)
+{
+  const size_t num_points = rotated_points.size();
+  point_log_probs_.resize(num_translations * num_points);
+
+  // Visit the points in spatial order (computed by computeSpatialOrder),
+  // and look up each point under all of the translations in turn.
+  // Consecutive nearest neighbor queries are then close together, so they
+  // mostly visit the same parts of the search tree (or the same cells of the
+  // spatial hash), which are still in the cache.
+  for (size_t k = 0; k < num_points; ++k) {
+    const size_t i = point_order_[k];
+    const pcl::PointXYZRGB& rotated_pt = rotated_points[i];
+
+    for (size_t j = 0; j < num_translations; ++j) {
+      // Translate the point so we can compute its score.
+      pcl::PointXYZRGB current_pt = rotated_pt;
+      current_pt.x += translations[j][0];
+      current_pt.y += translations[j][1];
+      current_pt.z += translations[j][2];
+
+      // Compute the probability.
+      point_log_probs_[j * num_points + i] =
+          get_log_prob<UseSpatialHash, UseColor, TwoColors, ColorSpace>(
+            current_pt);
+    }
+  }
+
+  // Sum the log probabilities in the original order of the points, so that
+  // the sums do not depend on the order of the queries.
+  for (size_t j = 0; j < num_translations; ++j) {
+    const double* point_log_probs = &point_log_probs_[j * num_points];
+    double log_measurement_prob = 0;
+    for (size_t i = 0; i < num_points; ++i) {
+      log_measurement_prob += point_log_probs[i];
+    }
+    log_measurement_probs[j] = log_measurement_prob;
+  }
+}
+
+template <bool UseSpatialHash, bool UseColor, bool TwoColors, int ColorSpace>
 double LF_RGBD_6D_Evaluator::get_log_prob(const pcl::PointXYZRGB& current_pt)
 {
   // Find the nearest neighbor.
-  searchTree_.nearestKSearch(current_pt, max_nn_, nn_indices_, nn_sq_dists_);
-  const pcl::PointXYZRGB& prev_pt = (*prev_points_)[nn_indices_[0]];
+  int nn_index;
+  float nn_sq_dist;
+  bool found_nn;
+  if (UseSpatialHash) {
+    found_nn = spatial_hash_.nearestWithinRadius(current_pt, &nn_index,
+                                                 &nn_sq_dist);
+  } else {
+    searchTree_.nearestKSearch(current_pt, max_nn_, nn_indices_,
+                               nn_sq_dists_);
+    nn_index = nn_indices_[0];
+    nn_sq_dist = nn_sq_dists_[0];
+    found_nn = true;
+  }
 
   // Compute the log probability of this neighbor match.
   // The NN search is isotropic, but our measurement model is not!
   // To acccount for this, we weight the NN search only by the isotropic
   // xyz_exp_factor_.
-  const double log_point_match_prob_i = nn_sq_dists_[0] * xyz_exp_factor_;
+  const double log_point_match_prob_i = nn_sq_dist * xyz_exp_factor_;
 
   // Compute the probability of this neighbor match.
-  const double point_match_prob_spatial_i = exp(log_point_match_prob_i);
+  const double point_match_prob_spatial_i =
+      found_nn ? exp(log_point_match_prob_i) : 0;
 
   // Compute the point match probability, incorporating color if necessary.
   double point_prob;
-  if (use_color_) {
-    point_prob = computeColorProb(prev_pt, current_pt,
-                                  point_match_prob_spatial_i);
+  if (UseColor && !found_nn) {
+    // If there is no neighbor within the radius of the spatial hash, the
+    // spatial match probability is (nearly) 0, so only the smoothing term
+    // remains and the color of the neighbor does not matter.
+    point_prob = color_likelihood_.getSmoothingFactor();
+  } else if (UseColor) {
+    // The colors of the previous points were converted in setPrevPoints.
+    point_prob = color_likelihood_.computeColorProb<TwoColors>(
+          abs(getFirstColor<ColorSpace>(current_pt) - prev_colors1_[nn_index]),
+          abs(getSecondColor<ColorSpace>(current_pt) - prev_colors2_[nn_index]),
+          point_match_prob_spatial_i);
   } else {
     point_prob = point_match_prob_spatial_i + smoothing_factor_;
   }
@@ -303,62 +597,4 @@ double LF_RGBD_6D_Evaluator::get_log_prob(const pcl::PointXYZRGB& current_pt)
   return log_point_prob;
 }
 
-double LF_RGBD_6D_Evaluator::computeColorProb(const pcl::PointXYZRGB& prev_pt,
-    const pcl::PointXYZRGB& pt, const double point_match_prob_spatial_i) const
-{
-  // Because we are using color, we have to modify the smoothing factor.
-  const double factor1 = smoothing_factor_ / (smoothing_factor_ + 1);
-
-  double smoothing_factor;
-  if (use_color_ && !params_->kTwoColors) {
-    smoothing_factor = factor1 / 255;
-  } else if (use_color_ && params_->kTwoColors) {
-    smoothing_factor = factor1 / pow(255, 2);
-  } else {
-    smoothing_factor = smoothing_factor_;
-  }
-  smoothing_factor *= (1 - point_match_prob_spatial_i);
-
-  // Find the colors of the 2 points.
-  int color1 = 0, color2 = 0, color3 = 0, color4 = 0;
-  if (params_->kColorSpace == 0) {
-    // Blue and Green.
-    color1 = pt.b;
-    color2 = prev_pt.b;
-
-    color3 = pt.g;
-    color4 = prev_pt.g;
-  } else if (params_->kColorSpace == 1) {
-    // Mean of RGB.
-    color1 = (pt.r + pt.g + pt.b) / 3;
-    color2 = (prev_pt.r + prev_pt.g + prev_pt.b) / 3;
-  } else {
-    printf("Unknown color space: %d\n", params_->kColorSpace);
-    exit(1);
-  }
-
-  // Compute the probability of the match, using the spatial and color distance.
-  const double color_distance1 = fabs(color1 - color2);
-  double point_match_prob;
-  if (params_->kTwoColors) {
-    const double color_distance2 = fabs(color3 - color4);
-
-    point_match_prob =
-        point_match_prob_spatial_i *
-        ((1-prob_color_match_) * 1.0 / pow(255, 2) +
-         prob_color_match_ * (
-           -0.5 * color_exp_factor1_ * exp(color_distance1 * color_exp_factor1_)) *
-           -0.5 * color_exp_factor2_ * exp(color_distance2 * color_exp_factor2_));
-  } else {
-    point_match_prob =
-        point_match_prob_spatial_i *
-        ((1-prob_color_match_) * 1.0 / 255 +
-         prob_color_match_ *
-         -1 * color_exp_factor1_ * exp(color_distance1 * color_exp_factor1_));
-  }
-  const double point_prob = point_match_prob + smoothing_factor;
-
-  return point_prob;
-}
-
 } // namespace precision_tracking
@@ -0,0 +1,50 @@
+/*
+ * memory_usage.cpp
+ *
+ */
+
+#include <cstdio>
+#include <cstring>
+
+#include <precision_tracking/memory_usage.h>
+
+namespace precision_tracking {
+
+bool getResidentSetSize(size_t* rss, size_t* peak_rss)
+{
+  FILE* fid = fopen("/proc/self/status", "r");
+  if (fid == NULL) {
+    return false;
+  }
+
+  // The sizes are given in kB, on lines such as "VmRSS:     1234 kB".
+  bool found_rss = false;
+  bool found_peak_rss = false;
+  char line[256];
+  while (fgets(line, sizeof(line), fid) != NULL) {
+    unsigned long size_kb;
+    if (sscanf(line, "VmRSS: %lu", &size_kb) == 1) {
+      *rss = size_kb * 1024;
+      found_rss = true;
+    } else if (sscanf(line, "VmHWM: %lu", &size_kb) == 1) {
+      *peak_rss = size_kb * 1024;
+      found_peak_rss = true;
+    }
+  }
+  fclose(fid);
+
+  return found_rss && found_peak_rss;
+}
+
+bool resetPeakResidentSetSize()
+{
+  // Writing 5 to clear_refs resets the peak RSS (see man proc).
+  FILE* fid = fopen("/proc/self/clear_refs", "w");
+  if (fid == NULL) {
+    return false;
+  }
+  const bool success = fputs("5", fid) >= 0;
+  return (fclose(fid) == 0) && success;
+}
+
+} // namespace precision_tracking
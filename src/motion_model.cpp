@@ -7,9 +7,11 @@
  */
 
 
+#include <boost/cstdint.hpp>
 #include <boost/math/constants/constants.hpp>
 
 #include <precision_tracking/motion_model.h>
+#include <precision_tracking/binary_io.h>
 
 using std::max;
 
@@ -267,4 +269,41 @@ void MotionModel::propagate(const double& recorded_time_diff)
   pdf_constant_ = 1 / (pow(2 * pi, k/2) * pow(determinant, 0.5));
 }
 
+void MotionModel::serialize(std::ostream& out) const
+{
+  writeBinary(mean_velocity_, out);
+  writeBinary(covariance_velocity_, out);
+  writeBinary(mean_delta_position_, out);
+  writeBinary(covariance_delta_position_, out);
+  writeBinary(covariance_delta_position_inv_, out);
+  writeBinary(pdf_constant_, out);
+  writeBinary(min_score_, out);
+  writeBinary(static_cast<boost::int8_t>(valid_), out);
+  writeBinary(static_cast<boost::int8_t>(flip_), out);
+}
+
+bool MotionModel::deserialize(std::istream& in)
+{
+  // Read into a copy, so that we are unchanged if the stream ends.
+  MotionModel motion_model(*this);
+  boost::int8_t valid;
+  boost::int8_t flip;
+  if (!readBinary(in, &motion_model.mean_velocity_) ||
+      !readBinary(in, &motion_model.covariance_velocity_) ||
+      !readBinary(in, &motion_model.mean_delta_position_) ||
+      !readBinary(in, &motion_model.covariance_delta_position_) ||
+      !readBinary(in, &motion_model.covariance_delta_position_inv_) ||
+      !readBinary(in, &motion_model.pdf_constant_) ||
+      !readBinary(in, &motion_model.min_score_) ||
+      !readBinary(in, &valid) ||
+      !readBinary(in, &flip)) {
+    return false;
+  }
+  motion_model.valid_ = valid != 0;
+  motion_model.flip_ = flip;
+
+  *this = motion_model;
+  return true;
+}
+
 } // namespace precision_tracking
@@ -7,14 +7,18 @@
  */
 
 
+#include <limits>
+
 #include <pcl/common/common.h>
 #include <pcl/common/centroid.h>
 
 #include <precision_tracking/down_sampler.h>
 #include <precision_tracking/density_grid_2d_evaluator.h>
 #include <precision_tracking/density_grid_3d_evaluator.h>
+#include <precision_tracking/lf_rgbd_2d_evaluator.h>
 #include <precision_tracking/lf_rgbd_6d_evaluator.h>
 #include <precision_tracking/precision_tracker.h>
+#include <precision_tracking/range_image_evaluator.h>
 
 
 namespace precision_tracking {
@@ -23,6 +27,7 @@ namespace {
 
 using std::pair;
 using std::max;
+using std::min;
 
 } // namespace
 
@@ -31,8 +36,13 @@ PrecisionTracker::PrecisionTracker(const Params *params)
     adh_tracker3d_(params_),
     down_sampler_(params_->stochastic_downsample, params_)
 {
-  if (params_->useColor) {
+  if (params_->useColor && !params_->use3D &&
+      params_->useProjectedColorField) {
+    alignment_evaluator_.reset(new LF_RGBD_2D_Evaluator(params_));
+  } else if (params_->useColor) {
     alignment_evaluator_.reset(new LF_RGBD_6D_Evaluator(params_));
+  } else if (params_->useRangeImage) {
+    alignment_evaluator_.reset(new RangeImageEvaluator(params_));
   } else if (params_->use3D){
     alignment_evaluator_.reset(new DensityGrid3dEvaluator(params_));
   } else {
@@ -54,12 +64,6 @@ void PrecisionTracker::track(
     const MotionModel& motion_model,
     ScoredTransforms<ScoredTransformXYZ>* scored_transforms)
 {
-  // Estimate the search range for alignment.
-  std::pair <double, double> xRange;
-  std::pair <double, double> yRange;
-  std::pair <double, double> zRange;
-  estimateRange(current_points, prev_points, &xRange, &yRange, &zRange);
-
   // Compute the centroid.
   Eigen::Vector4f current_points_centroid_4d;
   pcl::compute3DCentroid (*current_points, current_points_centroid_4d);
@@ -90,13 +94,36 @@ void PrecisionTracker::track(
   const double sensor_vertical_res =
       sensor_vertical_resolution_actual / down_sample_factor_prev;
 
+  // Compute the displacement of the centroid.
+  const Eigen::Matrix4f centroid_diff =
+      estimateAlignmentCentroidDiff(current_points, prev_points);
+
+  // Build the structures for the previous points once, for both the static
+  // fast path and the full search.
+  alignment_evaluator_->setPrevPoints(previous_model_downsampled);
+
+  // Static objects can be aligned with a small local search.
+  if (params_->useStaticFastPath &&
+      trackStatic(down_sampled_current, current_points_centroid,
+                  centroid_diff, sensor_horizontal_res, sensor_vertical_res,
+                  motion_model, scored_transforms)) {
+    return;
+  }
+
+  // Estimate the search range for alignment.
+  std::pair <double, double> xRange;
+  std::pair <double, double> yRange;
+  std::pair <double, double> zRange;
+  double lattice_heading;
+  estimateRange(current_points, prev_points, centroid_diff, motion_model,
+                &xRange, &yRange, &zRange, &lattice_heading);
+
   // Align the current points to the previous points using the annealed
   // dynamic histogram tracker.
-  adh_tracker3d_.track(
+  adh_tracker3d_.trackPrevPointsSet(
         params_->kInitialXYSamplingResolution, params_->kInitialZSamplingResolution,
-        xRange, yRange, zRange,
-        down_sampled_current, previous_model_downsampled,
-        current_points_centroid, motion_model,
+        xRange, yRange, zRange, lattice_heading,
+        down_sampled_current, current_points_centroid, motion_model,
         sensor_horizontal_res, sensor_vertical_res,
         alignment_evaluator_, scored_transforms);
 }
@@ -104,53 +131,212 @@ void PrecisionTracker::track(
 void PrecisionTracker::estimateRange(
     const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& current_points,
     const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& prev_points,
+    const Eigen::Matrix4f& centroid_diff,
+    const MotionModel& motion_model,
     std::pair <double, double>* xRange,
     std::pair <double, double>* yRange,
-    std::pair <double, double>* zRange) const
+    std::pair <double, double>* zRange,
+    double* lattice_heading) const
 {
-  // Compute the displacement of the centroid.
-  Eigen::Matrix4f centroidDiffTransform =
-      estimateAlignmentCentroidDiff(current_points, prev_points);
+  // We center our search window on an alignment of the centroids
+  // of the points from the previous and current frames.
+  const double x_init = centroid_diff(0,3);
+  const double y_init = centroid_diff(1,3);
 
-  // Find the min and max of the previous points.
-  pcl::PointXYZRGB max_pt_prev;
-  pcl::PointXYZRGB min_pt_prev;
-  pcl::getMinMax3D(*prev_points, min_pt_prev, max_pt_prev);
+  // Assume that the vertical motion is minimal.
+  const double z_init = 0;
 
-  // Compute the size of the previous points.
-  const double x_diff_prev = max_pt_prev.x - min_pt_prev.x;
-  const double y_diff_prev = max_pt_prev.y - min_pt_prev.y;
+  *zRange = std::make_pair(-params_->maxZ + z_init, params_->maxZ + z_init);
 
-  // Find the min and max of the previous points.
-  pcl::PointXYZRGB max_pt_curr;
-  pcl::PointXYZRGB min_pt_curr;
-  pcl::getMinMax3D(*current_points, min_pt_curr, max_pt_curr);
+  if (params_->kSearchWindowOrientation == 0) {
+    // Find the min and max of the previous points.
+    pcl::PointXYZRGB max_pt_prev;
+    pcl::PointXYZRGB min_pt_prev;
+    pcl::getMinMax3D(*prev_points, min_pt_prev, max_pt_prev);
+
+    // Compute the size of the previous points.
+    const double x_diff_prev = max_pt_prev.x - min_pt_prev.x;
+    const double y_diff_prev = max_pt_prev.y - min_pt_prev.y;
+
+    // Find the min and max of the previous points.
+    pcl::PointXYZRGB max_pt_curr;
+    pcl::PointXYZRGB min_pt_curr;
+    pcl::getMinMax3D(*current_points, min_pt_curr, max_pt_curr);
+
+    // Compute the size of the current points.
+    const double x_diff_curr = max_pt_curr.x - min_pt_curr.x;
+    const double y_diff_curr = max_pt_curr.y - min_pt_curr.y;
+
+    // Compute the maximum size of the object.
+    const double x_diff = max(x_diff_prev, x_diff_curr);
+    const double y_diff = max(y_diff_prev, y_diff_curr);
+    const double size = sqrt(pow(x_diff, 2) + pow(y_diff, 2));
+
+    // The object can have moved a maximum of size / 2 from the displacement
+    // of the centroid.
+    const double maxX = ceil(size / 2);
+    const double maxY = ceil(size / 2);
+
+    *xRange = std::make_pair(-maxX + x_init, maxX + x_init);
+    *yRange = std::make_pair(-maxY + y_init, maxY + y_init);
+    *lattice_heading = 0;
+  } else {
+    const double heading = estimateHeading(prev_points, motion_model);
+    const double cos_heading = cos(heading);
+    const double sin_heading = sin(heading);
+
+    // Compute the maximum size of the object along (u) and across (v) the
+    // heading, over the previous and the current points.
+    const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr clouds[2] =
+        { prev_points, current_points };
+    double u_diff = 0;
+    double v_diff = 0;
+    for (int c = 0; c < 2; ++c) {
+      const pcl::PointCloud<pcl::PointXYZRGB>& cloud = *clouds[c];
+      double min_u = std::numeric_limits<double>::max();
+      double max_u = -std::numeric_limits<double>::max();
+      double min_v = std::numeric_limits<double>::max();
+      double max_v = -std::numeric_limits<double>::max();
+
+      const size_t num_points = cloud.size();
+      for (size_t i = 0; i < num_points; ++i) {
+        const pcl::PointXYZRGB& pt = cloud[i];
+        const double u = pt.x * cos_heading + pt.y * sin_heading;
+        const double v = -pt.x * sin_heading + pt.y * cos_heading;
+        min_u = min(min_u, u);
+        max_u = max(max_u, u);
+        min_v = min(min_v, v);
+        max_v = max(max_v, v);
+      }
+
+      u_diff = max(u_diff, max_u - min_u);
+      v_diff = max(v_diff, max_v - min_v);
+    }
+
+    // The centroid can be off by at most half of the object size in each
+    // direction, so we only search that far along and across the heading.
+    const double maxU = ceil(params_->kAlongTrackSearchFactor * u_diff / 2);
+    const double maxV = ceil(params_->kCrossTrackSearchFactor * v_diff / 2);
+
+    // Express the centroid alignment in the lattice frame.
+    const double u_init = x_init * cos_heading + y_init * sin_heading;
+    const double v_init = -x_init * sin_heading + y_init * cos_heading;
+
+    *xRange = std::make_pair(-maxU + u_init, maxU + u_init);
+    *yRange = std::make_pair(-maxV + v_init, maxV + v_init);
+    *lattice_heading = heading;
+  }
+}
 
-  // Compute the size of the current points.
-  const double x_diff_curr = max_pt_curr.x - min_pt_curr.x;
-  const double y_diff_curr = max_pt_curr.y - min_pt_curr.y;
+bool PrecisionTracker::trackStatic(
+    const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& down_sampled_current,
+    const Eigen::Vector3f& current_points_centroid,
+    const Eigen::Matrix4f& centroid_diff,
+    const double sensor_horizontal_res,
+    const double sensor_vertical_res,
+    const MotionModel& motion_model,
+    ScoredTransforms<ScoredTransformXYZ>* scored_transforms)
+{
+  // The motion model must predict a small displacement with
+  // low uncertainty.
+  if (!motion_model.valid()) {
+    return false;
+  }
+  const Eigen::Vector3d predicted_displacement =
+      motion_model.get_mean_delta_position();
+  if (predicted_displacement.head(2).norm() > params_->kStaticMaxDisplacement) {
+    return false;
+  }
+  const Eigen::Matrix3d predicted_covariance =
+      motion_model.get_covariance_delta_position();
+  const double max_variance_xy =
+      max(predicted_covariance(0,0), predicted_covariance(1,1));
+  if (max_variance_xy > pow(params_->kStaticMaxMotionStd, 2)) {
+    return false;
+  }
 
-  // Compute the maximum size of the object.
-  const double x_diff = max(x_diff_prev, x_diff_curr);
-  const double y_diff = max(y_diff_prev, y_diff_curr);
-  const double size = sqrt(pow(x_diff, 2) + pow(y_diff, 2));
+  // The centroid must not have moved much.
+  if (centroid_diff.block<2,1>(0,3).norm() > params_->kStaticMaxDisplacement) {
+    return false;
+  }
 
-  // The object can have moved a maximum of size / 2 from the displacement
-  // of the centroid.
-  const double maxX = ceil(size / 2);
-  const double maxY = ceil(size / 2);
+  // The zero transform must score at least as well as its neighbors.
+  const double probe_offset = params_->kStaticProbeOffset;
+  std::vector<XYZTransform> probe_transforms;
+  const double probe_volume = pow(probe_offset, 2);
+  probe_transforms.push_back(XYZTransform(0, 0, 0, probe_volume));
+  probe_transforms.push_back(XYZTransform(probe_offset, 0, 0, probe_volume));
+  probe_transforms.push_back(XYZTransform(-probe_offset, 0, 0, probe_volume));
+  probe_transforms.push_back(XYZTransform(0, probe_offset, 0, probe_volume));
+  probe_transforms.push_back(XYZTransform(0, -probe_offset, 0, probe_volume));
+
+  ScoredTransforms<ScoredTransformXYZ> probe_scores;
+  alignment_evaluator_->score3DTransforms(
+        down_sampled_current, current_points_centroid,
+        probe_offset, 0, sensor_horizontal_res, sensor_vertical_res,
+        probe_transforms, motion_model, &probe_scores);
+
+  const std::vector<ScoredTransformXYZ>& probes =
+      probe_scores.getScoredTransforms();
+  const double zero_log_prob = probes[0].getUnnormalizedLogProb();
+  for (size_t i = 1; i < probes.size(); ++i) {
+    if (probes[i].getUnnormalizedLogProb() > zero_log_prob) {
+      return false;
+    }
+  }
 
-  // We center our search window on an alignment of the centroids
-  // of the points from the previous and current frames.
-  const double x_init = centroidDiffTransform(0,3);
-  const double y_init = centroidDiffTransform(1,3);
+  // Search in a small window around the zero transform.
+  const double radius = params_->kStaticSearchRadius;
+  const std::pair <double, double> xRange = std::make_pair(-radius, radius);
+  const std::pair <double, double> yRange = std::make_pair(-radius, radius);
+  const std::pair <double, double> zRange =
+      std::make_pair(-params_->maxZ, params_->maxZ);
+  const double lattice_heading = 0;
+
+  ScoredTransforms<ScoredTransformXYZ> static_scored_transforms;
+  adh_tracker3d_.trackPrevPointsSet(
+        params_->kStaticXYSamplingResolution,
+        params_->kInitialZSamplingResolution,
+        xRange, yRange, zRange, lattice_heading,
+        down_sampled_current, current_points_centroid, motion_model,
+        sensor_horizontal_res, sensor_vertical_res,
+        alignment_evaluator_, &static_scored_transforms);
+
+  // If the best alignment is on the border of the window, the object
+  // has probably moved further than the window - use the full search.
+  ScoredTransformXYZ best_transform;
+  double best_probability;
+  static_scored_transforms.findBest(&best_transform, &best_probability);
+  const double border =
+      radius - params_->kStaticXYSamplingResolution / 2;
+  if (fabs(best_transform.getX()) > border ||
+      fabs(best_transform.getY()) > border) {
+    return false;
+  }
 
-  // Assume that the vertical motion is minimal.
-  const double z_init = 0;
+  scored_transforms->appendScoredTransforms(static_scored_transforms);
+  return true;
+}
 
-  *xRange = std::make_pair(-maxX + x_init, maxX + x_init);
-  *yRange = std::make_pair(-maxY + y_init, maxY + y_init);
-  *zRange = std::make_pair(-params_->maxZ + z_init, params_->maxZ + z_init);
+double PrecisionTracker::estimateHeading(
+    const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& prev_points,
+    const MotionModel& motion_model) const
+{
+  // Use the direction of motion if the object is moving fast enough for
+  // the direction to be reliable.
+  if (params_->kSearchWindowOrientation == 2 && motion_model.valid()) {
+    const Eigen::Vector3f velocity = motion_model.get_mean_velocity();
+    if (velocity.head(2).norm() >= params_->kMinOrientationSpeed) {
+      return atan2(velocity(1), velocity(0));
+    }
+  }
+
+  // Otherwise use the major principal axis of the points in the xy-plane.
+  Eigen::Matrix3f covariance;
+  Eigen::Vector4f centroid;
+  pcl::computeMeanAndCovarianceMatrix(*prev_points, covariance, centroid);
+
+  return 0.5 * atan2(2 * covariance(0,1), covariance(0,0) - covariance(1,1));
 }
 
 Eigen::Matrix4f PrecisionTracker::estimateAlignmentCentroidDiff(
@@ -0,0 +1,292 @@
+/*
+ * range_image_evaluator.cpp
+ *
+ */
+
+
+#include <cmath>
+#include <algorithm>
+#include <vector>
+
+#include <pcl/common/centroid.h>
+
+#include <precision_tracking/range_image_evaluator.h>
+
+
+using std::max;
+using std::min;
+using std::vector;
+
+namespace precision_tracking {
+
+namespace {
+
+// Range of the pixels which have no range.
+const float kEmptyPixel = -1;
+
+// Points closer to the sensor than this depth (or behind it) are not
+// projected into the image.
+const double kMinDepth = 0.1;
+
+// Number of entries of the table of residual log probabilities per standard
+// deviation of the measurement model.
+const double kResidualStepsPerSigma = 10;
+
+} // namespace
+
+
+RangeImageEvaluator::RangeImageEvaluator(const Params *params)
+  : AlignmentEvaluatorImpl<RangeImageEvaluator>(params),
+    center_cos_(1),
+    center_sin_(0),
+    center_distance_(0),
+    num_us_(0),
+    num_vs_(0),
+    u_step_(0),
+    v_step_(0),
+    inv_u_step_(0),
+    inv_v_step_(0),
+    min_u_(0),
+    min_v_(0),
+    residual_scale_(0),
+    no_match_log_prob_(log(smoothing_factor_))
+{
+}
+
+RangeImageEvaluator::~RangeImageEvaluator()
+{
+}
+
+void RangeImageEvaluator::setPrevPoints(
+    const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr prev_points)
+{
+  AlignmentEvaluator::setPrevPoints(prev_points);
+
+  // Point the image at the centroid of the previous points.
+  Eigen::Vector4f centroid;
+  pcl::compute3DCentroid(*prev_points_, centroid);
+  const double center_azimuth = atan2(centroid(1), centroid(0));
+  center_cos_ = cos(center_azimuth);
+  center_sin_ = sin(center_azimuth);
+  center_distance_ = sqrt(pow(centroid(0), 2) + pow(centroid(1), 2));
+
+  // Project the previous points once, since the image is recomputed for
+  // each sampling resolution.
+  const size_t num_points = prev_points_->size();
+  prev_us_.clear();
+  prev_vs_.clear();
+  prev_ranges_.clear();
+  prev_us_.reserve(num_points);
+  prev_vs_.reserve(num_points);
+  prev_ranges_.reserve(num_points);
+  for (size_t i = 0; i < num_points; ++i) {
+    const pcl::PointXYZRGB& pt = (*prev_points_)[i];
+    const double depth = pt.x * center_cos_ + pt.y * center_sin_;
+    if (depth < kMinDepth) {
+      continue;
+    }
+    const double lateral = -pt.x * center_sin_ + pt.y * center_cos_;
+    prev_us_.push_back(lateral / depth);
+    prev_vs_.push_back(pt.z / depth);
+    prev_ranges_.push_back(sqrt(pt.x * pt.x + pt.y * pt.y + pt.z * pt.z));
+  }
+}
+
+void RangeImageEvaluator::init(const double xy_sampling_resolution,
+          const double z_sampling_resolution,
+          const double sensor_horizontal_resolution,
+          const double sensor_vertical_resolution,
+          const size_t num_current_points)
+{
+  AlignmentEvaluator::init(xy_sampling_resolution, z_sampling_resolution,
+                           sensor_horizontal_resolution,
+                           sensor_vertical_resolution, num_current_points);
+
+  // The sensor resolution (in meters at the distance of the object) is the
+  // angular resolution of the sensor, reduced by the down-sampling of the
+  // previous points.  We use pixels of this size, unless we are sampling the
+  // transforms more coarsely, in which case a coarser image avoids leaving
+  // holes between the previous points.
+  const double distance = max(center_distance_, kMinDepth);
+  u_step_ = max(sensor_horizontal_resolution, xy_sampling_resolution) /
+      distance;
+  v_step_ = max(sensor_vertical_resolution, z_sampling_resolution) /
+      distance;
+
+  computeRangeImage();
+  computeResidualLogProbs();
+}
+
+void RangeImageEvaluator::computeRangeImage()
+{
+  const size_t num_points = prev_us_.size();
+  if (num_points == 0) {
+    num_us_ = 0;
+    num_vs_ = 0;
+    pixel_ranges_.clear();
+    return;
+  }
+
+  // Find the extent of the previous points.
+  const double max_u = *std::max_element(prev_us_.begin(), prev_us_.end());
+  const double max_v = *std::max_element(prev_vs_.begin(), prev_vs_.end());
+  min_u_ = *std::min_element(prev_us_.begin(), prev_us_.end());
+  min_v_ = *std::min_element(prev_vs_.begin(), prev_vs_.end());
+
+  // Use larger pixels if the previous points do not fit in the maximum
+  // patch size, including the padding below.
+  u_step_ = max(u_step_, (max_u - min_u_) / (params_->kMaxXSize - 3));
+  v_step_ = max(v_step_, (max_v - min_v_) / (params_->kMaxYSize - 3));
+  inv_u_step_ = 1 / u_step_;
+  inv_v_step_ = 1 / v_step_;
+
+  // We add one pixel of padding on each side, to allow for inexact matches.
+  min_u_ -= u_step_;
+  min_v_ -= v_step_;
+
+  // Find the appropriate size for the patch.
+  num_us_ = static_cast<int>(floor((max_u - min_u_) * inv_u_step_)) + 2;
+  num_vs_ = static_cast<int>(floor((max_v - min_v_) * inv_v_step_)) + 2;
+  const int num_pixels = num_us_ * num_vs_;
+
+  // Keep the range of the nearest point in each pixel.
+  nearest_ranges_.assign(num_pixels, kEmptyPixel);
+  for (size_t k = 0; k < num_points; ++k) {
+    const int i = static_cast<int>((prev_us_[k] - min_u_) * inv_u_step_);
+    const int j = static_cast<int>((prev_vs_[k] - min_v_) * inv_v_step_);
+    float& range = nearest_ranges_[i * num_vs_ + j];
+    if (range == kEmptyPixel || prev_ranges_[k] < range) {
+      range = prev_ranges_[k];
+    }
+  }
+
+  // Fill each empty pixel with the nearest range of its 8 neighbors, so
+  // that a point which moves slightly across the boundary of a pixel, or
+  // into a gap between the down-sampled previous points, still finds its
+  // match.
+  pixel_ranges_ = nearest_ranges_;
+  for (int i = 0; i < num_us_; ++i) {
+    for (int j = 0; j < num_vs_; ++j) {
+      float& range = pixel_ranges_[i * num_vs_ + j];
+      if (range != kEmptyPixel) {
+        continue;
+      }
+      const int max_i = min(num_us_ - 1, i + 1);
+      const int max_j = min(num_vs_ - 1, j + 1);
+      for (int ni = max(0, i - 1); ni <= max_i; ++ni) {
+        for (int nj = max(0, j - 1); nj <= max_j; ++nj) {
+          const float neighbor_range = nearest_ranges_[ni * num_vs_ + nj];
+          if (neighbor_range != kEmptyPixel &&
+              (range == kEmptyPixel || neighbor_range < range)) {
+            range = neighbor_range;
+          }
+        }
+      }
+    }
+  }
+}
+
+void RangeImageEvaluator::computeResidualLogProbs()
+{
+  // Tabulate the residuals up to the spillover radius of the density grids,
+  // beyond which a point does not match.
+  const double residual_step = sigma_xy_ / kResidualStepsPerSigma;
+  residual_scale_ = 1 / residual_step;
+  const int num_residuals = static_cast<int>(
+        ceil(params_->kSpilloverRadius * kResidualStepsPerSigma)) + 1;
+  residual_log_probs_.resize(num_residuals);
+  for (int k = 0; k < num_residuals; ++k) {
+    const double residual = k * residual_step;
+    residual_log_probs_[k] =
+        log(exp(residual * residual * xy_exp_factor_) + smoothing_factor_);
+  }
+}
+
+inline double RangeImageEvaluator::getPointLogProbability(
+    const double u, const double v, const double range) const
+{
+  // Find the pixel for this point.  Points outside of the patch do not
+  // match any of the previous points.
+  const double u_scaled = (u - min_u_) * inv_u_step_;
+  const double v_scaled = (v - min_v_) * inv_v_step_;
+  if (!(u_scaled >= 0 && u_scaled < num_us_ &&
+        v_scaled >= 0 && v_scaled < num_vs_)) {
+    return no_match_log_prob_;
+  }
+  const float pixel_range = pixel_ranges_[
+      static_cast<int>(u_scaled) * num_vs_ + static_cast<int>(v_scaled)];
+  if (pixel_range == kEmptyPixel) {
+    return no_match_log_prob_;
+  }
+
+  // Look up the probability of the range residual.
+  const size_t residual_index = static_cast<size_t>(
+        fabs(range - pixel_range) * residual_scale_ + 0.5);
+  return residual_index < residual_log_probs_.size() ?
+        residual_log_probs_[residual_index] : no_match_log_prob_;
+}
+
+void RangeImageEvaluator::getLogProbabilities(
+    const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& current_points,
+    const Eigen::Vector3f& ,
+    const MotionModel& motion_model,
+    const XYZTransform* transforms, const size_t num_transforms,
+    double* log_probs)
+{
+  // Total log measurement probability for each of the transforms.
+  double log_measurement_probs[kTransformBlockSize];
+
+  // The depth and lateral offset of each translation, in the frame of the
+  // image.
+  double depth_offsets[kTransformBlockSize];
+  double lateral_offsets[kTransformBlockSize];
+  for (size_t j = 0; j < num_transforms; ++j) {
+    log_measurement_probs[j] = 0;
+    depth_offsets[j] =
+        transforms[j].x * center_cos_ + transforms[j].y * center_sin_;
+    lateral_offsets[j] =
+        -transforms[j].x * center_sin_ + transforms[j].y * center_cos_;
+  }
+
+  // Iterate over every point once, and look up its pixel in the range image
+  // for each of the transforms.
+  const size_t num_points = current_points->size();
+  for (size_t i = 0; i < num_points; ++i) {
+    const pcl::PointXYZRGB& pt = (*current_points)[i];
+    const double depth = pt.x * center_cos_ + pt.y * center_sin_;
+    const double lateral = -pt.x * center_sin_ + pt.y * center_cos_;
+
+    for (size_t j = 0; j < num_transforms; ++j) {
+      // Shift the point based on the proposed alignment.
+      const double shifted_depth = depth + depth_offsets[j];
+      const double shifted_lateral = lateral + lateral_offsets[j];
+      const double shifted_z = pt.z + transforms[j].z;
+
+      if (shifted_depth < kMinDepth) {
+        log_measurement_probs[j] += no_match_log_prob_;
+        continue;
+      }
+
+      // Project the point into the image.
+      const double inv_depth = 1 / shifted_depth;
+      const double range = sqrt(shifted_depth * shifted_depth +
+                                shifted_lateral * shifted_lateral +
+                                shifted_z * shifted_z);
+      log_measurement_probs[j] += getPointLogProbability(
+            shifted_lateral * inv_depth, shifted_z * inv_depth, range);
+    }
+  }
+
+  for (size_t j = 0; j < num_transforms; ++j) {
+    // Compute the motion model probability.
+    const double motion_model_prob = motion_model.computeScore(
+          transforms[j].x, transforms[j].y, transforms[j].z);
+
+    // Combine the motion model score with the (discounted) measurement score
+    // to get the final log probability.
+    log_probs[j] = log(motion_model_prob) +
+        measurement_discount_factor_ * log_measurement_probs[j];
+  }
+}
+
+} // namespace precision_tracking
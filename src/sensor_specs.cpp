@@ -11,6 +11,24 @@
 
 namespace precision_tracking {
 
+namespace {
+
+// The horizontal resolution for the 64-beam Velodyne spinning at 10 Hz
+// is 0.18 degrees.
+const double velodyne_horizontal_angular_res = 0.18;
+
+// There are 64 beams spanning 26.8 vertical degrees, so the average spacing
+// between each beam is computed as follows.
+const double velodyne_vertical_angular_res = 26.8 / 63;
+
+// The resolution in meters per meter of range, which we compute once.
+const double velodyne_horizontal_res_per_meter =
+    2 * tan(velodyne_horizontal_angular_res / 2.0 * M_PI / 180.0);
+const double velodyne_vertical_res_per_meter =
+    2 * tan(velodyne_vertical_angular_res / 2.0 * M_PI / 180.0);
+
+}  // namespace
+
 // Computes the sensor resolution for an object at a given distance,
 // for the 64-beam Velodyne.
 void getSensorResolution(const Eigen::Vector3f& centroid_local_coordinates,
@@ -21,24 +39,11 @@ void getSensorResolution(const Eigen::Vector3f& centroid_local_coordinates,
       sqrt(pow(centroid_local_coordinates(0), 2) +
            pow(centroid_local_coordinates(1), 2));
 
-  // The horizontal resolution for the 64-beam Velodyne spinning at 10 Hz
-  // is 0.18 degrees.
-  const double velodyne_horizontal_angular_res = 0.18;
-
-  // There are 64 beams spanning 26.8 vertical degrees, so the average spacing
-  // between each beam is computed as follows.
-  const double velodyne_vertical_angular_res = 26.8 / 63;
-
   // We convert the angular resolution to meters for a given range.
-  const double velodyne_horizontal_res =
-      2 * horizontal_distance *
-      tan(velodyne_horizontal_angular_res / 2.0 * M_PI / 180.0);
-  const double velodyne_vertical_res =
-      2 * horizontal_distance *
-      tan(velodyne_vertical_angular_res / 2.0 * M_PI / 180.0);
-
-  *sensor_horizontal_res = velodyne_horizontal_res;
-  *sensor_vertical_res = velodyne_vertical_res;
+  *sensor_horizontal_res =
+      horizontal_distance * velodyne_horizontal_res_per_meter;
+  *sensor_vertical_res =
+      horizontal_distance * velodyne_vertical_res_per_meter;
 }
 
 } // namespace precision_tracking
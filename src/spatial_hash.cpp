@@ -0,0 +1,172 @@
+/*
+ * spatial_hash.cpp
+ *
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+#include <precision_tracking/spatial_hash.h>
+
+
+namespace precision_tracking {
+
+SpatialHash::SpatialHash()
+  : radius_(0),
+    inv_cell_size_(0),
+    sq_radius_(0),
+    bucket_mask_(0),
+    query_x_cell_(0),
+    query_y_cell_(0),
+    query_z_cell_(0),
+    has_query_cell_(false),
+    num_query_buckets_(0)
+{
+}
+
+SpatialHash::~SpatialHash()
+{
+}
+
+void SpatialHash::setInputCloud(
+    const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& points,
+    const double radius)
+{
+  if (radius <= 0) {
+    printf("Error - the spatial hash radius must be > 0\n");
+    exit(1);
+  }
+
+  radius_ = radius;
+  has_query_cell_ = false;
+  inv_cell_size_ = 1.0 / radius;
+  sq_radius_ = radius * radius;
+
+  // Use about 2 buckets per point to keep the collisions rare.
+  const size_t num_points = points->size();
+  size_t num_buckets = 1;
+  while (num_buckets < 2 * num_points) {
+    num_buckets *= 2;
+  }
+  bucket_mask_ = num_buckets - 1;
+
+  // Count the points in each bucket.
+  std::vector<size_t> point_buckets(num_points);
+  bucket_starts_.assign(num_buckets + 1, 0);
+  for (size_t i = 0; i < num_points; ++i) {
+    const pcl::PointXYZRGB& pt = (*points)[i];
+    point_buckets[i] = getBucket(getCell(pt.x), getCell(pt.y), getCell(pt.z));
+    bucket_starts_[point_buckets[i] + 1]++;
+  }
+
+  // Convert the counts to the start of each bucket.
+  for (size_t i = 0; i < num_buckets; ++i) {
+    bucket_starts_[i + 1] += bucket_starts_[i];
+  }
+
+  // Place each point in its bucket.
+  entries_.resize(num_points);
+  std::vector<size_t> next_entry(bucket_starts_.begin(),
+                                 bucket_starts_.end() - 1);
+  for (size_t i = 0; i < num_points; ++i) {
+    const pcl::PointXYZRGB& pt = (*points)[i];
+    Entry& entry = entries_[next_entry[point_buckets[i]]++];
+    entry.x = pt.x;
+    entry.y = pt.y;
+    entry.z = pt.z;
+    entry.index = static_cast<int>(i);
+  }
+}
+
+bool SpatialHash::nearestWithinRadius(
+    const pcl::PointXYZRGB& query, int* index, float* sq_dist)
+{
+  const int x_cell = getCell(query.x);
+  const int y_cell = getCell(query.y);
+  const int z_cell = getCell(query.z);
+
+  // The cells are as large as the radius, so all points within the radius
+  // are in the 27 cells around the query.  Find their buckets, unless the
+  // previous query was in the same cell.  Several cells can share a bucket,
+  // so we only keep the distinct buckets.
+  if (!has_query_cell_ || x_cell != query_x_cell_ ||
+      y_cell != query_y_cell_ || z_cell != query_z_cell_) {
+    num_query_buckets_ = 0;
+    for (int i = x_cell - 1; i <= x_cell + 1; ++i) {
+      for (int j = y_cell - 1; j <= y_cell + 1; ++j) {
+        for (int k = z_cell - 1; k <= z_cell + 1; ++k) {
+          const size_t bucket = getBucket(i, j, k);
+
+          // Skip empty buckets and buckets that we already have.
+          if (bucket_starts_[bucket] == bucket_starts_[bucket + 1]) {
+            continue;
+          }
+          bool is_new = true;
+          for (size_t b = 0; b < num_query_buckets_; ++b) {
+            if (query_buckets_[b] == bucket) {
+              is_new = false;
+              break;
+            }
+          }
+          if (is_new) {
+            query_buckets_[num_query_buckets_++] = bucket;
+          }
+        }
+      }
+    }
+    query_x_cell_ = x_cell;
+    query_y_cell_ = y_cell;
+    query_z_cell_ = z_cell;
+    has_query_cell_ = true;
+  }
+
+  // Other points which share these buckets are rejected by the distance
+  // check.
+  float best_sq_dist = sq_radius_;
+  int best_index = -1;
+  for (size_t b = 0; b < num_query_buckets_; ++b) {
+    const size_t bucket = query_buckets_[b];
+    const size_t end = bucket_starts_[bucket + 1];
+    for (size_t e = bucket_starts_[bucket]; e < end; ++e) {
+      const Entry& entry = entries_[e];
+      const float dx = entry.x - query.x;
+      const float dy = entry.y - query.y;
+      const float dz = entry.z - query.z;
+      const float entry_sq_dist = dx * dx + dy * dy + dz * dz;
+      if (entry_sq_dist < best_sq_dist ||
+          (entry_sq_dist == best_sq_dist &&
+           (best_index < 0 || entry.index < best_index))) {
+        best_sq_dist = entry_sq_dist;
+        best_index = entry.index;
+      }
+    }
+  }
+
+  if (best_index < 0) {
+    return false;
+  }
+
+  *index = best_index;
+  *sq_dist = best_sq_dist;
+  return true;
+}
+
+int SpatialHash::getCell(const float value) const
+{
+  return static_cast<int>(floor(value * inv_cell_size_));
+}
+
+size_t SpatialHash::getBucket(
+    const int x_cell, const int y_cell, const int z_cell) const
+{
+  // Hash function from Teschner et al., "Optimized Spatial Hashing for
+  // Collision Detection of Deformable Objects", 2003.
+  const size_t hash =
+      (static_cast<size_t>(x_cell) * 73856093u) ^
+      (static_cast<size_t>(y_cell) * 19349663u) ^
+      (static_cast<size_t>(z_cell) * 83492791u);
+  return hash & bucket_mask_;
+}
+
+} // namespace precision_tracking
@@ -0,0 +1,208 @@
+/*
+ * spillover_cache.cpp
+ *
+ */
+
+#include <cmath>
+
+#include <precision_tracking/spillover_cache.h>
+#include <precision_tracking/fixed_point.h>
+
+
+namespace precision_tracking {
+
+namespace {
+
+// Quantize an exponent factor, which must be negative.
+int getFactorBin(const double exp_factor, const double bins_per_log) {
+  return static_cast<int>(round(log(-exp_factor) * bins_per_log));
+}
+
+// Get the exponent factor in the middle of the bin.
+double getBinFactor(const int bin, const double bins_per_log) {
+  return -exp(bin / bins_per_log);
+}
+
+}  // namespace
+
+template <>
+const double* SpilloverKernel::getCells<double>() const
+{
+  return &log_densities[0];
+}
+
+template <>
+const boost::int16_t* SpilloverKernel::getCells<boost::int16_t>() const
+{
+  return &fixed_point_log_densities[0];
+}
+
+SpilloverCache& SpilloverCache::getInstance()
+{
+  static SpilloverCache instance;
+  return instance;
+}
+
+SpilloverCache::SpilloverCache()
+  : num_entries_(0)
+{
+  for (size_t i = 0; i < kNumBuckets; ++i) {
+    bucket_heads_[i].store(NULL, boost::memory_order_relaxed);
+  }
+}
+
+SpilloverCache::~SpilloverCache()
+{
+  for (size_t i = 0; i < kNumBuckets; ++i) {
+    const Entry* entry = bucket_heads_[i].load(boost::memory_order_relaxed);
+    while (entry) {
+      const Entry* next = entry->next;
+      delete entry;
+      entry = next;
+    }
+  }
+}
+
+bool SpilloverCache::Key::operator==(const Key& other) const
+{
+  return num_steps_xy == other.num_steps_xy &&
+      num_steps_z == other.num_steps_z &&
+      xy_factor_bin == other.xy_factor_bin &&
+      z_factor_bin == other.z_factor_bin &&
+      smoothing_factor == other.smoothing_factor &&
+      factor_bins_per_log == other.factor_bins_per_log;
+}
+
+const SpilloverKernel& SpilloverCache::getKernel(
+    const int num_steps_xy, const int num_steps_z,
+    const double xy_exp_factor, const double z_exp_factor,
+    const double smoothing_factor, const double factor_bins_per_log,
+    SpilloverKernel* local_kernel)
+{
+  // Without quantization the kernels almost never repeat, so we do not
+  // cache them.
+  if (factor_bins_per_log <= 0) {
+    computeKernel(num_steps_xy, num_steps_z, xy_exp_factor, z_exp_factor,
+                  smoothing_factor, local_kernel);
+    return *local_kernel;
+  }
+
+  const Key key = getKey(num_steps_xy, num_steps_z, xy_exp_factor,
+                         z_exp_factor, smoothing_factor, factor_bins_per_log);
+  boost::atomic<const Entry*>& bucket_head = bucket_heads_[getBucket(key)];
+
+  // The acquire load makes the contents of the entries visible.
+  const SpilloverKernel* kernel =
+      find(bucket_head.load(boost::memory_order_acquire), key);
+  if (kernel) {
+    return *kernel;
+  }
+
+  boost::mutex::scoped_lock lock(insert_mutex_);
+
+  // Another thread may have added the kernel while we waited for the lock.
+  kernel = find(bucket_head.load(boost::memory_order_relaxed), key);
+  if (kernel) {
+    return *kernel;
+  }
+
+  // Don't let the cache grow without bound if the parameters never repeat.
+  if (num_entries_.load(boost::memory_order_relaxed) >= kMaxEntries) {
+    computeKernel(key, local_kernel);
+    return *local_kernel;
+  }
+
+  // Fill in the entry before publishing it with the release store, so that
+  // lookups never see a partially computed kernel.
+  Entry* entry = new Entry;
+  entry->key = key;
+  computeKernel(key, &entry->kernel);
+  entry->next = bucket_head.load(boost::memory_order_relaxed);
+  bucket_head.store(entry, boost::memory_order_release);
+  num_entries_.fetch_add(1, boost::memory_order_relaxed);
+
+  return entry->kernel;
+}
+
+SpilloverCache::Key SpilloverCache::getKey(
+    const int num_steps_xy, const int num_steps_z,
+    const double xy_exp_factor, const double z_exp_factor,
+    const double smoothing_factor, const double factor_bins_per_log)
+{
+  Key key;
+  key.num_steps_xy = num_steps_xy;
+  key.num_steps_z = num_steps_z;
+  key.xy_factor_bin = getFactorBin(xy_exp_factor, factor_bins_per_log);
+  key.z_factor_bin = num_steps_z > 0 ?
+        getFactorBin(z_exp_factor, factor_bins_per_log) : 0;
+  key.smoothing_factor = smoothing_factor;
+  key.factor_bins_per_log = factor_bins_per_log;
+  return key;
+}
+
+size_t SpilloverCache::getBucket(const Key& key)
+{
+  // The exponent factors change the most between kernels.
+  const size_t hash =
+      (static_cast<size_t>(key.xy_factor_bin) * 73856093u) ^
+      (static_cast<size_t>(key.z_factor_bin) * 19349663u) ^
+      (static_cast<size_t>(key.num_steps_xy) * 83492791u) ^
+      static_cast<size_t>(key.num_steps_z);
+  return hash % kNumBuckets;
+}
+
+const SpilloverKernel* SpilloverCache::find(const Entry* head, const Key& key)
+{
+  for (const Entry* entry = head; entry; entry = entry->next) {
+    if (entry->key == key) {
+      return &entry->kernel;
+    }
+  }
+  return NULL;
+}
+
+void SpilloverCache::computeKernel(const Key& key, SpilloverKernel* kernel)
+{
+  // For a 2D kernel (num_steps_z = 0), the z factor is never used.
+  computeKernel(key.num_steps_xy, key.num_steps_z,
+                getBinFactor(key.xy_factor_bin, key.factor_bins_per_log),
+                getBinFactor(key.z_factor_bin, key.factor_bins_per_log),
+                key.smoothing_factor, kernel);
+}
+
+void SpilloverCache::computeKernel(
+    const int num_steps_xy, const int num_steps_z,
+    const double xy_exp_factor, const double z_exp_factor,
+    const double smoothing_factor, SpilloverKernel* kernel)
+{
+  const double fixed_point_scale = getFixedPointScale(smoothing_factor);
+
+  kernel->num_steps_xy = num_steps_xy;
+  kernel->num_steps_z = num_steps_z;
+  const size_t size = (num_steps_xy + 1) * (num_steps_xy + 1) *
+      (num_steps_z + 1);
+  kernel->log_densities.resize(size);
+  kernel->fixed_point_log_densities.resize(size);
+
+  // For any given point, the density falls off as a Gaussian to
+  // neighboring regions.
+  size_t index = 0;
+  for (int i = 0; i <= num_steps_xy; ++i) {
+    for (int j = 0; j <= num_steps_xy; ++j) {
+      const double log_xy_density = (i * i + j * j) * xy_exp_factor;
+
+      for (int k = 0; k <= num_steps_z; ++k) {
+        const double log_z_density = k * k * z_exp_factor;
+
+        const double log_density = log(
+              exp(log_xy_density + log_z_density) + smoothing_factor);
+        kernel->log_densities[index] = log_density;
+        kernel->fixed_point_log_densities[index] =
+            toFixedPoint(log_density, fixed_point_scale);
+        ++index;
+      }
+    }
+  }
+}
+
+} // namespace precision_tracking
@@ -5,8 +5,11 @@
  *
  */
 
+#include <algorithm>
 #include <vector>
 
+#include <sys/stat.h>
+
 #include <pcl/conversions.h>
 #include <pcl/io/file_io.h>
 
@@ -159,6 +162,27 @@ bool TrackManagerColor::deserialize(istream& istrm, const int tracknum) {
 }
 
 
+bool TrackManagerColor::deserialize(istream& istrm,
+                                    const vector<std::streamoff>& track_offsets,
+                                    const size_t begin, const size_t end) {
+  tracks_.clear();
+
+  for (size_t i = begin; i < end && i < track_offsets.size(); ++i) {
+    istrm.clear();
+    istrm.seekg(track_offsets[i]);
+
+    boost::shared_ptr<Track> tr(new Track());
+    if (!tr->deserialize(istrm)) {
+      cerr << "Could not deserialize track " << i << " at offset "
+           << track_offsets[i] << endl;
+      return false;
+    }
+    tracks_.push_back(tr);
+  }
+
+  return true;
+}
+
 bool TrackManagerColor::deserialize(istream& istrm) {
   tracks_.clear();
   string line;
@@ -330,7 +354,7 @@ double Track::getMeanNumPoints() const {
   return total / (double)frames_.size();
 }
   
-double Track::getMeanDistance() {
+double Track::getMeanDistance() const {
   double total = 0;
   for(size_t i = 0; i < frames_.size(); ++i) {
     total += frames_[i]->getDistance();
@@ -408,10 +432,15 @@ Frame::Frame(pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud,
   cloud_(cloud),
   timestamp_(timestamp)
 {
+  computeMetadata();
 }
 
 Frame::Frame(istream& istrm) :
-  serialization_version_(FRAME_SERIALIZATION_VERSION)
+  serialization_version_(FRAME_SERIALIZATION_VERSION),
+  bounding_box_(Eigen::Matrix2f::Zero()),
+  centroid_(Eigen::Vector3f::Zero()),
+  distance_(0),
+  num_points_(0)
 {
   deserialize(istrm);
 }
@@ -453,6 +482,8 @@ bool Frame::deserialize(std::istream& istrm) {
       new pcl::PointCloud<pcl::PointXYZRGB>);
   *cloud_ = cloud;
 
+  computeMetadata();
+
   return true;
 }
 
@@ -468,51 +499,28 @@ void Frame::serialize(std::ostream& out) const{
   serializePointCloud(*cloud_, out);
 }
 
-Eigen::Vector3f Frame::getCentroid() {
-  if(centroid_)
-    return *centroid_;
-
-  centroid_ = boost::shared_ptr<Eigen::Vector3f>(new Eigen::Vector3f());
-  *centroid_ = Eigen::Vector3f::Zero();
-  for(size_t i = 0; i < cloud_->points.size(); ++i) {
-    centroid_->coeffRef(0) += cloud_->points[i].x;
-    centroid_->coeffRef(1) += cloud_->points[i].y;
-    centroid_->coeffRef(2) += cloud_->points[i].z;
-  }
-  *centroid_ /= (double)cloud_->points.size();
-
-  return *centroid_;
-}
-
-Eigen::MatrixXf Frame::getBoundingBox() {
-  if(bounding_box_)
-    return *bounding_box_;
+void Frame::computeMetadata() {
+  num_points_ = cloud_->points.size();
 
-  bounding_box_ = boost::shared_ptr<Eigen::MatrixXf>(new Eigen::MatrixXf(2, 2));
-  Eigen::MatrixXf& bb = *bounding_box_;
-  bb(0, 0) = FLT_MAX; // Small x.
-  bb(1, 0) = FLT_MAX; // Small y.
-  bb(0, 1) = -FLT_MAX; // Big x.
-  bb(1, 1) = -FLT_MAX; // Big y.
-  for(size_t i = 0; i < cloud_->points.size(); ++i) {
-    double x = cloud_->points[i].x;
-    double y = cloud_->points[i].y;
-    if(x < bb(0, 0))
-      bb(0, 0) = x;
-    if(x > bb(0, 1))
-      bb(0, 1) = x;
-    if(y < bb(1, 0))
-      bb(1, 0) = y;
-    if(y > bb(1, 1))
-      bb(1, 1) = y;
+  // Compute the centroid and the bounding box in a single pass.
+  centroid_ = Eigen::Vector3f::Zero();
+  bounding_box_(0, 0) = FLT_MAX; // Small x.
+  bounding_box_(1, 0) = FLT_MAX; // Small y.
+  bounding_box_(0, 1) = -FLT_MAX; // Big x.
+  bounding_box_(1, 1) = -FLT_MAX; // Big y.
+  for(size_t i = 0; i < num_points_; ++i) {
+    const pcl::PointXYZRGB& pt = cloud_->points[i];
+    centroid_(0) += pt.x;
+    centroid_(1) += pt.y;
+    centroid_(2) += pt.z;
+    bounding_box_(0, 0) = std::min(bounding_box_(0, 0), pt.x);
+    bounding_box_(0, 1) = std::max(bounding_box_(0, 1), pt.x);
+    bounding_box_(1, 0) = std::min(bounding_box_(1, 0), pt.y);
+    bounding_box_(1, 1) = std::max(bounding_box_(1, 1), pt.y);
   }
+  centroid_ /= (double)num_points_;
 
-  return *bounding_box_;
-}
-
-double Frame::getDistance() {
-  Eigen::Vector3f centroid = getCentroid();
-  return (centroid.cast<double>()).norm();
+  distance_ = (centroid_.cast<double>()).norm();
 }
 
 
@@ -530,6 +538,130 @@ bool checkLine(istream& istrm, const string& expected_input) {
   return true;
 }
 
+bool indexTracks(istream& istrm, vector<std::streamoff>* track_offsets) {
+  track_offsets->clear();
+  string line;
+
+  getline(istrm, line);
+  if(line.compare("TrackManager") != 0) {
+    return false;
+  }
+
+  if (!checkLine(istrm, "serialization_version_")) return false;
+  int serialization_version;
+  istrm >> serialization_version;
+  if(serialization_version != TRACKMANAGER_SERIALIZATION_VERSION) {
+    cerr << "Expected TrackManager serialization_version_ == " << TRACKMANAGER_SERIALIZATION_VERSION;
+    cerr << ".  This file is vs " << serialization_version << ", aborting." << endl;
+    return false;
+  }
+  getline(istrm, line);
+
+  while(true) {
+    const std::streamoff begin = istrm.tellg();
+
+    getline(istrm, line);
+    if(!istrm || line.compare("Track") != 0) {
+      break;
+    }
+
+    if (!checkLine(istrm, "serialization_version_")) return false;
+    getline(istrm, line);
+    if (!checkLine(istrm, "track_num_")) return false;
+    getline(istrm, line);
+    if (!checkLine(istrm, "num_frames_")) return false;
+    size_t num_frames = 0;
+    istrm >> num_frames;
+    getline(istrm, line);
+
+    for (size_t i = 0; i < num_frames; ++i) {
+      if (!skipFrame(istrm)) {
+        return false;
+      }
+    }
+
+    track_offsets->push_back(begin);
+  }
+
+  return true;
+}
+
+bool getFileStamp(const string& filename, string* stamp) {
+  struct stat file_stat;
+  if (stat(filename.c_str(), &file_stat) != 0) {
+    return false;
+  }
+  std::ostringstream stamp_stream;
+  stamp_stream << file_stat.st_size << " " << file_stat.st_mtim.tv_sec << "."
+               << file_stat.st_mtim.tv_nsec;
+  *stamp = stamp_stream.str();
+  return true;
+}
+
+bool saveTrackIndex(const string& filename, const string& tm_file_stamp,
+                    const vector<std::streamoff>& track_offsets) {
+  ofstream ofs(filename.c_str(), ios::out);
+  if (ofs.fail()) {
+    return false;
+  }
+  ofs << "TrackIndex" << endl;
+  ofs << tm_file_stamp << endl;
+  ofs << track_offsets.size() << endl;
+  for (size_t i = 0; i < track_offsets.size(); ++i) {
+    ofs << track_offsets[i] << endl;
+  }
+  ofs.close();
+  return !ofs.fail();
+}
+
+bool loadTrackIndex(const string& filename, const string& tm_file_stamp,
+                    vector<std::streamoff>* track_offsets) {
+  ifstream ifs(filename.c_str(), ios::in);
+  if (ifs.fail() || !checkLine(ifs, "TrackIndex")) {
+    return false;
+  }
+  string indexed_stamp;
+  getline(ifs, indexed_stamp);
+  if (indexed_stamp.compare(tm_file_stamp) != 0) {
+    return false;
+  }
+  size_t num_tracks = 0;
+  ifs >> num_tracks;
+  track_offsets->resize(num_tracks);
+  for (size_t i = 0; i < num_tracks; ++i) {
+    ifs >> (*track_offsets)[i];
+  }
+  return !ifs.fail();
+}
+
+bool skipFrame(istream& istrm) {
+  string line;
+  if (!checkLine(istrm, "Frame")) return false;
+  if (!checkLine(istrm, "serialization_version_")) return false;
+  getline(istrm, line);
+  if (!checkLine(istrm, "timestamp_")) return false;
+  istrm.seekg(sizeof(double), ios::cur);
+  getline(istrm, line);
+
+  // Skip the header of the point cloud until we get to the size of the data.
+  while (getline(istrm, line)) {
+    if (line.compare("datasize: ") == 0) {
+      break;
+    }
+  }
+  size_t data_size;
+  istrm >> data_size;
+  getline(istrm, line);
+
+  istrm.seekg(data_size, ios::cur);
+  getline(istrm, line);
+
+  if (!checkLine(istrm, "is_dense: ")) return false;
+  getline(istrm, line);
+
+  return !istrm.fail();
+}
+
 bool readCloud(std::istream& s, pcl::PCLPointCloud2 &cloud)
 {
   string line;
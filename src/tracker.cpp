@@ -6,13 +6,28 @@
  *
  */
 
+#include <cstring>
+
+#include <boost/cstdint.hpp>
+
 #include <pcl/common/centroid.h>
 
 #include <precision_tracking/tracker.h>
+#include <precision_tracking/alignment_cache.h>
+#include <precision_tracking/binary_io.h>
 
 
 namespace precision_tracking {
 
+namespace {
+
+const char kTrackerStateHeader[] = "TrackerState";
+
+// Bump this whenever the format of the tracker state changes.
+const boost::uint32_t kTrackerStateVersion = 2;
+
+} // namespace
+
 Tracker::Tracker(const Params *params)
   : params_(params),
     previousModel_(new pcl::PointCloud<pcl::PointXYZRGB>),
@@ -86,21 +101,8 @@ void Tracker::addPoints(
                 sensor_vertical_resolution, *motion_model_, &scored_transforms);
       }
 
-
-      motion_model_->addTransformsWeightedGaussian(scored_transforms,
-                                                  timestamp_diff);
-      ScoredTransformXYZ best_transform;
-      scored_transforms.findBest(&best_transform, alignment_probability);
-
-      if (params_->useMean) {
-        Eigen::Vector3f mean_velocity = motion_model_->get_mean_velocity();
-        *estimated_velocity = mean_velocity;
-      } else {
-        Eigen::Vector3f best_displacement;
-        best_transform.getEigen(&best_displacement);
-
-        *estimated_velocity = (flip ? -1 : 1) * best_displacement / timestamp_diff;
-      }
+      estimateVelocity(scored_transforms, flip, timestamp_diff,
+                       estimated_velocity, alignment_probability);
     } else {
       // Track using the centroid-based Kalman filter.
       Eigen::Vector4f new_centroid;
@@ -123,4 +125,185 @@ void Tracker::addPoints(
   prev_timestamp_ = current_timestamp;
 }
 
+void Tracker::alignWithoutPrior(
+    const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& previous_points,
+    const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& current_points,
+    const double sensor_horizontal_resolution,
+    const double sensor_vertical_resolution,
+    ScoredTransforms<ScoredTransformXYZ>* scored_transforms)
+{
+  if (previous_points->empty() || current_points->empty()) {
+    return;
+  }
+
+  // A motion model without any observations gives a uniform prior.
+  const MotionModel uniform_motion_model(params_);
+
+  // Always align the smaller points to the bigger points, as in addPoints.
+  const bool flip = previous_points->size() > current_points->size();
+  if (!flip) {
+    precision_tracker_->track(
+          previous_points, current_points, sensor_horizontal_resolution,
+          sensor_vertical_resolution, uniform_motion_model, scored_transforms);
+  } else {
+    precision_tracker_->track(
+          current_points, previous_points, sensor_horizontal_resolution,
+          sensor_vertical_resolution, uniform_motion_model, scored_transforms);
+  }
+}
+
+void Tracker::addAlignment(
+    const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& current_points,
+    const double current_timestamp,
+    const ScoredTransforms<ScoredTransformXYZ>& scored_transforms,
+    Eigen::Vector3f* estimated_velocity)
+{
+  // Do not align if there are no points.
+  if (current_points->size() == 0){
+    printf("No points - cannot align.\n");
+    *estimated_velocity = Eigen::Vector3f::Zero();
+    return;
+  }
+
+  if (previousModel_->empty()) {
+    // No previous points - just creating initial model.
+    *estimated_velocity = Eigen::Vector3f::Zero();
+  } else if (scored_transforms.getScoredTransforms().empty()) {
+    // The previous frame had no points, so it could not be aligned.
+    printf("No alignment - cannot estimate velocity.\n");
+    *estimated_velocity = Eigen::Vector3f::Zero();
+  } else {
+    const double timestamp_diff = current_timestamp - prev_timestamp_;
+
+    // Propogate the motion model forward to estimate the new position.
+    motion_model_->propagate(timestamp_diff);
+
+    // The alignment was computed in the same direction as in addPoints.
+    const bool flip = previousModel_->size() > current_points->size();
+    motion_model_->setFlip(flip);
+
+    // Combine the motion model with the measurement probabilities.
+    ScoredTransforms<ScoredTransformXYZ> combined_transforms(
+          scored_transforms.getScoredTransforms());
+    std::vector<ScoredTransformXYZ>& combined =
+        combined_transforms.getScoredTransforms();
+    for (size_t i = 0; i < combined.size(); ++i) {
+      ScoredTransformXYZ& transform = combined[i];
+      const double motion_model_prob = motion_model_->computeScore(
+            transform.getX(), transform.getY(), transform.getZ());
+      transform.setUnnormalizedLogProb(
+            transform.getUnnormalizedLogProb() + log(motion_model_prob));
+    }
+
+    double alignment_probability;
+    estimateVelocity(combined_transforms, flip, timestamp_diff,
+                     estimated_velocity, &alignment_probability);
+  }
+
+  // Save mdoel and timestamp.
+  *previousModel_ = *current_points;
+  prev_timestamp_ = current_timestamp;
+}
+
+void Tracker::estimateVelocity(
+    const ScoredTransforms<ScoredTransformXYZ>& scored_transforms,
+    const bool flip,
+    const double timestamp_diff,
+    Eigen::Vector3f* estimated_velocity,
+    double* alignment_probability)
+{
+  motion_model_->addTransformsWeightedGaussian(scored_transforms,
+                                              timestamp_diff);
+  ScoredTransformXYZ best_transform;
+  scored_transforms.findBest(&best_transform, alignment_probability);
+
+  if (params_->useMean) {
+    Eigen::Vector3f mean_velocity = motion_model_->get_mean_velocity();
+    *estimated_velocity = mean_velocity;
+  } else {
+    Eigen::Vector3f best_displacement;
+    best_transform.getEigen(&best_displacement);
+
+    *estimated_velocity = (flip ? -1 : 1) * best_displacement / timestamp_diff;
+  }
+}
+
+void Tracker::saveState(std::ostream& out) const
+{
+  out.write(kTrackerStateHeader, sizeof(kTrackerStateHeader));
+  writeBinary(kTrackerStateVersion, out);
+  writeBinary(hashParams(*params_), out);
+  writeBinary(prev_timestamp_, out);
+  motion_model_->serialize(out);
+
+  // Each point is stored as x, y, z, rgb.
+  const boost::uint64_t num_points = previousModel_->size();
+  writeBinary(num_points, out);
+  for (size_t i = 0; i < num_points; ++i) {
+    const pcl::PointXYZRGB& pt = (*previousModel_)[i];
+    writeBinary(pt.x, out);
+    writeBinary(pt.y, out);
+    writeBinary(pt.z, out);
+    writeBinary(pt.rgb, out);
+  }
+}
+
+bool Tracker::loadState(std::istream& in)
+{
+  char header[sizeof(kTrackerStateHeader)];
+  boost::uint32_t version = 0;
+  in.read(header, sizeof(header));
+  if (!in.good() ||
+      memcmp(header, kTrackerStateHeader, sizeof(header)) != 0 ||
+      !readBinary(in, &version)) {
+    printf("Error - invalid tracker state\n");
+    return false;
+  }
+  if (version != kTrackerStateVersion) {
+    printf("Error - tracker state version is %u, expected %u\n",
+           version, kTrackerStateVersion);
+    return false;
+  }
+
+  // The motion model includes values from the params (such as the minimum
+  // score), so the state must be restored with the same params.
+  boost::uint64_t params_hash = 0;
+  if (!readBinary(in, &params_hash)) {
+    printf("Error - truncated tracker state\n");
+    return false;
+  }
+  if (params_hash != hashParams(*params_)) {
+    printf("Error - tracker state was saved with different params\n");
+    return false;
+  }
+
+  double prev_timestamp;
+  boost::shared_ptr<MotionModel> motion_model(new MotionModel(params_));
+  boost::uint64_t num_points = 0;
+  if (!readBinary(in, &prev_timestamp) ||
+      !motion_model->deserialize(in) ||
+      !readBinary(in, &num_points)) {
+    printf("Error - truncated tracker state\n");
+    return false;
+  }
+
+  pcl::PointCloud<pcl::PointXYZRGB>::Ptr previous_model(
+        new pcl::PointCloud<pcl::PointXYZRGB>);
+  for (size_t i = 0; i < num_points; ++i) {
+    // Add the points one at a time, in case num_points is corrupt.
+    pcl::PointXYZRGB pt;
+    if (!readBinary(in, &pt.x) || !readBinary(in, &pt.y) ||
+        !readBinary(in, &pt.z) || !readBinary(in, &pt.rgb)) {
+      printf("Error - truncated tracker state\n");
+      return false;
+    }
+    previous_model->push_back(pt);
+  }
+
+  prev_timestamp_ = prev_timestamp;
+  motion_model_ = motion_model;
+  previousModel_ = previous_model;
+  return true;
+}
+
 } // namespace precision_tracking
@@ -7,15 +7,29 @@
  */
 
 #include <string>
+#include <cstdarg>
 #include <cstdio>
+#include <fstream>
 #include <sstream>
+#include <algorithm>
+#include <limits>
+#include <map>
+
+#include <dirent.h>
+#include <errno.h>
+#include <malloc.h>
+#include <omp.h>
+#include <unistd.h>
+#include <sys/wait.h>
 
 #include <boost/math/constants/constants.hpp>
 #include <boost/make_shared.hpp>
 
+#include <precision_tracking/alignment_cache.h>
 #include <precision_tracking/track_manager_color.h>
 #include <precision_tracking/tracker.h>
 #include <precision_tracking/high_res_timer.h>
+#include <precision_tracking/memory_usage.h>
 #include <precision_tracking/sensor_specs.h>
 
 using std::string;
@@ -24,13 +38,158 @@ namespace {
 
 const double pi = boost::math::constants::pi<double>();
 
+// Heap memory allocated with malloc and its variants, in bytes.  This
+// includes everything allocated with new (e.g. the density grids), since
+// operator new calls malloc, as well as the point clouds, which Eigen
+// allocates with malloc or posix_memalign.
+volatile long live_heap_bytes = 0;
+volatile long peak_heap_bytes = 0;
+volatile long num_heap_allocations = 0;
+
+void recordAllocation(void* ptr) {
+  if (ptr == NULL) {
+    return;
+  }
+  const long live = __sync_add_and_fetch(&live_heap_bytes,
+                                         malloc_usable_size(ptr));
+  __sync_add_and_fetch(&num_heap_allocations, 1);
+
+  long peak = peak_heap_bytes;
+  while (live > peak &&
+         !__sync_bool_compare_and_swap(&peak_heap_bytes, peak, live)) {
+    peak = peak_heap_bytes;
+  }
+}
+
+void recordFree(void* ptr) {
+  if (ptr != NULL) {
+    __sync_sub_and_fetch(&live_heap_bytes, malloc_usable_size(ptr));
+  }
+}
+
+// Reset the peak heap memory to the current heap memory.
+void resetPeakHeapBytes() {
+  peak_heap_bytes = live_heap_bytes;
+}
+
+// When several configurations run concurrently, each one writes its output
+// to its own buffer, which is printed in one piece when the configuration
+// finishes (see runConfigs).  Otherwise this is NULL and we print directly.
+string* output_buffer = NULL;
+#pragma omp threadprivate(output_buffer)
+
+// Print to stdout, or to the output buffer of the calling thread.
+void printOutput(const char* format, ...)
+    __attribute__((format(printf, 1, 2)));
+
+void printOutput(const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+  if (output_buffer == NULL) {
+    vprintf(format, args);
+  } else {
+    va_list size_args;
+    va_copy(size_args, args);
+    const int size = vsnprintf(NULL, 0, format, size_args);
+    va_end(size_args);
+    if (size > 0) {
+      std::vector<char> text(size + 1);
+      vsnprintf(&text[0], text.size(), format, args);
+      output_buffer->append(&text[0], size);
+    }
+  }
+  va_end(args);
+}
+
 } // namespace
 
+// Count all heap allocations, to measure the memory used by each tracker.
+// We replace malloc and its variants with versions which call the glibc
+// allocator and update the counters.  Every form of operator new and delete
+// goes through these, so they do not need to be replaced.
+extern "C" {
+
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t num, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+void* __libc_valloc(size_t size);
+void* __libc_pvalloc(size_t size);
+void __libc_free(void* ptr);
+
+void* malloc(size_t size) throw() {
+  void* ptr = __libc_malloc(size);
+  recordAllocation(ptr);
+  return ptr;
+}
+
+void* calloc(size_t num, size_t size) throw() {
+  void* ptr = __libc_calloc(num, size);
+  recordAllocation(ptr);
+  return ptr;
+}
+
+void* realloc(void* ptr, size_t size) throw() {
+  const long old_size = ptr != NULL ? malloc_usable_size(ptr) : 0;
+  void* new_ptr = __libc_realloc(ptr, size);
+  // If the reallocation fails, the old memory is left as it was.
+  if (new_ptr == NULL && size > 0) {
+    return NULL;
+  }
+  __sync_sub_and_fetch(&live_heap_bytes, old_size);
+  recordAllocation(new_ptr);
+  return new_ptr;
+}
+
+void* memalign(size_t alignment, size_t size) throw() {
+  void* ptr = __libc_memalign(alignment, size);
+  recordAllocation(ptr);
+  return ptr;
+}
+
+void* aligned_alloc(size_t alignment, size_t size) throw() {
+  return memalign(alignment, size);
+}
+
+int posix_memalign(void** memptr, size_t alignment, size_t size) throw() {
+  if (alignment % sizeof(void*) != 0 ||
+      (alignment & (alignment - 1)) != 0) {
+    return EINVAL;
+  }
+  void* ptr = memalign(alignment, size);
+  if (ptr == NULL) {
+    return ENOMEM;
+  }
+  *memptr = ptr;
+  return 0;
+}
+
+void* valloc(size_t size) throw() {
+  void* ptr = __libc_valloc(size);
+  recordAllocation(ptr);
+  return ptr;
+}
+
+void* pvalloc(size_t size) throw() {
+  void* ptr = __libc_pvalloc(size);
+  recordAllocation(ptr);
+  return ptr;
+}
+
+void free(void* ptr) throw() {
+  recordFree(ptr);
+  __libc_free(ptr);
+}
+
+} // extern "C"
+
 // Structure for storing estimated velocities for each track.
 struct TrackResults {
   int track_num;
   std::vector<Eigen::Vector3f> estimated_velocities;
   std::vector<bool> ignore_frame;
+  // Runtime for each frame of this track (including the first), in ms.
+  std::vector<double> frame_ms;
 };
 
 // Get the ground-truth velocities.
@@ -57,7 +216,8 @@ void getGTVelocities(const string& gt_folder, const int track_num,
   fclose(fid);
 }
 
-void computeErrorStatistics(const std::vector<double>& errors) {
+// Prints and returns the root-mean-square error.
+double computeErrorStatistics(const std::vector<double>& errors) {
   double sum_sq = 0;
 
   size_t num_frames = errors.size();
@@ -69,10 +229,13 @@ void computeErrorStatistics(const std::vector<double>& errors) {
 
   const double rms_error = sqrt(sum_sq / errors.size());
 
-  printf("RMS error: %lf m/s\n", rms_error);
+  printOutput("RMS error: %lf m/s\n", rms_error);
+
+  return rms_error;
 }
 
-void evaluateTracking(const std::vector<TrackResults>& velocity_estimates,
+// Returns the root-mean-square error of the velocity estimates.
+double evaluateTracking(const std::vector<TrackResults>& velocity_estimates,
                       const string& gt_folder,
                       boost::shared_ptr<std::vector<bool> > filter) {
 
@@ -114,7 +277,7 @@ void evaluateTracking(const std::vector<TrackResults>& velocity_estimates,
     }
   }
 
-  computeErrorStatistics(errors);
+  return computeErrorStatistics(errors);
 }
 
 // Filter to only evaluate on objects within a given distance (in meters).
@@ -206,12 +369,254 @@ void find_bad_frames(const precision_tracking::track_manager_color::TrackManager
   }
 }
 
-void track(
+// Returns the given percentile (between 0 and 100) of the values, using
+// the nearest-rank method.
+double computePercentile(std::vector<double> values, const double percentile) {
+  if (values.empty()) {
+    return 0;
+  }
+  const size_t rank = std::max(1.0, ceil(percentile / 100 * values.size()));
+  std::nth_element(values.begin(), values.begin() + rank - 1, values.end());
+  return values[rank - 1];
+}
+
+// Prints the mean and percentiles of the given latencies, in ms.
+void printLatencyPercentiles(const string& label,
+                             const std::vector<double>& latencies) {
+  if (latencies.empty()) {
+    return;
+  }
+  double sum = 0;
+  for (size_t i = 0; i < latencies.size(); ++i) {
+    sum += latencies[i];
+  }
+  printOutput("%-22s %8zu %9.3lf %9.3lf %9.3lf %9.3lf %9.3lf\n",
+              label.c_str(), latencies.size(), sum / latencies.size(),
+              computePercentile(latencies, 50),
+              computePercentile(latencies, 90),
+              computePercentile(latencies, 99),
+              computePercentile(latencies, 100));
+}
+
+// Print the distribution of the runtime per frame, broken down by the
+// number of points and the distance of each object, so that we can see
+// where the tail latency comes from.  Also print the distribution of the
+// total runtime of all objects in each sweep of the sensor.
+void printLatencyReport(
+    const precision_tracking::track_manager_color::TrackManagerColor& track_manager,
+    const std::vector<TrackResults>& velocity_estimates) {
+  const std::vector< boost::shared_ptr<precision_tracking::track_manager_color::Track> >& tracks =
+      track_manager.tracks_;
+
+  // Upper bounds of each bucket; the last bucket has no upper bound.
+  const size_t point_buckets[] = { 100, 300, 1000, 3000 };
+  const int num_point_buckets = sizeof(point_buckets) / sizeof(point_buckets[0]);
+  const double distance_buckets[] = { 5, 10, 20, 40 };
+  const int num_distance_buckets =
+      sizeof(distance_buckets) / sizeof(distance_buckets[0]);
+
+  // The sensor spins at 10 Hz.  The timestamps of the objects observed in
+  // one sweep are spread over the sweep, depending on their direction, so
+  // the sweep of each frame is found from its timestamp.
+  const double sweep_duration = 0.1;
+
+  std::vector<double> all_latencies;
+  std::vector<std::vector<double> > point_latencies(num_point_buckets + 1);
+  std::vector<std::vector<double> > distance_latencies(
+        num_distance_buckets + 1);
+  // The total latency of the frames in each sweep, indexed by
+  // floor(timestamp / sweep_duration).
+  std::map<long, double> sweep_latencies;
+
+  for (size_t i = 0; i < tracks.size(); ++i) {
+    const std::vector< boost::shared_ptr<precision_tracking::track_manager_color::Frame> >& frames =
+        tracks[i]->frames_;
+    const std::vector<double>& frame_ms = velocity_estimates[i].frame_ms;
+    for (size_t j = 0; j < frames.size() && j < frame_ms.size(); ++j) {
+      const double latency = frame_ms[j];
+      all_latencies.push_back(latency);
+
+      const size_t num_points = frames[j]->cloud_->size();
+      int point_bucket = 0;
+      while (point_bucket < num_point_buckets &&
+             num_points >= point_buckets[point_bucket]) {
+        point_bucket++;
+      }
+      point_latencies[point_bucket].push_back(latency);
+
+      const double distance = frames[j]->getDistance();
+      int distance_bucket = 0;
+      while (distance_bucket < num_distance_buckets &&
+             distance >= distance_buckets[distance_bucket]) {
+        distance_bucket++;
+      }
+      distance_latencies[distance_bucket].push_back(latency);
+
+      const long sweep = static_cast<long>(
+            floor(frames[j]->timestamp_ / sweep_duration));
+      sweep_latencies[sweep] += latency;
+    }
+  }
+
+  printOutput("%-22s %8s %9s %9s %9s %9s %9s\n", "Latency per frame (ms)",
+              "frames", "mean", "p50", "p90", "p99", "max");
+  printLatencyPercentiles("all", all_latencies);
+  for (int k = 0; k <= num_point_buckets; ++k) {
+    std::ostringstream label;
+    label << "points ";
+    if (k == 0) {
+      label << "< " << point_buckets[k];
+    } else if (k == num_point_buckets) {
+      label << ">= " << point_buckets[k - 1];
+    } else {
+      label << point_buckets[k - 1] << "-" << point_buckets[k];
+    }
+    printLatencyPercentiles(label.str(), point_latencies[k]);
+  }
+  for (int k = 0; k <= num_distance_buckets; ++k) {
+    std::ostringstream label;
+    label << "distance ";
+    if (k == 0) {
+      label << "< " << distance_buckets[k] << " m";
+    } else if (k == num_distance_buckets) {
+      label << ">= " << distance_buckets[k - 1] << " m";
+    } else {
+      label << distance_buckets[k - 1] << "-" << distance_buckets[k] << " m";
+    }
+    printLatencyPercentiles(label.str(), distance_latencies[k]);
+  }
+
+  std::vector<double> per_sweep;
+  for (std::map<long, double>::const_iterator it = sweep_latencies.begin();
+       it != sweep_latencies.end(); ++it) {
+    per_sweep.push_back(it->second);
+  }
+  printOutput("%-22s %8s\n", "Latency per sweep (ms)", "sweeps");
+  printLatencyPercentiles("all", per_sweep);
+}
+
+// Hardware event counts while tracking (see PerfCounters).
+struct EventCounts {
+  bool available;
+  double counts[precision_tracking::PerfCounters::kNumEvents];
+  double ipc;
+  // Number of (point, transform) pairs scored by the alignment evaluators.
+  double num_scored_points;
+};
+
+// Returns the hardware counters of the calling thread, opening them the
+// first time, since they only count the events of the thread that opened
+// them.
+precision_tracking::PerfCounters* getThreadCounters(
+    std::vector<boost::shared_ptr<precision_tracking::PerfCounters> >* perf_counters) {
+  boost::shared_ptr<precision_tracking::PerfCounters>& counters =
+      (*perf_counters)[omp_get_thread_num()];
+  if (!counters) {
+    counters.reset(new precision_tracking::PerfCounters);
+  }
+  return counters.get();
+}
+
+// Add up the hardware event counts of all threads, print them and save them
+// to event_counts.
+void summarizeEventCounts(
+    const std::vector<boost::shared_ptr<precision_tracking::PerfCounters> >& perf_counters,
+    const std::vector<boost::shared_ptr<precision_tracking::PrecisionTracker> >& precision_trackers,
+    EventCounts* event_counts) {
+  precision_tracking::PerfCounters total("Hardware counters");
+  for (size_t i = 0; i < perf_counters.size(); ++i) {
+    if (perf_counters[i]) {
+      total.add(*perf_counters[i]);
+    }
+  }
+
+  event_counts->num_scored_points = 0;
+  for (size_t i = 0; i < precision_trackers.size(); ++i) {
+    event_counts->num_scored_points += precision_trackers[i]->getNumScoredPoints();
+  }
+
+  printOutput("[COUNTERS] %s\n",
+              total.report(event_counts->num_scored_points,
+                           "scored point").c_str());
+
+  event_counts->available = total.isAvailable();
+  for (int i = 0; i < precision_tracking::PerfCounters::kNumEvents; ++i) {
+    event_counts->counts[i] = total.getCount(
+          static_cast<precision_tracking::PerfCounters::Event>(i));
+  }
+  event_counts->ipc = total.getIPC();
+}
+
+// Memory used while tracking, in bytes.  All of these are NaN if the memory
+// was not measured (see trackAndEvaluate).
+struct MemoryUsage {
+  // Peak heap memory allocated while tracking.
+  double peak_heap;
+  // Heap memory held by each tracker after tracking all objects.
+  double heap_per_tracker;
+  double num_allocations;
+  // Resident set size after tracking, and its peak while tracking.  These
+  // are 0 if not available.
+  double rss;
+  double peak_rss;
+};
+
+// Start measuring the memory used while tracking.  Returns the heap memory
+// in use before tracking.
+long startMeasuringMemory() {
+  resetPeakHeapBytes();
+  precision_tracking::resetPeakResidentSetSize();
+  return live_heap_bytes;
+}
+
+// Measure the memory used since startMeasuringMemory.  The trackers are
+// destroyed, to find out how much heap memory they were holding.
+void finishMeasuringMemory(
+    const long heap_baseline,
+    const long num_allocations_baseline,
+    std::vector<precision_tracking::Tracker>* trackers,
+    std::vector<boost::shared_ptr<precision_tracking::PrecisionTracker> >* precision_trackers,
+    MemoryUsage* memory_usage) {
+  size_t rss = 0;
+  size_t peak_rss = 0;
+  precision_tracking::getResidentSetSize(&rss, &peak_rss);
+
+  memory_usage->peak_heap = peak_heap_bytes - heap_baseline;
+  memory_usage->num_allocations =
+      num_heap_allocations - num_allocations_baseline;
+  memory_usage->rss = rss;
+  memory_usage->peak_rss = peak_rss;
+
+  const size_t num_trackers = trackers->size();
+  const long heap_with_trackers = live_heap_bytes;
+  trackers->clear();
+  precision_trackers->clear();
+  memory_usage->heap_per_tracker =
+      static_cast<double>(heap_with_trackers - live_heap_bytes) / num_trackers;
+
+  const double mb = 1024 * 1024;
+  printOutput("Memory: peak heap %.2lf MB, heap per tracker %.2lf MB, "
+              "%.0lf allocations", memory_usage->peak_heap / mb,
+              memory_usage->heap_per_tracker / mb,
+              memory_usage->num_allocations);
+  if (rss > 0) {
+    printOutput(", RSS %.2lf MB, peak RSS %.2lf MB", memory_usage->rss / mb,
+                memory_usage->peak_rss / mb);
+  }
+  printOutput("\n");
+}
+
+// Returns the mean runtime per frame, in milliseconds.  If event_counts
+// is not NULL, also counts hardware events while tracking, and if
+// memory_usage is not NULL, also measures the memory used.
+double track(
            const precision_tracking::track_manager_color::TrackManagerColor& track_manager,
            const precision_tracking::Params& params,
            const bool use_precision_tracker,
            const bool do_parallel,
-           std::vector<TrackResults>* velocity_estimates) {
+           std::vector<TrackResults>* velocity_estimates,
+           EventCounts* event_counts = NULL,
+           MemoryUsage* memory_usage = NULL) {
   const std::vector< boost::shared_ptr<precision_tracking::track_manager_color::Track> >& tracks =
       track_manager.tracks_;
 
@@ -222,23 +627,35 @@ void track(
 
   const int num_threads = do_parallel ? 8 : 1;
 
+  const long num_allocations_baseline = num_heap_allocations;
+  const long heap_baseline = memory_usage ? startMeasuringMemory() : 0;
+
   std::vector<precision_tracking::Tracker> trackers;
+  std::vector<boost::shared_ptr<precision_tracking::PrecisionTracker> >
+      precision_trackers;
   for (int i = 0; i < num_threads; ++i) {
     precision_tracking::Tracker tracker(&params);
     if (use_precision_tracker) {
-      tracker.setPrecisionTracker(
+      precision_trackers.push_back(
           boost::make_shared<precision_tracking::PrecisionTracker>(&params));
+      tracker.setPrecisionTracker(precision_trackers.back());
     }
     trackers.push_back(tracker);
   }
+  std::vector<boost::shared_ptr<precision_tracking::PerfCounters> >
+      perf_counters(num_threads);
 
   velocity_estimates->resize(tracks.size());
 
+  // When tracking serially, measure the CPU time of this thread so that
+  // the timings are not affected by other configurations running
+  // concurrently (see runConfigs).
+  const clockid_t clock = do_parallel ? CLOCK_REALTIME :
+                                        CLOCK_THREAD_CPUTIME_ID;
+
   std::ostringstream hrt_title_stream;
   hrt_title_stream << "Total time for tracking " << tracks.size() << " objects";
-  precision_tracking::HighResTimer hrt(hrt_title_stream.str(),
-                                       do_parallel ? CLOCK_REALTIME :
-                                                     CLOCK_PROCESS_CPUTIME_ID);
+  precision_tracking::HighResTimer hrt(hrt_title_stream.str(), clock);
   hrt.start();
 
   // Iterate over all tracks.
@@ -246,6 +663,8 @@ void track(
   for (int i = 0; i < tracks.size(); ++i) {
 
     precision_tracking::Tracker& tracker = trackers[omp_get_thread_num()];
+    precision_tracking::PerfCounters* counters =
+        event_counts ? getThreadCounters(&perf_counters) : NULL;
 
     // Reset the tracker for this new track.
     tracker.clear();
@@ -270,12 +689,23 @@ void track(
             frame->getCentroid(), &sensor_horizontal_resolution,
             &sensor_vertical_resolution);
 
-      // Track object.
+      // Track object.  The counters are read outside of the timed region, so
+      // that they do not add to the latency.
+      if (counters) {
+        counters->start();
+      }
+      precision_tracking::HighResTimer frame_timer("", clock);
+      frame_timer.start();
       Eigen::Vector3f estimated_velocity;
       tracker.addPoints(frame->cloud_, frame->timestamp_,
                          sensor_horizontal_resolution,
                          sensor_vertical_resolution,
                          &estimated_velocity);
+      frame_timer.stop();
+      if (counters) {
+        counters->stop();
+      }
+      track_estimates.frame_ms.push_back(frame_timer.getMilliseconds());
 
       // The first time we see this object, we don't have a velocity yet.
       // After the first time, save the estimated velocity.
@@ -290,120 +720,1489 @@ void track(
   }
 
   hrt.stop();
-  hrt.print();
+  printOutput("[TIMER] %s\n", hrt.report().c_str());
 
   const double ms = hrt.getMilliseconds();
-  printf("Mean runtime per frame: %lf ms\n", ms / total_num_frames);
+  printOutput("Mean runtime per frame: %lf ms\n", ms / total_num_frames);
+  printLatencyReport(track_manager, *velocity_estimates);
+  if (event_counts) {
+    summarizeEventCounts(perf_counters, precision_trackers, event_counts);
+  }
+  if (memory_usage) {
+    finishMeasuringMemory(heap_baseline, num_allocations_baseline, &trackers,
+                          &precision_trackers, memory_usage);
+  }
+
+  return ms / total_num_frames;
+}
+
+// Offline version of track: first computes the alignments of all pairs of
+// consecutive frames in parallel, without a motion prior, and then fuses
+// them with the motion model in a fast sequential pass over each track.
+// Unlike track, this keeps all cores busy even for a few long tracks.
+// If cache_dir is not empty, the alignments are loaded from / saved to an
+// on-disk cache, so runs which only change the motion model parameters do
+// not need to recompute them.  Returns the mean runtime per frame, in
+// milliseconds.  If event_counts is not NULL, also counts hardware events
+// while aligning the frames, and if memory_usage is not NULL, also measures
+// the memory used.
+double trackOffline(
+           const precision_tracking::track_manager_color::TrackManagerColor& track_manager,
+           const precision_tracking::Params& params,
+           const string& cache_dir,
+           std::vector<TrackResults>* velocity_estimates,
+           EventCounts* event_counts = NULL,
+           MemoryUsage* memory_usage = NULL) {
+  const std::vector< boost::shared_ptr<precision_tracking::track_manager_color::Track> >& tracks =
+      track_manager.tracks_;
+
+  // Index all pairs of consecutive frames.
+  int total_num_frames = 0;
+  std::vector<std::pair<int, int> > frame_pairs;
+  std::vector<int> first_pair_index(tracks.size());
+  for (size_t i = 0; i < tracks.size(); ++i) {
+    total_num_frames += tracks[i]->frames_.size();
+    first_pair_index[i] = frame_pairs.size();
+    for (size_t j = 1; j < tracks[i]->frames_.size(); ++j) {
+      frame_pairs.push_back(std::make_pair(i, j));
+    }
+  }
+
+  const int num_threads = 8;
+
+  const long num_allocations_baseline = num_heap_allocations;
+  const long heap_baseline = memory_usage ? startMeasuringMemory() : 0;
+
+  std::vector<precision_tracking::Tracker> trackers;
+  std::vector<boost::shared_ptr<precision_tracking::PrecisionTracker> >
+      precision_trackers;
+  for (int i = 0; i < num_threads; ++i) {
+    precision_tracking::Tracker tracker(&params);
+    precision_trackers.push_back(
+        boost::make_shared<precision_tracking::PrecisionTracker>(&params));
+    tracker.setPrecisionTracker(precision_trackers.back());
+    trackers.push_back(tracker);
+  }
+  std::vector<boost::shared_ptr<precision_tracking::PerfCounters> >
+      perf_counters(num_threads);
+
+  velocity_estimates->resize(tracks.size());
+
+  std::ostringstream hrt_title_stream;
+  hrt_title_stream << "Total time for tracking " << tracks.size()
+                   << " objects offline";
+  precision_tracking::HighResTimer hrt(hrt_title_stream.str(), CLOCK_REALTIME);
+  hrt.start();
+
+  boost::shared_ptr<precision_tracking::AlignmentCache> alignment_cache;
+  if (!cache_dir.empty()) {
+    alignment_cache.reset(
+          new precision_tracking::AlignmentCache(cache_dir, &params));
+  }
+  int num_cache_hits = 0;
+
+  // Align all pairs of frames in parallel.
+  std::vector<precision_tracking::ScoredTransforms<
+      precision_tracking::ScoredTransformXYZ> > alignments(frame_pairs.size());
+  std::vector<double> alignment_ms(frame_pairs.size(), 0);
+
+  #pragma omp parallel for schedule(dynamic) num_threads(num_threads) reduction(+:num_cache_hits)
+  for (size_t k = 0; k < frame_pairs.size(); ++k) {
+    precision_tracking::Tracker& tracker = trackers[omp_get_thread_num()];
+
+    const std::vector< boost::shared_ptr<precision_tracking::track_manager_color::Frame> >& frames =
+        tracks[frame_pairs[k].first]->frames_;
+    const boost::shared_ptr<precision_tracking::track_manager_color::Frame>& prev_frame =
+        frames[frame_pairs[k].second - 1];
+    const boost::shared_ptr<precision_tracking::track_manager_color::Frame>& frame =
+        frames[frame_pairs[k].second];
+
+    // The counters are read outside of the timed region, so that they do not
+    // add to the latency.
+    precision_tracking::PerfCounters* counters =
+        event_counts ? getThreadCounters(&perf_counters) : NULL;
+    if (counters) {
+      counters->start();
+    }
+    precision_tracking::HighResTimer alignment_timer("", CLOCK_MONOTONIC);
+    alignment_timer.start();
+
+    // Get the sensor resolution.
+    double sensor_horizontal_resolution;
+    double sensor_vertical_resolution;
+    precision_tracking::getSensorResolution(
+          frame->getCentroid(), &sensor_horizontal_resolution,
+          &sensor_vertical_resolution);
+
+    if (alignment_cache &&
+        alignment_cache->load(prev_frame->cloud_, frame->cloud_,
+                              sensor_horizontal_resolution,
+                              sensor_vertical_resolution, &alignments[k])) {
+      num_cache_hits++;
+      alignment_timer.stop();
+      if (counters) {
+        counters->stop();
+      }
+      alignment_ms[k] = alignment_timer.getMilliseconds();
+      continue;
+    }
+
+    tracker.alignWithoutPrior(prev_frame->cloud_, frame->cloud_,
+                              sensor_horizontal_resolution,
+                              sensor_vertical_resolution, &alignments[k]);
+
+    if (alignment_cache) {
+      alignment_cache->save(prev_frame->cloud_, frame->cloud_,
+                            sensor_horizontal_resolution,
+                            sensor_vertical_resolution, alignments[k]);
+    }
+
+    alignment_timer.stop();
+    if (counters) {
+      counters->stop();
+    }
+    alignment_ms[k] = alignment_timer.getMilliseconds();
+  }
+
+  if (alignment_cache) {
+    printOutput("Loaded %d of %zu alignments from the cache\n",
+                num_cache_hits, frame_pairs.size());
+  }
+
+  // Fuse the alignments of each track with the motion model.
+  const precision_tracking::ScoredTransforms<
+      precision_tracking::ScoredTransformXYZ> no_alignment;
+
+  #pragma omp parallel for num_threads(num_threads)
+  for (size_t i = 0; i < tracks.size(); ++i) {
+    precision_tracking::Tracker& tracker = trackers[omp_get_thread_num()];
+
+    // Reset the tracker for this new track.
+    tracker.clear();
+
+    // Extract frames.
+    const boost::shared_ptr<precision_tracking::track_manager_color::Track>& track = tracks[i];
+    const std::vector< boost::shared_ptr<precision_tracking::track_manager_color::Frame> >& frames =
+        track->frames_;
+
+    // Structure for storing estimated velocities for this track.
+    TrackResults track_estimates;
+    track_estimates.track_num = track->track_num_;
+
+    for (size_t j = 0; j < frames.size(); ++j) {
+      const boost::shared_ptr<precision_tracking::track_manager_color::Frame>& frame = frames[j];
+
+      precision_tracking::HighResTimer frame_timer("", CLOCK_MONOTONIC);
+      frame_timer.start();
+      Eigen::Vector3f estimated_velocity;
+      tracker.addAlignment(frame->cloud_, frame->timestamp_,
+                           j > 0 ? alignments[first_pair_index[i] + j - 1] :
+                                   no_alignment,
+                           &estimated_velocity);
+      frame_timer.stop();
+
+      // The latency of a frame is the time to align it to the previous
+      // frame plus the time to combine that with the motion model.
+      track_estimates.frame_ms.push_back(
+            frame_timer.getMilliseconds() +
+            (j > 0 ? alignment_ms[first_pair_index[i] + j - 1] : 0));
+
+      // The first time we see this object, we don't have a velocity yet.
+      // After the first time, save the estimated velocity.
+      if (j > 0) {
+        track_estimates.estimated_velocities.push_back(estimated_velocity);
+
+        // By default, don't ignore any frames.
+        track_estimates.ignore_frame.push_back(false);
+      }
+    }
+    (*velocity_estimates)[i] = track_estimates;
+  }
+
+  hrt.stop();
+  printOutput("[TIMER] %s\n", hrt.report().c_str());
+
+  const double ms = hrt.getMilliseconds();
+  printOutput("Mean runtime per frame: %lf ms\n", ms / total_num_frames);
+  printLatencyReport(track_manager, *velocity_estimates);
+  if (event_counts) {
+    summarizeEventCounts(perf_counters, precision_trackers, event_counts);
+  }
+  if (memory_usage) {
+    finishMeasuringMemory(heap_baseline, num_allocations_baseline, &trackers,
+                          &precision_trackers, memory_usage);
+  }
+
+  return ms / total_num_frames;
+}
+
+// Check that the tracker state can be restored from a snapshot.  The
+// state of a tracker which sees every frame is saved before each frame and
+// restored into a standby tracker, which then tracks the frame in its
+// place, and the velocities of the two trackers are compared.  Also checks
+// that truncated snapshots, and snapshots saved with different params, are
+// rejected.  The velocities of the standby tracker are returned, along
+// with the mean runtime per frame of restoring and tracking, in
+// milliseconds, and whether all of these checks passed.
+double trackRestored(
+           const precision_tracking::track_manager_color::TrackManagerColor& track_manager,
+           const precision_tracking::Params& params,
+           std::vector<TrackResults>* velocity_estimates,
+           bool* ok) {
+  const std::vector< boost::shared_ptr<precision_tracking::track_manager_color::Track> >& tracks =
+      track_manager.tracks_;
+
+  int total_num_frames = 0;
+  for (size_t i = 0; i < tracks.size(); ++i) {
+    total_num_frames += tracks[i]->frames_.size();
+  }
+
+  precision_tracking::Tracker tracker(&params);
+  tracker.setPrecisionTracker(
+      boost::make_shared<precision_tracking::PrecisionTracker>(&params));
+  precision_tracking::Tracker standby_tracker(&params);
+  standby_tracker.setPrecisionTracker(
+      boost::make_shared<precision_tracking::PrecisionTracker>(&params));
+
+  velocity_estimates->resize(tracks.size());
+
+  int num_restore_failures = 0;
+  int num_different_velocities = 0;
+  double max_velocity_diff = 0;
+  string check_snapshot;
+
+  const clockid_t clock = CLOCK_THREAD_CPUTIME_ID;
+  std::ostringstream hrt_title_stream;
+  hrt_title_stream << "Total time for restoring and tracking " << tracks.size()
+                   << " objects";
+  precision_tracking::HighResTimer hrt(hrt_title_stream.str(), clock);
+  hrt.start();
+
+  for (size_t i = 0; i < tracks.size(); ++i) {
+    tracker.clear();
+
+    const boost::shared_ptr<precision_tracking::track_manager_color::Track>& track = tracks[i];
+    const std::vector< boost::shared_ptr<precision_tracking::track_manager_color::Frame> >& frames =
+        track->frames_;
+
+    TrackResults track_estimates;
+    track_estimates.track_num = track->track_num_;
+
+    for (size_t j = 0; j < frames.size(); ++j) {
+      const boost::shared_ptr<precision_tracking::track_manager_color::Frame>& frame = frames[j];
+
+      double sensor_horizontal_resolution;
+      double sensor_vertical_resolution;
+      precision_tracking::getSensorResolution(
+            frame->getCentroid(), &sensor_horizontal_resolution,
+            &sensor_vertical_resolution);
+
+      // Save the state of the tracker before this frame.
+      std::ostringstream snapshot_stream;
+      tracker.saveState(snapshot_stream);
+      const string snapshot = snapshot_stream.str();
+      if (check_snapshot.empty() && j > 0) {
+        check_snapshot = snapshot;
+      }
+
+      // Fail over to the standby tracker, starting from an empty state.
+      precision_tracking::HighResTimer frame_timer("", clock);
+      frame_timer.start();
+      standby_tracker.clear();
+      std::istringstream restore_stream(snapshot);
+      if (!standby_tracker.loadState(restore_stream)) {
+        num_restore_failures++;
+      }
+      Eigen::Vector3f estimated_velocity;
+      standby_tracker.addPoints(frame->cloud_, frame->timestamp_,
+                                sensor_horizontal_resolution,
+                                sensor_vertical_resolution,
+                                &estimated_velocity);
+      frame_timer.stop();
+      track_estimates.frame_ms.push_back(frame_timer.getMilliseconds());
+
+      Eigen::Vector3f expected_velocity;
+      tracker.addPoints(frame->cloud_, frame->timestamp_,
+                        sensor_horizontal_resolution,
+                        sensor_vertical_resolution, &expected_velocity);
+      const double velocity_diff =
+          (estimated_velocity - expected_velocity).norm();
+      if (velocity_diff > 0) {
+        num_different_velocities++;
+        max_velocity_diff = std::max(max_velocity_diff, velocity_diff);
+      }
+
+      if (j > 0) {
+        track_estimates.estimated_velocities.push_back(estimated_velocity);
+        track_estimates.ignore_frame.push_back(false);
+      }
+    }
+    (*velocity_estimates)[i] = track_estimates;
+  }
+
+  hrt.stop();
+  printOutput("[TIMER] %s\n", hrt.report().c_str());
+
+  const double ms = hrt.getMilliseconds();
+  printOutput("Mean runtime per frame (restoring and tracking): %lf ms\n",
+              ms / total_num_frames);
+  printLatencyReport(track_manager, *velocity_estimates);
+
+  printOutput("Restored the tracker state before %d frames: %d failed to "
+              "restore, %d had a different velocity than without restoring "
+              "(max difference %g m/s)\n", total_num_frames,
+              num_restore_failures, num_different_velocities,
+              max_velocity_diff);
+  bool snapshots_ok = num_restore_failures == 0 &&
+      num_different_velocities == 0;
+
+  // A truncated snapshot must be rejected without changing the tracker, so
+  // restore the full snapshot afterwards and check that it still tracks the
+  // same way.
+  if (!check_snapshot.empty()) {
+    const size_t size = check_snapshot.size();
+    const size_t truncated_sizes[] = { 0, 5, size / 4, size / 2, size - 1 };
+    const int num_truncated =
+        sizeof(truncated_sizes) / sizeof(truncated_sizes[0]);
+    int num_rejected = 0;
+    precision_tracking::Tracker check_tracker(&params);
+    for (int k = 0; k < num_truncated; ++k) {
+      std::istringstream truncated_stream(
+            check_snapshot.substr(0, truncated_sizes[k]));
+      if (!check_tracker.loadState(truncated_stream)) {
+        num_rejected++;
+      }
+    }
+
+    // A snapshot saved with different params must be rejected.
+    precision_tracking::Params other_params = params;
+    other_params.kMotionMinProb *= 2;
+    precision_tracking::Tracker other_tracker(&other_params);
+    std::istringstream other_stream(check_snapshot);
+    const bool rejected_other_params = !other_tracker.loadState(other_stream);
+
+    printOutput("Rejected %d of %d truncated snapshots, %s the snapshot "
+                "with different params\n", num_rejected, num_truncated,
+                rejected_other_params ? "and rejected" : "but accepted");
+    snapshots_ok = snapshots_ok && num_rejected == num_truncated &&
+        rejected_other_params;
+  }
+
+  if (!snapshots_ok) {
+    printOutput("Error - the tracker state was not saved and restored "
+                "correctly\n");
+  }
+  *ok = snapshots_ok;
+
+  return ms / total_num_frames;
+}
+
+// A tracker configuration evaluated by test_tracking.
+struct TrackerConfig {
+  // Short name used to select this configuration with --configs.
+  string name;
+  string description;
+  precision_tracking::Params params;
+  bool use_precision_tracker;
+  bool track_parallel;
+  bool track_offline;
+  // Restore the tracker from a snapshot before each frame (see
+  // trackRestored).
+  bool track_restored;
+};
+
+// Runtime and accuracy of a tracker configuration.
+struct BenchmarkResult {
+  string name;
+  double ms_per_frame;
+  // Runtime of each frame, in ms.
+  std::vector<double> frame_ms;
+  double rms_error;
+  // RMS error for objects within max_distance.
+  double rms_error_nearby;
+  EventCounts event_counts;
+  MemoryUsage memory_usage;
+  // Whether the checks of this configuration passed (see trackRestored).
+  bool ok;
+};
+
+// Returns all configurations, in the order in which they are run by default.
+void getTrackerConfigs(std::vector<TrackerConfig>* configs) {
+  TrackerConfig config;
+  config.use_precision_tracker = true;
+  config.track_parallel = false;
+  config.track_offline = false;
+  config.track_restored = false;
+
+  // Testing the centroid-based Kalman filter baseline method - should be
+  // very fast but not very accurate.
+  config.name = "kalman";
+  config.description = "Tracking objects with the centroid-based Kalman filter baseline. "
+      "This method is very fast but not very accurate.";
+  config.use_precision_tracker = false;
+  configs->push_back(config);
+  config.use_precision_tracker = true;
+
+  // Testing our precision tracker - should be very accurate and quite fast.
+  config.name = "2d";
+  config.description = "Tracking objects with our precision tracker in 2D (single-threaded). "
+      "This method is accurate and fairly fast. Compared to the full 3D version, this method uses much less memory "
+      "and is much faster, but is slightly less accurate.";
+  configs->push_back(config);
+
+  // Testing our precision tracker - should be very accurate and quite fast.
+  config.name = "2d_parallel";
+  config.description = "Tracking objects with our precision tracker in 2D in parallel. "
+      "This method is accurate and fairly fast. Compared to the full 3D version, this method uses much less memory "
+      "and is much faster, but is slightly less accurate.";
+  config.track_parallel = true;
+  configs->push_back(config);
+
+  // Testing our precision tracker in offline mode - should be almost as
+  // accurate, and faster when there are few tracks.
+  config.name = "offline";
+  config.description = "Tracking objects with our precision tracker in 2D in offline mode. "
+      "All pairs of frames are aligned in parallel without a motion prior, "
+      "and are then combined with the motion model in a fast sequential pass. "
+      "This is only possible when processing logs offline.";
+  config.track_offline = true;
+  configs->push_back(config);
+  config.track_parallel = false;
+  config.track_offline = false;
+
+  // Testing that the tracker can be restored from a snapshot - should be
+  // exactly as accurate as the 2D version.
+  config.name = "restore";
+  config.description = "Tracking objects with our precision tracker in 2D, restoring the tracker "
+      "from a snapshot of its state before every frame (single-threaded). "
+      "The velocities should be identical to those of a tracker which is never restored.";
+  config.track_restored = true;
+  configs->push_back(config);
+  config.track_restored = false;
+
+  // Testing our precision tracker - should be very accurate and quite fast.
+  config.name = "3d";
+  config.description = "Tracking objects with our precision tracker in 3D (single-threaded). "
+      "This method is accurate and fairly fast. Compared to the 2D version, this method uses more memory "
+      "and is slower, but is more accurate.";
+  config.params.use3D = true;
+  configs->push_back(config);
+  config.params.use3D = false;
+
+  // Testing our precision tracker with a range image of the previous
+  // points - uses very little memory.
+  config.name = "range_image";
+  config.description = "Tracking objects with our precision tracker using a range image (single-threaded). "
+      "Each current point is compared to the range of the previous points in the direction of the point, "
+      "so this method uses much less memory than the 3D version, but can be slightly less accurate.";
+  config.params.useRangeImage = true;
+  configs->push_back(config);
+  config.params.useRangeImage = false;
+
+  // Testing our precision tracker with color - should be even more accurate
+  // but slow.
+  config.name = "color";
+  config.description = "Tracking objects with our precision tracker using color (single-threaded). "
+      "This method is a bit more accurate than the version without color but is much slower.";
+  config.params.useColor = true;
+  configs->push_back(config);
+
+  // Testing our precision tracker with color in 2D - should be almost as
+  // accurate as the version with color, and much faster.
+  config.name = "color_2d";
+  config.description = "Tracking objects with our precision tracker using color in 2D (single-threaded). "
+      "The previous points are projected onto the ground plane, so this method is much faster "
+      "than the 3D version with color.";
+  config.params.useProjectedColorField = true;
+  configs->push_back(config);
 }
 
 void trackAndEvaluate(
     const precision_tracking::track_manager_color::TrackManagerColor& track_manager,
-    const string gt_folder,
-    const precision_tracking::Params& params,
-    const bool use_precision_tracker,
-    const bool track_parallel) {
+    const string& gt_folder,
+    const TrackerConfig& config,
+    const string& cache_dir,
+    const bool count_events,
+    const bool measure_memory,
+    BenchmarkResult* result) {
+  result->name = config.name;
+  result->event_counts.available = false;
+  result->ok = true;
+
   // Track all objects and store the estimated velocities.
+  EventCounts* event_counts = count_events ? &result->event_counts : NULL;
+  MemoryUsage* memory_usage = measure_memory ? &result->memory_usage : NULL;
   std::vector<TrackResults> velocity_estimates;
-  track(track_manager, params, use_precision_tracker, track_parallel, &velocity_estimates);
+  if (config.track_offline) {
+    result->ms_per_frame = trackOffline(track_manager, config.params,
+                                        cache_dir, &velocity_estimates,
+                                        event_counts, memory_usage);
+  } else if (config.track_restored) {
+    // The events and memory are not measured, since most of the work is
+    // done twice.
+    result->ms_per_frame = trackRestored(track_manager, config.params,
+                                         &velocity_estimates, &result->ok);
+  } else {
+    result->ms_per_frame = track(track_manager, config.params,
+                                 config.use_precision_tracker,
+                                 config.track_parallel, &velocity_estimates,
+                                 event_counts, memory_usage);
+  }
+
+  if (!measure_memory || config.track_restored) {
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    result->memory_usage.peak_heap = nan;
+    result->memory_usage.heap_per_tracker = nan;
+    result->memory_usage.num_allocations = nan;
+    result->memory_usage.rss = nan;
+    result->memory_usage.peak_rss = nan;
+  }
+
+  result->frame_ms.clear();
+  for (size_t i = 0; i < velocity_estimates.size(); ++i) {
+    result->frame_ms.insert(result->frame_ms.end(),
+                            velocity_estimates[i].frame_ms.begin(),
+                            velocity_estimates[i].frame_ms.end());
+  }
 
   // Find bad frames that we want to ignore.
   find_bad_frames(track_manager, &velocity_estimates);
 
   // Evaluate the tracking accuracy.
   boost::shared_ptr<std::vector<bool> > empty_filter;
-  evaluateTracking(velocity_estimates, gt_folder, empty_filter);
+  result->rms_error = evaluateTracking(velocity_estimates, gt_folder,
+                                       empty_filter);
 
   // Evaluate the tracking accuracy for nearby objects.
   const double max_distance = 5;
-  printf("Evaluating only for objects within %lf m:\n", max_distance);
+  printOutput("Evaluating only for objects within %lf m:\n", max_distance);
   boost::shared_ptr<std::vector<bool> > filter(new std::vector<bool>);
   getWithinDistance(track_manager, max_distance, *filter);
-  evaluateTracking(velocity_estimates, gt_folder, filter);
+  result->rms_error_nearby = evaluateTracking(velocity_estimates, gt_folder,
+                                              filter);
 }
 
-void testKalman(const precision_tracking::track_manager_color::TrackManagerColor& track_manager,
-                const string gt_folder) {
-  printf("Tracking objects with the centroid-based Kalman filter baseline. "
-         "This method is very fast but not very accurate. Please wait...\n");
-  precision_tracking::Params params;
-  trackAndEvaluate(track_manager, gt_folder, params, false, false);
+// Evaluate the given configurations over the same tracks.  If concurrent is
+// true, all configurations run at the same time, which is much faster
+// overall but adds some noise to the timings of each configuration.  The
+// output of each configuration is then printed when it finishes, and the
+// memory is not measured, since the heap and RSS counters are shared by the
+// whole process.
+// If count_events is true, hardware events are also counted.
+void runConfigs(
+    const precision_tracking::track_manager_color::TrackManagerColor& track_manager,
+    const string& gt_folder,
+    const std::vector<TrackerConfig>& configs,
+    const string& cache_dir,
+    const bool concurrent,
+    const bool count_events,
+    std::vector<BenchmarkResult>* results) {
+  results->resize(configs.size());
+
+  if (!concurrent) {
+    for (size_t i = 0; i < configs.size(); ++i) {
+      printf("\n%s  Please wait...\n", configs[i].description.c_str());
+      trackAndEvaluate(track_manager, gt_folder, configs[i], cache_dir,
+                       count_events, true, &(*results)[i]);
+    }
+    return;
+  }
+
+  printf("\nRunning %zu configurations concurrently:", configs.size());
+  for (size_t i = 0; i < configs.size(); ++i) {
+    printf(" %s", configs[i].name.c_str());
+  }
+  printf(".  Please wait...\n");
+
+  // Allow the parallel configurations to start their own threads.
+  omp_set_max_active_levels(2);
+
+  // Print the output of each configuration in one piece once it finishes,
+  // so that the output of the configurations does not interleave.
+  #pragma omp parallel for schedule(dynamic) num_threads(configs.size())
+  for (size_t i = 0; i < configs.size(); ++i) {
+    string output;
+    output_buffer = &output;
+    trackAndEvaluate(track_manager, gt_folder, configs[i], cache_dir,
+                     count_events, false, &(*results)[i]);
+    output_buffer = NULL;
+
+    #pragma omp critical(print_output)
+    {
+      printf("\n%s\n%s", configs[i].description.c_str(), output.c_str());
+      fflush(stdout);
+    }
+  }
 }
 
-void testPrecisionTracker2D(
-    const precision_tracking::track_manager_color::TrackManagerColor& track_manager,
-    const string gt_folder) {
-  printf("\nTracking objects with our precision tracker in 2D (single-threaded). "
-         "This method is accurate and fairly fast. Compared to the full 3D version, this method uses much less memory "
-         "and is much faster, but is slightly less accurate.  Please wait...\n");
-  precision_tracking::Params params;
-  trackAndEvaluate(track_manager, gt_folder, params, true, false);
+// Formats an amount of memory in MB for the summary table, or n/a if it was
+// not measured.
+string formatMemory(const double bytes) {
+  if (bytes != bytes) {
+    return "n/a";
+  }
+  char text[32];
+  snprintf(text, sizeof(text), "%.2lf", bytes / (1024 * 1024));
+  return text;
 }
 
-void testPrecisionTracker2DParallel(
-    const precision_tracking::track_manager_color::TrackManagerColor& track_manager,
-    const string gt_folder) {
-  printf("\nTracking objects with our precision tracker in 2D in parallel. "
-         "This method is accurate and fairly fast. Compared to the full 3D version, this method uses much less memory "
-         "and is much faster, but is slightly less accurate.  Please wait...\n");
-  precision_tracking::Params params;
-  trackAndEvaluate(track_manager, gt_folder, params, true, true);
+// Print a table of the runtime and accuracy of each configuration.
+void printSummary(const std::vector<BenchmarkResult>& results) {
+  printf("\nSummary (latencies in ms per frame, errors in m/s, "
+         "memory in MB):\n");
+  printf("%-12s %10s %10s %10s %10s %10s %10s %10s %10s %10s\n", "config",
+         "mean", "p50", "p90", "p99", "max", "RMS", "RMS near", "peak heap",
+         "per trkr");
+  for (size_t i = 0; i < results.size(); ++i) {
+    const BenchmarkResult& result = results[i];
+    printf("%-12s %10.3lf %10.3lf %10.3lf %10.3lf %10.3lf %10.4lf %10.4lf "
+           "%10s %10s\n",
+           result.name.c_str(), result.ms_per_frame,
+           computePercentile(result.frame_ms, 50),
+           computePercentile(result.frame_ms, 90),
+           computePercentile(result.frame_ms, 99),
+           computePercentile(result.frame_ms, 100),
+           result.rms_error, result.rms_error_nearby,
+           formatMemory(result.memory_usage.peak_heap).c_str(),
+           formatMemory(result.memory_usage.heap_per_tracker).c_str());
+  }
 }
 
-void testPrecisionTracker3D(
-    const precision_tracking::track_manager_color::TrackManagerColor& track_manager,
-    const string gt_folder) {
-  printf("\nTracking objects with our precision tracker in 3D (single-threaded). "
-         "This method is accurate and fairly fast. Compared to the 2D version, this method uses more memory "
-         "and is slower, but is more accurate.  Please wait...\n");
+// Writes a number to a JSON file, using null for NaN and infinity.
+void writeJsonNumber(FILE* fid, const double value) {
+  if (value == value && fabs(value) <= std::numeric_limits<double>::max()) {
+    fprintf(fid, "%.9g", value);
+  } else {
+    fprintf(fid, "null");
+  }
+}
+
+// Names of the hardware counter metrics computed by getEventMetrics.
+const char* event_metric_names[] = {
+  "ipc", "llc_misses_per_point", "branch_misses_per_point" };
+const int num_event_metrics =
+    sizeof(event_metric_names) / sizeof(event_metric_names[0]);
+
+// Computes the IPC and the LLC and branch misses per scored point, or NaN
+// for the metrics which could not be counted.
+void getEventMetrics(const EventCounts& event_counts, double* metrics) {
+  const double nan = std::numeric_limits<double>::quiet_NaN();
+  for (int k = 0; k < num_event_metrics; ++k) {
+    metrics[k] = nan;
+  }
+  if (!event_counts.available) {
+    return;
+  }
+  const double* counts = event_counts.counts;
+  if (counts[precision_tracking::PerfCounters::kCycles] > 0) {
+    metrics[0] = event_counts.ipc;
+  }
+  if (event_counts.num_scored_points > 0) {
+    metrics[1] = counts[precision_tracking::PerfCounters::kLLCMisses] /
+        event_counts.num_scored_points;
+    metrics[2] = counts[precision_tracking::PerfCounters::kBranchMisses] /
+        event_counts.num_scored_points;
+  }
+}
+
+// Names of the memory metrics computed by getMemoryMetrics.
+const char* memory_metric_names[] = {
+  "peak_heap_mb", "heap_per_tracker_mb", "num_allocations", "rss_mb",
+  "peak_rss_mb" };
+const int num_memory_metrics =
+    sizeof(memory_metric_names) / sizeof(memory_metric_names[0]);
+
+void getMemoryMetrics(const MemoryUsage& memory_usage, double* metrics) {
+  const double mb = 1024 * 1024;
+  metrics[0] = memory_usage.peak_heap / mb;
+  metrics[1] = memory_usage.heap_per_tracker / mb;
+  metrics[2] = memory_usage.num_allocations;
+  metrics[3] = memory_usage.rss / mb;
+  metrics[4] = memory_usage.peak_rss / mb;
+}
+
+// Save the runtime and accuracy of each configuration as JSON if the
+// filename ends in .json, or as CSV otherwise.
+void writeSummary(const string& filename,
+                  const std::vector<BenchmarkResult>& results) {
+  FILE* fid = fopen(filename.c_str(), "w");
+  if (fid == NULL) {
+    printf("Cannot open file: %s\n", filename.c_str());
+    exit(1);
+  }
+
+  const double percentiles[] = { 50, 90, 99, 100 };
+  const char* percentile_names[] = { "p50", "p90", "p99", "max" };
+  const int num_percentiles = sizeof(percentiles) / sizeof(percentiles[0]);
+
+  const bool json = filename.size() >= 5 &&
+      filename.compare(filename.size() - 5, 5, ".json") == 0;
+  if (json) {
+    fprintf(fid, "[\n");
+    for (size_t i = 0; i < results.size(); ++i) {
+      const BenchmarkResult& result = results[i];
+      fprintf(fid, "  {\"config\": \"%s\", \"num_frames\": %zu, "
+              "\"ms_per_frame\": ", result.name.c_str(),
+              result.frame_ms.size());
+      writeJsonNumber(fid, result.ms_per_frame);
+      fprintf(fid, ", \"latency_ms\": {");
+      for (int k = 0; k < num_percentiles; ++k) {
+        fprintf(fid, "%s\"%s\": ", k > 0 ? ", " : "", percentile_names[k]);
+        writeJsonNumber(fid, computePercentile(result.frame_ms,
+                                               percentiles[k]));
+      }
+      fprintf(fid, "}, \"rms_error\": ");
+      writeJsonNumber(fid, result.rms_error);
+      fprintf(fid, ", \"rms_error_nearby\": ");
+      writeJsonNumber(fid, result.rms_error_nearby);
+      double metrics[num_event_metrics];
+      getEventMetrics(result.event_counts, metrics);
+      for (int k = 0; k < num_event_metrics; ++k) {
+        fprintf(fid, ", \"%s\": ", event_metric_names[k]);
+        writeJsonNumber(fid, metrics[k]);
+      }
+      double memory_metrics[num_memory_metrics];
+      getMemoryMetrics(result.memory_usage, memory_metrics);
+      for (int k = 0; k < num_memory_metrics; ++k) {
+        fprintf(fid, ", \"%s\": ", memory_metric_names[k]);
+        writeJsonNumber(fid, memory_metrics[k]);
+      }
+      fprintf(fid, "}%s\n", i + 1 < results.size() ? "," : "");
+    }
+    fprintf(fid, "]\n");
+  } else {
+    fprintf(fid, "config,num_frames,ms_per_frame");
+    for (int k = 0; k < num_percentiles; ++k) {
+      fprintf(fid, ",%s_ms", percentile_names[k]);
+    }
+    fprintf(fid, ",rms_error,rms_error_nearby");
+    for (int k = 0; k < num_event_metrics; ++k) {
+      fprintf(fid, ",%s", event_metric_names[k]);
+    }
+    for (int k = 0; k < num_memory_metrics; ++k) {
+      fprintf(fid, ",%s", memory_metric_names[k]);
+    }
+    fprintf(fid, "\n");
+    for (size_t i = 0; i < results.size(); ++i) {
+      const BenchmarkResult& result = results[i];
+      fprintf(fid, "%s,%zu,%g", result.name.c_str(), result.frame_ms.size(),
+              result.ms_per_frame);
+      for (int k = 0; k < num_percentiles; ++k) {
+        fprintf(fid, ",%g", computePercentile(result.frame_ms,
+                                              percentiles[k]));
+      }
+      fprintf(fid, ",%g,%g", result.rms_error, result.rms_error_nearby);
+      double metrics[num_event_metrics];
+      getEventMetrics(result.event_counts, metrics);
+      for (int k = 0; k < num_event_metrics; ++k) {
+        // Leave the metrics which could not be counted empty.
+        if (metrics[k] == metrics[k]) {
+          fprintf(fid, ",%g", metrics[k]);
+        } else {
+          fprintf(fid, ",");
+        }
+      }
+      double memory_metrics[num_memory_metrics];
+      getMemoryMetrics(result.memory_usage, memory_metrics);
+      for (int k = 0; k < num_memory_metrics; ++k) {
+        // Leave the memory which was not measured empty.
+        if (memory_metrics[k] == memory_metrics[k]) {
+          fprintf(fid, ",%g", memory_metrics[k]);
+        } else {
+          fprintf(fid, ",");
+        }
+      }
+      fprintf(fid, "\n");
+    }
+  }
+
+  fclose(fid);
+  printf("Saved summary to %s\n", filename.c_str());
+}
+
+// A configuration evaluated by the parameter tuner.
+struct TuningResult {
   precision_tracking::Params params;
-  params.use3D = true;
-  trackAndEvaluate(track_manager, gt_folder, params, true, false);
+  double ms_per_frame;
+  double rms_error;
+  bool pareto_optimal;
+};
+
+// Track all objects with the given parameters (single-threaded) and return
+// the mean runtime per frame and the RMS error.
+void evaluateParams(
+    const precision_tracking::track_manager_color::TrackManagerColor& track_manager,
+    const string& gt_folder,
+    const precision_tracking::Params& params,
+    double* ms_per_frame,
+    double* rms_error) {
+  std::vector<TrackResults> velocity_estimates;
+  *ms_per_frame = track(track_manager, params, true, false, &velocity_estimates);
+  find_bad_frames(track_manager, &velocity_estimates);
+  boost::shared_ptr<std::vector<bool> > empty_filter;
+  *rms_error = evaluateTracking(velocity_estimates, gt_folder, empty_filter);
+}
+
+// Sample configurations to evaluate from a grid over the parameters which
+// most affect the speed / accuracy tradeoff.  The default configuration
+// is always evaluated first.
+void sampleTuningConfigs(const int num_samples,
+                         std::vector<precision_tracking::Params>* configs) {
+  const int curr_downsample[] = { 50, 100, 150, 250, 400 };
+  const int prev_downsample[] = { 500, 1000, 2000, 4000 };
+  const double initial_resolution[] = { 0.5, 1, 2 };
+  const double min_prob[] = { 1e-5, 1e-4, 1e-3, 1e-2 };
+  const double reduction_factor[] = { 2, 3, 4 };
+
+  const int num_curr = sizeof(curr_downsample) / sizeof(curr_downsample[0]);
+  const int num_prev = sizeof(prev_downsample) / sizeof(prev_downsample[0]);
+  const int num_res = sizeof(initial_resolution) / sizeof(initial_resolution[0]);
+  const int num_prob = sizeof(min_prob) / sizeof(min_prob[0]);
+  const int num_reduction = sizeof(reduction_factor) / sizeof(reduction_factor[0]);
+  const int grid_size = num_curr * num_prev * num_res * num_prob * num_reduction;
+
+  // Visit the grid in a random (but repeatable) order.
+  std::vector<int> order(grid_size);
+  for (int i = 0; i < grid_size; ++i) {
+    order[i] = i;
+  }
+  srand(0);
+  for (int i = grid_size - 1; i > 0; --i) {
+    std::swap(order[i], order[rand() % (i + 1)]);
+  }
+
+  const precision_tracking::Params default_params;
+  configs->push_back(default_params);
+
+  for (int i = 0; i < grid_size &&
+       static_cast<int>(configs->size()) < num_samples; ++i) {
+    int index = order[i];
+    precision_tracking::Params params;
+    params.kCurrFrameDownsample = curr_downsample[index % num_curr];
+    index /= num_curr;
+    params.kPrevFrameDownsample = prev_downsample[index % num_prev];
+    index /= num_prev;
+    params.kInitialXYSamplingResolution = initial_resolution[index % num_res];
+    index /= num_res;
+    params.kMinProb = min_prob[index % num_prob];
+    index /= num_prob;
+    params.kReductionFactor = reduction_factor[index % num_reduction];
+
+    // Skip the default configuration, which we already added.
+    if (params.kCurrFrameDownsample == default_params.kCurrFrameDownsample &&
+        params.kPrevFrameDownsample == default_params.kPrevFrameDownsample &&
+        params.kInitialXYSamplingResolution ==
+          default_params.kInitialXYSamplingResolution &&
+        params.kMinProb == default_params.kMinProb &&
+        params.kReductionFactor == default_params.kReductionFactor) {
+      continue;
+    }
+
+    configs->push_back(params);
+  }
+}
+
+// Returns the number of threads in this process, or 1 if it cannot be
+// determined.
+int getNumProcessThreads() {
+  DIR* dir = opendir("/proc/self/task");
+  if (dir == NULL) {
+    return 1;
+  }
+  int num_threads = 0;
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != NULL) {
+    if (entry->d_name[0] != '.') {
+      ++num_threads;
+    }
+  }
+  closedir(dir);
+  return std::max(num_threads, 1);
 }
 
-void testPrecisionTrackerColor(
+// Start a worker process.  Only the calling thread is copied into the
+// worker, so if the process had already started other threads (such as
+// the OpenMP thread pool, which stays alive after a parallel region), a
+// worker could deadlock on a lock held by one of them, or when it enters
+// a parallel region.  The worker processes must therefore be started
+// before any parallel tracking, and this exits with an error otherwise.
+pid_t forkWorker() {
+  const int num_threads = getNumProcessThreads();
+  if (num_threads > 1) {
+    printf("Error - cannot start a worker process after starting %d "
+           "threads\n", num_threads);
+    exit(1);
+  }
+  return fork();
+}
+
+// Search over the tracker parameters using num_workers worker processes,
+// and print the Pareto frontier of runtime per frame vs RMS error.
+// Each worker evaluates its configurations single-threaded and the runtime
+// is measured in CPU time, so that the workers do not skew each other's
+// timings too much.  If output_file is not empty, all results are also
+// saved to it as CSV.  Must be called before any parallel tracking (see
+// forkWorker).
+void tune(
     const precision_tracking::track_manager_color::TrackManagerColor& track_manager,
-    const string gt_folder) {
-  printf("\nTracking objects with our precision tracker using color (single-threaded). "
-         "This method is a bit more accurate than the version without color but is much slower. Please wait (will be slow)...\n");
+    const string& gt_folder,
+    const int num_workers,
+    const int num_samples,
+    const string& output_file) {
+  std::vector<precision_tracking::Params> configs;
+  sampleTuningConfigs(num_samples, &configs);
+  const int num_configs = configs.size();
+
+  printf("Evaluating %d configurations with %d worker processes. "
+         "Please wait...\n", num_configs, num_workers);
+  fflush(stdout);
+
+  // Start the workers.  Each worker evaluates every num_workers'th
+  // configuration and writes the results to a pipe.
+  std::vector<int> result_pipes;
+  std::vector<pid_t> worker_pids;
+  for (int w = 0; w < num_workers; ++w) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+      printf("Error - cannot create pipe\n");
+      exit(1);
+    }
+
+    const pid_t pid = forkWorker();
+    if (pid < 0) {
+      printf("Error - cannot start worker process\n");
+      exit(1);
+    } else if (pid == 0) {
+      // Worker process: silence the per-configuration output.
+      close(fds[0]);
+      if (freopen("/dev/null", "w", stdout) == NULL) {
+        _exit(1);
+      }
+      FILE* results = fdopen(fds[1], "w");
+      for (int k = w; k < num_configs; k += num_workers) {
+        double ms_per_frame;
+        double rms_error;
+        evaluateParams(track_manager, gt_folder, configs[k],
+                       &ms_per_frame, &rms_error);
+        fprintf(results, "%d %.17g %.17g\n", k, ms_per_frame, rms_error);
+        fflush(results);
+      }
+      fclose(results);
+      _exit(0);
+    }
+
+    close(fds[1]);
+    result_pipes.push_back(fds[0]);
+    worker_pids.push_back(pid);
+  }
+
+  // Collect the results.
+  std::vector<TuningResult> results(num_configs);
+  std::vector<bool> evaluated(num_configs, false);
+  for (int w = 0; w < num_workers; ++w) {
+    FILE* worker_results = fdopen(result_pipes[w], "r");
+    int k;
+    double ms_per_frame;
+    double rms_error;
+    while (fscanf(worker_results, "%d %lf %lf\n", &k, &ms_per_frame,
+                  &rms_error) == 3) {
+      if (k < 0 || k >= num_configs) {
+        continue;
+      }
+      results[k].params = configs[k];
+      results[k].ms_per_frame = ms_per_frame;
+      results[k].rms_error = rms_error;
+      results[k].pareto_optimal = false;
+      evaluated[k] = true;
+    }
+    fclose(worker_results);
+    waitpid(worker_pids[w], NULL, 0);
+  }
+
+  std::vector<TuningResult> completed;
+  for (int k = 0; k < num_configs; ++k) {
+    if (evaluated[k]) {
+      completed.push_back(results[k]);
+    } else {
+      printf("Warning - configuration %d was not evaluated\n", k);
+    }
+  }
+
+  // Find the Pareto frontier: sorted by runtime, a configuration is Pareto
+  // optimal if it is more accurate than every faster configuration.
+  std::vector<std::pair<double, int> > by_runtime;
+  for (size_t i = 0; i < completed.size(); ++i) {
+    by_runtime.push_back(std::make_pair(completed[i].ms_per_frame, i));
+  }
+  std::sort(by_runtime.begin(), by_runtime.end());
+
+  double best_rms_error = std::numeric_limits<double>::max();
+  for (size_t i = 0; i < by_runtime.size(); ++i) {
+    TuningResult& result = completed[by_runtime[i].second];
+    if (result.rms_error < best_rms_error) {
+      result.pareto_optimal = true;
+      best_rms_error = result.rms_error;
+    }
+  }
+
+  printf("\nPareto frontier (ms/frame vs RMS error):\n");
+  printf("%10s %10s %8s %8s %8s %8s %8s\n", "ms/frame", "RMS (m/s)",
+         "curr", "prev", "init_res", "min_prob", "reduce");
+  for (size_t i = 0; i < by_runtime.size(); ++i) {
+    const TuningResult& result = completed[by_runtime[i].second];
+    if (!result.pareto_optimal) {
+      continue;
+    }
+    const precision_tracking::Params& params = result.params;
+    printf("%10.3lf %10.4lf %8d %8d %8g %8g %8g\n",
+           result.ms_per_frame, result.rms_error,
+           params.kCurrFrameDownsample, params.kPrevFrameDownsample,
+           params.kInitialXYSamplingResolution, params.kMinProb,
+           params.kReductionFactor);
+  }
+
+  if (!output_file.empty()) {
+    FILE* fid = fopen(output_file.c_str(), "w");
+    if (fid == NULL) {
+      printf("Cannot open file: %s\n", output_file.c_str());
+      exit(1);
+    }
+    fprintf(fid, "ms_per_frame,rms_error,pareto_optimal,kCurrFrameDownsample,"
+            "kPrevFrameDownsample,kInitialXYSamplingResolution,kMinProb,"
+            "kReductionFactor\n");
+    for (size_t i = 0; i < by_runtime.size(); ++i) {
+      const TuningResult& result = completed[by_runtime[i].second];
+      const precision_tracking::Params& params = result.params;
+      fprintf(fid, "%g,%g,%d,%d,%d,%g,%g,%g\n",
+              result.ms_per_frame, result.rms_error, result.pareto_optimal,
+              params.kCurrFrameDownsample, params.kPrevFrameDownsample,
+              params.kInitialXYSamplingResolution, params.kMinProb,
+              params.kReductionFactor);
+    }
+    fclose(fid);
+    printf("Saved all results to %s\n", output_file.c_str());
+  }
+}
+
+// Returns the filename for the velocity estimates of shard k of num_shards.
+string getShardFilename(const string& shard_dir, const int k,
+                        const int num_shards) {
+  std::ostringstream filename_stream;
+  filename_stream << shard_dir << "/shard_" << k << "_of_" << num_shards
+                  << ".txt";
+  return filename_stream.str();
+}
+
+// Atomically move a finished file into place, so that a worker on another
+// machine never sees a partially written file.
+void renameOrDie(const string& tmp_filename, const string& filename) {
+  if (rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+    printf("Cannot rename %s to %s\n", tmp_filename.c_str(), filename.c_str());
+    exit(1);
+  }
+}
+
+// Creates a unique temporary file next to filename and returns its name.
+string makeTempFilename(const string& filename) {
+  std::vector<char> tmp_filename(filename.begin(), filename.end());
+  const string suffix = ".tmp.XXXXXX";
+  tmp_filename.insert(tmp_filename.end(), suffix.begin(), suffix.end());
+  tmp_filename.push_back('\0');
+  const int fd = mkstemp(&tmp_filename[0]);
+  if (fd < 0) {
+    printf("Cannot create temporary file for %s\n", filename.c_str());
+    exit(1);
+  }
+  close(fd);
+  return string(&tmp_filename[0]);
+}
+
+// Load the offsets of each track in the tm file from shard_dir, or compute
+// them (without deserializing any point clouds) and save them there.  The
+// index is recomputed if it was saved for a different tm file, or for an
+// older version of it.
+void getTrackIndex(const string& tm_file, const string& shard_dir,
+                   std::vector<std::streamoff>* track_offsets) {
+  // Get the version of the tm file before indexing it, so that a change
+  // while indexing is detected by the next run.
+  string tm_file_stamp;
+  if (!precision_tracking::track_manager_color::getFileStamp(
+        tm_file, &tm_file_stamp)) {
+    printf("Cannot open file: %s\n", tm_file.c_str());
+    exit(1);
+  }
+
+  const string index_filename = shard_dir + "/tracks.index";
+  if (precision_tracking::track_manager_color::loadTrackIndex(
+        index_filename, tm_file_stamp, track_offsets)) {
+    return;
+  }
+
+  printf("Indexing file: %s\n", tm_file.c_str());
+  std::ifstream ifs(tm_file.c_str(), std::ios::in | std::ios::binary);
+  if (!ifs.is_open() ||
+      !precision_tracking::track_manager_color::indexTracks(ifs,
+                                                            track_offsets)) {
+    printf("Cannot index file: %s\n", tm_file.c_str());
+    exit(1);
+  }
+
+  const string tmp_filename = makeTempFilename(index_filename);
+  if (!precision_tracking::track_manager_color::saveTrackIndex(
+        tmp_filename, tm_file_stamp, *track_offsets)) {
+    printf("Cannot write file: %s\n", tmp_filename.c_str());
+    exit(1);
+  }
+  renameOrDie(tmp_filename, index_filename);
+}
+
+// Track the objects in shard k of num_shards, i.e. a contiguous range of
+// roughly 1 / num_shards of the tracks in the tm file, and save the
+// estimated velocities to shard_dir.  Shards are independent, so they can
+// be run by separate processes on any machines that share shard_dir.
+void runShard(const string& tm_file, const string& shard_dir,
+              const int k, const int num_shards, const bool do_parallel) {
+  std::vector<std::streamoff> track_offsets;
+  getTrackIndex(tm_file, shard_dir, &track_offsets);
+
+  const size_t num_tracks = track_offsets.size();
+  const size_t begin = num_tracks * k / num_shards;
+  const size_t end = num_tracks * (k + 1) / num_shards;
+
+  printf("Shard %d of %d: loading tracks %zu to %zu of %zu\n", k, num_shards,
+         begin, end, num_tracks);
+  std::ifstream ifs(tm_file.c_str(), std::ios::in | std::ios::binary);
+  precision_tracking::track_manager_color::TrackManagerColor track_manager;
+  if (!ifs.is_open() ||
+      !track_manager.deserialize(ifs, track_offsets, begin, end)) {
+    printf("Cannot load tracks from file: %s\n", tm_file.c_str());
+    exit(1);
+  }
+
   precision_tracking::Params params;
-  params.useColor = true;
-  trackAndEvaluate(track_manager, gt_folder, params, true, false);
+  std::vector<TrackResults> velocity_estimates;
+  track(track_manager, params, true, do_parallel, &velocity_estimates);
+  find_bad_frames(track_manager, &velocity_estimates);
+
+  // Save the velocity estimates, along with the distance to each object so
+  // that the merge step can apply the same filters as evaluateTracking.
+  const string filename = getShardFilename(shard_dir, k, num_shards);
+  const string tmp_filename = makeTempFilename(filename);
+  FILE* fid = fopen(tmp_filename.c_str(), "w");
+  if (fid == NULL) {
+    printf("Cannot open file: %s\n", tmp_filename.c_str());
+    exit(1);
+  }
+  fprintf(fid, "%zu\n", velocity_estimates.size());
+  for (size_t i = 0; i < velocity_estimates.size(); ++i) {
+    const TrackResults& track_results = velocity_estimates[i];
+    const std::vector< boost::shared_ptr<precision_tracking::track_manager_color::Frame> >& frames =
+        track_manager.tracks_[i]->frames_;
+    fprintf(fid, "%d %zu\n", track_results.track_num,
+            track_results.estimated_velocities.size());
+    for (size_t j = 0; j < track_results.estimated_velocities.size(); ++j) {
+      const Eigen::Vector3f& velocity = track_results.estimated_velocities[j];
+      const Eigen::Vector3f centroid = frames[j + 1]->getCentroid();
+      const double distance = sqrt(pow(centroid(0), 2) + pow(centroid(1), 2));
+      fprintf(fid, "%.9g %.9g %.9g %d %.9g\n", velocity(0), velocity(1),
+              velocity(2), static_cast<int>(track_results.ignore_frame[j]),
+              distance);
+    }
+  }
+  if (fclose(fid) != 0) {
+    printf("Cannot write file: %s\n", tmp_filename.c_str());
+    exit(1);
+  }
+  renameOrDie(tmp_filename, filename);
+  printf("Saved shard %d of %d to %s\n", k, num_shards, filename.c_str());
+}
+
+// Merge the velocity estimates of all shards in shard_dir and evaluate them.
+void mergeShards(const string& shard_dir, const string& gt_folder) {
+  // Find the shard files.
+  DIR* dir = opendir(shard_dir.c_str());
+  if (dir == NULL) {
+    printf("Cannot open folder: %s\n", shard_dir.c_str());
+    exit(1);
+  }
+  int num_shards = 0;
+  std::vector<bool> found;
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != NULL) {
+    int k;
+    int n;
+    char ext[8];
+    if (sscanf(entry->d_name, "shard_%d_of_%d.%7s", &k, &n, ext) != 3 ||
+        string(ext) != "txt" || n <= 0 || k < 0 || k >= n) {
+      continue;
+    }
+    if (num_shards != 0 && n != num_shards) {
+      printf("Error - %s contains shards from different runs\n",
+             shard_dir.c_str());
+      exit(1);
+    }
+    num_shards = n;
+    found.resize(n, false);
+    found[k] = true;
+  }
+  closedir(dir);
+
+  if (num_shards == 0) {
+    printf("Error - no shards found in %s\n", shard_dir.c_str());
+    exit(1);
+  }
+  for (int k = 0; k < num_shards; ++k) {
+    if (!found[k]) {
+      printf("Error - missing shard %d of %d in %s\n", k, num_shards,
+             shard_dir.c_str());
+      exit(1);
+    }
+  }
+
+  // Load the velocity estimates in the order of the tracks in the tm file.
+  const double max_distance = 5;
+  std::vector<TrackResults> velocity_estimates;
+  boost::shared_ptr<std::vector<bool> > filter(new std::vector<bool>);
+  for (int k = 0; k < num_shards; ++k) {
+    const string filename = getShardFilename(shard_dir, k, num_shards);
+    FILE* fid = fopen(filename.c_str(), "r");
+    if (fid == NULL) {
+      printf("Cannot open file: %s\n", filename.c_str());
+      exit(1);
+    }
+    size_t num_tracks;
+    if (fscanf(fid, "%zu\n", &num_tracks) != 1) {
+      printf("Cannot read file: %s\n", filename.c_str());
+      exit(1);
+    }
+    for (size_t i = 0; i < num_tracks; ++i) {
+      TrackResults track_results;
+      size_t num_estimates;
+      if (fscanf(fid, "%d %zu\n", &track_results.track_num,
+                 &num_estimates) != 2) {
+        printf("Cannot read file: %s\n", filename.c_str());
+        exit(1);
+      }
+      for (size_t j = 0; j < num_estimates; ++j) {
+        Eigen::Vector3f velocity;
+        int ignore;
+        double distance;
+        if (fscanf(fid, "%f %f %f %d %lf\n", &velocity(0), &velocity(1),
+                   &velocity(2), &ignore, &distance) != 5) {
+          printf("Cannot read file: %s\n", filename.c_str());
+          exit(1);
+        }
+        track_results.estimated_velocities.push_back(velocity);
+        track_results.ignore_frame.push_back(ignore != 0);
+        filter->push_back(distance <= max_distance);
+      }
+      velocity_estimates.push_back(track_results);
+    }
+    fclose(fid);
+  }
+
+  printf("Merged %zu tracks from %d shards\n", velocity_estimates.size(),
+         num_shards);
+
+  // Evaluate the tracking accuracy.
+  boost::shared_ptr<std::vector<bool> > empty_filter;
+  evaluateTracking(velocity_estimates, gt_folder, empty_filter);
+
+  // Evaluate the tracking accuracy for nearby objects.
+  printf("Evaluating only for objects within %lf m:\n", max_distance);
+  evaluateTracking(velocity_estimates, gt_folder, filter);
+}
+
+// Run all num_shards shards in local worker processes, one per shard, and
+// then merge the results.  Must be called before any parallel tracking (see
+// forkWorker).
+void runShards(const string& tm_file, const string& shard_dir,
+               const string& gt_folder, const int num_shards) {
+  // Build the index once up front, rather than in every worker.
+  std::vector<std::streamoff> track_offsets;
+  getTrackIndex(tm_file, shard_dir, &track_offsets);
+
+  printf("Tracking %zu objects with %d worker processes. Please wait...\n",
+         track_offsets.size(), num_shards);
+  fflush(stdout);
+
+  std::vector<pid_t> worker_pids;
+  for (int k = 0; k < num_shards; ++k) {
+    const pid_t pid = forkWorker();
+    if (pid < 0) {
+      printf("Error - cannot start worker process\n");
+      exit(1);
+    } else if (pid == 0) {
+      runShard(tm_file, shard_dir, k, num_shards, false);
+      fflush(stdout);
+      _exit(0);
+    }
+    worker_pids.push_back(pid);
+  }
+
+  bool failed = false;
+  for (int k = 0; k < num_shards; ++k) {
+    int status;
+    waitpid(worker_pids[k], &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      printf("Error - shard %d of %d failed\n", k, num_shards);
+      failed = true;
+    }
+  }
+  if (failed) {
+    exit(1);
+  }
+
+  mergeShards(shard_dir, gt_folder);
 }
 
 int main(int argc, char **argv)
 {
   if (argc < 3) {
-    printf("Usage: %s tm_file gt_folder\n", argv[0]);
+    printf("Usage: %s tm_file gt_folder [options]\n", argv[0]);
+    printf("  --cache_dir dir: cache the offline alignments in this folder\n");
+    printf("  --tune num_workers: search for the Pareto frontier of speed vs "
+           "accuracy over the tracker parameters\n");
+    printf("  --tune_samples n: number of configurations to evaluate when "
+           "tuning (default 32)\n");
+    printf("  --tune_output file: save all tuning results to this CSV file\n");
+    printf("  --shard k/N --shard_dir dir: track only shard k of N of the "
+           "tracks and save the velocity estimates to dir\n");
+    printf("  --shards N --shard_dir dir: track all N shards in local worker "
+           "processes and merge the results\n");
+    printf("  --merge dir: merge and evaluate the shards saved in dir\n");
+    printf("  --configs list: comma-separated configurations to evaluate "
+           "(default: all of kalman,2d,2d_parallel,offline,restore,3d,range_image,color,color_2d)\n");
+    printf("  --concurrent: evaluate the configurations at the same time\n");
+    printf("  --summary file: save the runtime and accuracy of each "
+           "configuration as JSON (if file ends in .json) or CSV\n");
+    printf("  --perf_counters: count cycles, instructions, cache misses and "
+           "branch misses while tracking, if supported\n");
     return (1);
   }
 
   string color_tm_file = argv[1];
   string gt_folder = argv[2];
 
+  // Parse the optional arguments.
+  string cache_dir;
+  int tune_workers = 0;
+  int tune_samples = 32;
+  string tune_output;
+  int shard = -1;
+  int num_shards = 0;
+  string shard_dir;
+  string merge_dir;
+  string config_names;
+  bool concurrent = false;
+  string summary_file;
+  bool count_events = false;
+  for (int i = 3; i < argc; ++i) {
+    const string arg = argv[i];
+    if (arg == "--cache_dir" && i + 1 < argc) {
+      cache_dir = argv[++i];
+    } else if (arg == "--tune" && i + 1 < argc) {
+      tune_workers = atoi(argv[++i]);
+    } else if (arg == "--tune_samples" && i + 1 < argc) {
+      tune_samples = atoi(argv[++i]);
+    } else if (arg == "--tune_output" && i + 1 < argc) {
+      tune_output = argv[++i];
+    } else if (arg == "--shard" && i + 1 < argc) {
+      if (sscanf(argv[++i], "%d/%d", &shard, &num_shards) != 2 ||
+          num_shards <= 0 || shard < 0 || shard >= num_shards) {
+        printf("Invalid shard: %s\n", argv[i]);
+        return (1);
+      }
+    } else if (arg == "--shards" && i + 1 < argc) {
+      num_shards = atoi(argv[++i]);
+    } else if (arg == "--shard_dir" && i + 1 < argc) {
+      shard_dir = argv[++i];
+    } else if (arg == "--merge" && i + 1 < argc) {
+      merge_dir = argv[++i];
+    } else if (arg == "--configs" && i + 1 < argc) {
+      config_names = argv[++i];
+    } else if (arg == "--concurrent") {
+      concurrent = true;
+    } else if (arg == "--summary" && i + 1 < argc) {
+      summary_file = argv[++i];
+    } else if (arg == "--perf_counters") {
+      count_events = true;
+    } else {
+      printf("Unknown argument: %s\n", arg.c_str());
+      return (1);
+    }
+  }
+
+  // Select the configurations to evaluate.
+  std::vector<TrackerConfig> all_configs;
+  getTrackerConfigs(&all_configs);
+  std::vector<TrackerConfig> configs;
+  if (config_names.empty()) {
+    configs = all_configs;
+  } else {
+    std::istringstream config_names_stream(config_names);
+    string name;
+    while (getline(config_names_stream, name, ',')) {
+      size_t k = 0;
+      while (k < all_configs.size() && all_configs[k].name != name) {
+        ++k;
+      }
+      if (k == all_configs.size()) {
+        printf("Unknown configuration: %s\n", name.c_str());
+        return (1);
+      }
+      configs.push_back(all_configs[k]);
+    }
+  }
+
+  if (!merge_dir.empty()) {
+    mergeShards(merge_dir, gt_folder);
+    return 0;
+  }
+
+  // Sharding and tuning start worker processes, so they must run before
+  // any parallel tracking (see forkWorker).
+  if (num_shards > 0) {
+    if (shard_dir.empty()) {
+      printf("Error - sharding requires --shard_dir\n");
+      return (1);
+    }
+    if (shard >= 0) {
+      runShard(color_tm_file, shard_dir, shard, num_shards, true);
+    } else {
+      runShards(color_tm_file, shard_dir, gt_folder, num_shards);
+    }
+    return 0;
+  }
+
   // Load tracks.
   printf("Loading file: %s\n", color_tm_file.c_str());
   precision_tracking::track_manager_color::TrackManagerColor track_manager(color_tm_file);
   printf("Found %zu tracks\n", track_manager.tracks_.size());
 
-  // Track objects and evaluate the accuracy.
-  printf("Tracking objects - please wait...\n\n");
-
-  // Testing the centroid-based Kalman filter baseline method - should be
-  // very fast but not very accurate.
-  testKalman(track_manager, gt_folder);
-
-  // Testing our precision tracker - should be very accurate and quite fast.
-  testPrecisionTracker2D(track_manager, gt_folder);
-
-  // Testing our precision tracker - should be very accurate and quite fast.
-  testPrecisionTracker2DParallel(track_manager, gt_folder);
+  if (tune_workers > 0) {
+    tune(track_manager, gt_folder, tune_workers, tune_samples, tune_output);
+    return 0;
+  }
 
-  // Testing our precision tracker - should be very accurate and quite fast.
-  testPrecisionTracker3D(track_manager, gt_folder);
+  // Track objects and evaluate the accuracy.
+  printf("Tracking objects - please wait...\n");
+  std::vector<BenchmarkResult> results;
+  runConfigs(track_manager, gt_folder, configs, cache_dir, concurrent,
+             count_events, &results);
+
+  printSummary(results);
+  if (!summary_file.empty()) {
+    writeSummary(summary_file, results);
+  }
 
-  // Testing our precision tracker with color - should be even more accurate
-  // but slow.
-  testPrecisionTrackerColor(track_manager, gt_folder);
+  for (size_t i = 0; i < results.size(); ++i) {
+    if (!results[i].ok) {
+      printf("Error - the checks of configuration %s failed\n",
+             results[i].name.c_str());
+      return (1);
+    }
+  }
 
   return 0;
 }